@@ -0,0 +1,117 @@
+/** **************************************************************************
+ * bandwidth.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#ifndef BANDWIDTH_H
+#define BANDWIDTH_H
+
+#include "request.h"
+
+// The bandwidth limits of an S3RequestContext (see
+// S3_set_request_context_bandwidth_limit): for the context as a whole, and
+// for each bucket given a limit of its own, a token bucket for downloads and
+// another for uploads.  Each is filled at its rate, up to a tenth of a
+// second's worth (but at least a buffer's worth), and emptied by the data
+// that every request of the context, or of the bucket, transfers.  A request
+// which finds a bucket empty pauses its transfer in that direction until the
+// bucket has filled again, which request_bandwidth_resume sees to.  A bucket
+// may go into debt by the one buffer which last emptied it, which the data
+// that follows pays off.
+//
+// Each token bucket also measures the rate at which data actually passes
+// through it, over the current window and the one before it, a window being
+// a second or more.
+
+
+typedef struct TokenBucket
+{
+    // Bytes per second, or 0 for no limit
+    int64_t rate;
+
+    // The bytes that may be transferred now (negative while in debt), and
+    // when that was last brought up to date
+    double tokens;
+    int64_t filledMs;
+
+    // The bytes transferred since windowStartMs, and in the window before,
+    // which started at previousStartMs
+    int64_t windowStartMs, windowBytes;
+    int64_t previousStartMs, previousBytes;
+} TokenBucket;
+
+
+typedef struct BandwidthLimit
+{
+    struct BandwidthLimit *next;
+
+    // The bucket name, stored after the structure, or 0 for the limits of
+    // the context as a whole
+    const char *bucketName;
+
+    TokenBucket download, upload;
+} BandwidthLimit;
+
+
+// Transfer directions
+#define BANDWIDTH_DOWNLOAD 0
+#define BANDWIDTH_UPLOAD 1
+
+
+// Returns the context's limits for the bucket (0 for the context as a whole),
+// creating them, unlimited, if create is nonzero; or 0 if there are none or
+// there was no memory for them
+BandwidthLimit *bandwidth_limit_get(S3RequestContext *context,
+                                    const char *bucketName, int create);
+
+// Sets the rate of a token bucket, taking effect straight away
+void bandwidth_set_rate(TokenBucket *bucket, int64_t rate);
+
+// Returns the rate measured for a token bucket
+double bandwidth_measured_rate(TokenBucket *bucket);
+
+// Returns how many bytes of up to len the request may transfer in the given
+// direction now; if none, the request is put on the context's list of paused
+// requests, and the caller must pause its transfer
+size_t bandwidth_allow(Request *request, int direction, size_t len);
+
+// Takes bytes which a request has transferred from its token buckets
+void bandwidth_use(Request *request, int direction, size_t bytes);
+
+// Unpauses the transfers of the context's paused requests for which there is
+// bandwidth again; returns nonzero if there were any
+int request_bandwidth_resume(S3RequestContext *context);
+
+// Takes a request off the context's list of paused requests
+void bandwidth_paused_remove(Request *request);
+
+// Returns the number of milliseconds until request_bandwidth_resume next
+// needs to be called, or -1 if there is no need
+int64_t bandwidth_timeout(S3RequestContext *context);
+
+// Frees all of the context's limits
+void bandwidth_limits_destroy(S3RequestContext *context);
+
+#endif /* BANDWIDTH_H */
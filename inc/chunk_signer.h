@@ -0,0 +1,89 @@
+/** **************************************************************************
+ * chunk_signer.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#ifndef CHUNK_SIGNER_H
+#define CHUNK_SIGNER_H
+
+#include <stdint.h>
+
+// Signs a request body as it is sent, in the aws-chunked encoding of
+// STREAMING-AWS4-HMAC-SHA256-PAYLOAD.  The body is cut into chunks of
+// CHUNK_SIGNER_CHUNK_SIZE bytes (the last one shorter), each sent as
+//   <hex size>;chunk-signature=<signature>\r\n<data>\r\n
+// and followed by a last chunk of no data.  Each chunk's signature covers
+// the SHA-256 of its data and the signature of the chunk before it, the
+// first chunk's being the signature of the request itself, so that the body
+// cannot be altered, reordered or cut short unnoticed.
+//
+// The data of each chunk is hashed as it is added to the chunk, and sent
+// straight from the chunk buffer once the chunk is signed, so it is neither
+// read twice nor held beyond one chunk.
+
+
+#define CHUNK_SIGNER_CHUNK_SIZE (64 * 1024)
+
+// The hex SHA-256 of no data, which is the payload hash of an empty body,
+// and which every chunk signature covers in place of the chunk's headers
+#define EMPTY_PAYLOAD_HASH \
+    "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"
+
+typedef struct ChunkSigner ChunkSigner;
+
+
+// Returns the length of the aws-chunked encoding of a body of length bytes
+int64_t chunk_signer_encoded_length(int64_t length);
+
+// Returns a new ChunkSigner for a request signed with the given signing key
+// (of 32 bytes), date (as YYYYMMDDTHHMMSSZ), credential scope and hex
+// signature, or 0 if there was no memory for it
+ChunkSigner *chunk_signer_create(const unsigned char *signingKey,
+                                 const char *date, const char *scope,
+                                 const char *seedSignature);
+
+void chunk_signer_destroy(ChunkSigner *signer);
+
+// Returns where the next bytes of data go in the chunk being filled, and in
+// *lenReturn, how many may go there; 0 if the chunk is full, or signed and
+// waiting to be sent
+char *chunk_signer_space(ChunkSigner *signer, int *lenReturn);
+
+// Adds len bytes, just written to the space chunk_signer_space returned, to
+// the chunk being filled
+void chunk_signer_add(ChunkSigner *signer, int len);
+
+// Signs the chunk being filled, which is sent next; signing an empty chunk
+// ends the body
+void chunk_signer_seal(ChunkSigner *signer);
+
+// Copies up to len bytes of the signed chunk being sent to buffer; returns
+// the number copied, 0 if there are none left to send
+int chunk_signer_output(ChunkSigner *signer, char *buffer, int len);
+
+// Returns nonzero once the last, empty, chunk has been signed
+int chunk_signer_ended(const ChunkSigner *signer);
+
+#endif /* CHUNK_SIGNER_H */
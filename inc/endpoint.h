@@ -0,0 +1,114 @@
+/** **************************************************************************
+ * endpoint.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include "request.h"
+
+// The endpoint balancing of an S3RequestContext (see
+// S3_set_request_context_endpoint_balancing).  For each host and port that
+// requests connect to, the context resolves the host itself and keeps the
+// addresses found, re-resolving them once they are older than the refresh
+// interval.  Host names are looked up on threads of their own, and until a
+// host's first lookup completes its requests connect as curl would.  Each
+// request is given one of the addresses, in turn or the one with the fewest
+// requests in flight, and connects to it by way of CURLOPT_CONNECT_TO; curl
+// keeps the connections to each address apart, so they are spread over all
+// of them instead of piling onto the first one.
+//
+// An address which a request fails to connect to is ejected: passed over for
+// a time which doubles with each failure in a row, up to a limit.  If every
+// address of a host is ejected, the one which is due back soonest is used.
+// Addresses which drop out of a refreshed resolution are kept for as long as
+// requests in flight use them, but are given no more.
+
+
+typedef struct EndpointAddress
+{
+    struct EndpointAddress *next;
+
+    // The address as curl takes it in CURLOPT_CONNECT_TO, with an IPv6
+    // address in brackets
+    char address[64];
+
+    // Nonzero once the address has dropped out of the host's resolution
+    int stale;
+
+    // The requests in flight given the address, and those ever given it
+    int inFlight;
+    int64_t requestCount;
+
+    // The connection failures in a row, and the monotonic time until which
+    // the address is ejected for them
+    int failures;
+    int64_t ejectedUntilMs;
+} EndpointAddress;
+
+
+typedef struct EndpointLookup EndpointLookup;
+
+
+typedef struct Endpoint
+{
+    struct Endpoint *next;
+
+    // The host and port, as "host:port", stored after the structure, and the
+    // length of the host part
+    const char *name;
+    int hostLen;
+
+    // The host's addresses, in the order resolved, and the one to try first
+    // for the next request
+    EndpointAddress *addresses;
+    int cursor;
+
+    // The lookup of the host under way, if there is one
+    EndpointLookup *lookup;
+
+    // When the host was last resolved, and last used
+    int64_t resolvedMs, usedMs;
+
+    // The requests in flight given any of the addresses
+    int inFlight;
+} Endpoint;
+
+
+// Gives a request one of the addresses of the host it is about to connect
+// to, setting its CURLOPT_CONNECT_TO, if the context is balancing endpoints.
+// A request which cannot be given one (because the host cannot be resolved,
+// say) connects as curl would otherwise.  Returns S3StatusOK unless the
+// curl handle could not be set up.
+S3Status endpoint_assign(Request *request);
+
+// Takes back the address given to a request which has completed with status
+void endpoint_release(Request *request, S3Status status);
+
+// Frees all of the context's Endpoints, which must not be in use
+void endpoints_destroy(S3RequestContext *context);
+
+#endif /* ENDPOINT_H */
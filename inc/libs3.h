@@ -205,6 +205,22 @@ extern "C" {
      sizeof("&Signature=") + 28 + 1)
 
 
+/**
+ * This is the number of characters (including terminating \0) stored for
+ * each buffer by S3_compute_content_md5s: the 24 characters of the base64
+ * MD5, as the md5 of S3PutProperties takes it
+ **/
+#define S3_CONTENT_MD5_SIZE                25
+
+
+/**
+ * This is the number of characters (including terminating \0) stored for
+ * each buffer by S3_compute_sha256s: the 64 lowercase hex digits of the
+ * SHA-256
+ **/
+#define S3_SHA256_HEX_SIZE                 65
+
+
 /**
  * This constant is used by the S3_initialize() function, to specify that
  * the winsock library should be initialized by libs3; only relevent on
@@ -219,6 +235,31 @@ extern "C" {
  * basis by calling S3_set_request_context_verify_peer).
  */
 #define S3_INIT_VERIFY_PEER                2
+/**
+ * This constant is used by the S3_initialize() function, to make every
+ * request share one DNS cache, one SSL session cache and one connection
+ * cache, no matter which thread or S3RequestContext issues it.  Without it,
+ * each request handle keeps its own caches, so a handle that has never been
+ * used before must repeat the DNS lookup and perform a full TLS handshake
+ * even if another handle has already connected to the same host.  This
+ * matters most for short-lived synchronous callers that never use an
+ * S3RequestContext.  The shared caches are protected by locks, which adds a
+ * little overhead to every request.
+ */
+#define S3_INIT_SHARE_CACHES               4
+/**
+ * This constant is used by the S3_initialize() function, to sign the
+ * payloads of all requests by default.  Without it, the data sent by PUTs
+ * and POSTs is not covered by their signatures (they are sent with an
+ * x-amz-content-sha256 of UNSIGNED-PAYLOAD), which some S3-compatible
+ * services refuse.  With it, the data is sent in the aws-chunked encoding
+ * of STREAMING-AWS4-HMAC-SHA256-PAYLOAD: in chunks of 64 KB, each signed as
+ * it is sent, so that the server can tell if any of it was altered on the
+ * way.  The data is still only read once, and the chunk headers add about
+ * 0.15% to what is sent.  This can be overridden for the requests of an
+ * S3RequestContext by calling S3_set_request_context_sign_payloads.
+ **/
+#define S3_INIT_SIGN_PAYLOADS              8
 
 
 /**
@@ -228,6 +269,19 @@ extern "C" {
 #define S3_INIT_ALL                        (S3_INIT_WINSOCK)
 
 
+/**
+ * These flags describe socket events, for S3RequestContexts which are driven
+ * by an external event loop (see
+ * S3_create_request_context_with_event_callbacks).  S3_SOCKET_EVENT_READ and
+ * S3_SOCKET_EVENT_WRITE are passed to the S3RequestContextSocketCallback to
+ * say which events libs3 is interested in; any of the three are passed to
+ * S3_process_request_context_socket to say which events have occurred.
+ **/
+#define S3_SOCKET_EVENT_READ               1
+#define S3_SOCKET_EVENT_WRITE              2
+#define S3_SOCKET_EVENT_ERROR              4
+
+
 /**
  * The default region identifier used to scope the signing key
  */
@@ -393,7 +447,13 @@ typedef enum
     S3StatusHttpErrorForbidden                              ,
     S3StatusHttpErrorNotFound                               ,
     S3StatusHttpErrorConflict                               ,
-    S3StatusHttpErrorUnknown
+    S3StatusHttpErrorUnknown                                ,
+
+    /**
+     * Errors that prevent a libs3 function from completing, added after the
+     * above, so as not to change their values
+     **/
+    S3StatusBufferTooSmall
 } S3Status;
 
 
@@ -502,6 +562,40 @@ typedef enum
 } S3CannedAcl;
 
 
+/**
+ * S3RequestContextEngine selects the mechanism an S3RequestContext uses to
+ * wait for and dispatch network I/O.
+ *
+ * S3RequestContextEngineSelect rebuilds fd_sets and polls every socket of
+ * every transfer on each pass, so each wakeup costs time proportional to
+ * the number of transfers, and no more than FD_SETSIZE (typically 1024)
+ * sockets can be watched.
+ *
+ * S3RequestContextEngineEpoll keeps every socket registered with an epoll
+ * instance, and only visits the sockets which actually have I/O pending, so
+ * each wakeup costs time proportional to the number of active sockets, and
+ * there is no limit on the number of sockets beyond the process's file
+ * descriptor limit.  It is only available on Linux.
+ *
+ * S3RequestContextEngineExternal leaves waiting for I/O to the caller's own
+ * event loop; it is the engine of contexts created by
+ * S3_create_request_context_with_event_callbacks, and cannot be passed to
+ * S3_create_request_context_with_engine.
+ *
+ * S3RequestContextEngineThreaded runs requests on worker threads owned by
+ * the context, each with an event loop of its own; it is the engine of
+ * contexts created by S3_create_request_context_threaded, and cannot be
+ * passed to S3_create_request_context_with_engine.
+ **/
+typedef enum
+{
+    S3RequestContextEngineSelect        = 0,
+    S3RequestContextEngineEpoll         = 1,
+    S3RequestContextEngineExternal      = 2,
+    S3RequestContextEngineThreaded      = 3
+} S3RequestContextEngine;
+
+
 /** **************************************************************************
  * Data Types
  ************************************************************************** **/
@@ -513,6 +607,21 @@ typedef enum
 typedef struct S3RequestContext S3RequestContext;
 
 
+/**
+ * An S3KeepWarm keeps a number of connections to a bucket's host open and
+ * ready for use in the background; see S3_start_keep_warm
+ **/
+typedef struct S3KeepWarm S3KeepWarm;
+
+
+/**
+ * An S3RequestHandle identifies one request made on an S3RequestContext, so
+ * that it can be cancelled; see S3_get_last_request_handle.  Handles are
+ * never re-used, and 0 is never a valid handle.
+ **/
+typedef uint64_t S3RequestHandle;
+
+
 /**
  * S3NameValue represents a single Name - Value pair, used to represent either
  * S3 metadata associated with a key, or S3 error details.
@@ -988,6 +1097,100 @@ typedef struct S3ErrorDetails
 } S3ErrorDetails;
 
 
+/**
+ * S3RequestPoolStats gives counts of how requests have been served by the
+ * pool of idle request handles that libs3 keeps for re-use.  A request which
+ * is served from the pool can re-use the live connection of the handle it is
+ * given; a miss means that a new handle (and thus a new connection) had to be
+ * created.  All counts are since S3_initialize() was called.
+ **/
+typedef struct S3RequestPoolStats
+{
+    /**
+     * Requests served from the calling thread's private cache of handles
+     **/
+    uint64_t threadCacheHits;
+
+    /**
+     * Requests served from the pool shared by all threads
+     **/
+    uint64_t sharedPoolHits;
+
+    /**
+     * Requests for which no idle handle was available
+     **/
+    uint64_t misses;
+
+    /**
+     * Handles destroyed when finished with because the pool was full
+     **/
+    uint64_t discards;
+} S3RequestPoolStats;
+
+
+/**
+ * S3Completion describes a request which has completed in an
+ * S3RequestContext with a completion queue; see
+ * S3_set_request_context_completion_queue.  It remains valid until it is
+ * passed to S3_release_completion, regardless of what becomes of the
+ * S3RequestContext.
+ **/
+typedef struct S3Completion
+{
+    /**
+     * This is the callback data given to the request's complete callback;
+     * for the object requests (S3_get_object, S3_put_object,
+     * S3_head_object, S3_delete_object and S3_upload_part), this is the
+     * callbackData passed when the request was made
+     **/
+    void *callbackData;
+
+    /**
+     * This gives the overall status of the request, exactly as would have
+     * been passed to its complete callback
+     **/
+    S3Status status;
+
+    /**
+     * If non-NULL, this gives details as returned by the S3 service,
+     * describing the error
+     **/
+    const S3ErrorDetails *error;
+
+    /**
+     * If non-NULL, this gives the properties of the response (which may be
+     * an error response); this is NULL if no response was received
+     **/
+    const S3ResponseProperties *properties;
+} S3Completion;
+
+
+/**
+ * S3HedgeStats gives counts of how an S3RequestContext has hedged its
+ * requests; see S3_set_request_context_hedging.  All counts are since the
+ * S3RequestContext was created.
+ **/
+typedef struct S3HedgeStats
+{
+    /**
+     * GETs and HEADs started while hedging was enabled
+     **/
+    uint64_t hedgeableCount;
+
+    /**
+     * Duplicate requests started because the original had not received a
+     * response within the hedging threshold
+     **/
+    uint64_t hedgeCount;
+
+    /**
+     * Duplicate requests which received a response before the original did,
+     * and so replaced it
+     **/
+    uint64_t hedgeWinCount;
+} S3HedgeStats;
+
+
 /** **************************************************************************
  * Callback Signatures
  ************************************************************************** **/
@@ -1116,6 +1319,22 @@ typedef int (S3PutObjectDataCallback)(int bufferSize, char *buffer,
                                       void *callbackData);
 
 
+/**
+ * This callback is made before a request which sends data, such as a put
+ * object operation, is retried by an S3RequestContext with a retry policy
+ * (see S3_set_request_context_retry_policy).  It must arrange for the
+ * S3PutObjectDataCallback of the request to supply the data again from the
+ * beginning.
+ *
+ * @param callbackData is the callback data as specified when the request
+ *        was issued.
+ * @return 0 if the data can be supplied again, in which case the request is
+ *         retried, or nonzero if it cannot, in which case the request
+ *         completes with the status of its last attempt
+ **/
+typedef int (S3PutObjectRewindCallback)(void *callbackData);
+
+
 /**
  * This callback is made during a get object operation, to provide the next
  * chunk of data available from the S3 service constituting the contents of
@@ -1240,6 +1459,49 @@ typedef S3Status (S3MultipartCommitResponseCallback)(const char *location,
                                                      void *callbackData);
 
 
+/**
+ * This callback is made by an S3RequestContext created with
+ * S3_create_request_context_with_event_callbacks whenever the set of events
+ * it wants to be told about on one of its sockets changes.  The caller's
+ * event loop should from then on watch the socket for exactly those events,
+ * and report them with S3_process_request_context_socket.
+ *
+ * This callback is made from within libs3 request processing, and so must
+ * not call back into any libs3 function for the same S3RequestContext.
+ *
+ * @param fd is the socket
+ * @param events is S3_SOCKET_EVENT_READ and/or S3_SOCKET_EVENT_WRITE or'd
+ *        together, or 0 if the socket should no longer be watched at all
+ *        (the socket may be closed immediately after this callback returns)
+ * @param callbackData is the callback data passed to
+ *        S3_create_request_context_with_event_callbacks
+ **/
+typedef void (S3RequestContextSocketCallback)(int fd, int events,
+                                              void *callbackData);
+
+
+/**
+ * This callback is made by an S3RequestContext created with
+ * S3_create_request_context_with_event_callbacks whenever the time at which
+ * it next needs S3_process_request_context_timeout to be called changes.
+ * Each call replaces any timeout set by a previous call.  The timeout is a
+ * one-shot: it should be disarmed once it has fired.
+ *
+ * This callback is made from within libs3 request processing, and so must
+ * not call back into any libs3 function for the same S3RequestContext; in
+ * particular, a timeout of 0 should be handled on the next pass of the event
+ * loop rather than from within this callback.
+ *
+ * @param timeoutMs is the number of milliseconds from now after which
+ *        S3_process_request_context_timeout should be called, 0 meaning
+ *        as soon as possible, or -1 to cancel the timeout
+ * @param callbackData is the callback data passed to
+ *        S3_create_request_context_with_event_callbacks
+ **/
+typedef void (S3RequestContextTimerCallback)(int64_t timeoutMs,
+                                             void *callbackData);
+
+
 /** **************************************************************************
  * Callback Structures
  ************************************************************************** **/
@@ -1406,6 +1668,203 @@ typedef struct S3AbortMultipartUploadHandler
 
 } S3AbortMultipartUploadHandler;
 
+
+/**
+ * An S3RetryPolicy describes how an S3RequestContext retries requests which
+ * fail in a way that may succeed if tried again; see
+ * S3_set_request_context_retry_policy.
+ *
+ * The delay before each retry is drawn at random between baseDelayMs and
+ * three times the previous delay for that request, but no more than
+ * maxDelayMs ("decorrelated jitter"), so that many requests failing at once
+ * are spread out when they are retried.
+ *
+ * Retries are also limited by a budget shared by all of the requests in the
+ * context: a bucket of budgetTokens tokens, from which each retry takes
+ * retryCost tokens, and to which each request which succeeds returns one
+ * token (or retryCost tokens, if it succeeded on a retry).  When a service
+ * fails most requests, the bucket soon empties and requests fail without
+ * being retried, rather than multiplying the load on the service.
+ **/
+typedef struct S3RetryPolicy
+{
+    /**
+     * The most times that any one request is retried, after its first
+     * attempt; 0 disables retries
+     **/
+    int maxRetries;
+
+    /**
+     * The least delay in milliseconds before a retry; 0 means 100
+     **/
+    int baseDelayMs;
+
+    /**
+     * The greatest delay in milliseconds before a retry; 0 means 20000
+     **/
+    int maxDelayMs;
+
+    /**
+     * The size of the retry budget; 0 means that retries are not limited by
+     * a budget
+     **/
+    int budgetTokens;
+
+    /**
+     * The number of tokens that each retry takes from the budget; 0 means 5
+     **/
+    int retryCost;
+
+    /**
+     * Called before retrying a request which sends data; if this is 0, such
+     * requests are never retried
+     **/
+    S3PutObjectRewindCallback *rewindCallback;
+} S3RetryPolicy;
+
+
+/**
+ * An S3RateLimit gives the rate to which an S3RequestContext is limiting the
+ * requests it starts for one bucket and key prefix; see
+ * S3_get_request_context_rate_limits.
+ **/
+typedef struct S3RateLimit
+{
+    /**
+     * The name of the bucket
+     **/
+    const char *bucketName;
+
+    /**
+     * The key prefix: the keys up to and including their last '/', which is
+     * the empty string for keys without a '/' (and for requests without a
+     * key)
+     **/
+    const char *prefix;
+
+    /**
+     * The requests per second started for the bucket and prefix
+     **/
+    double requestsPerSecond;
+} S3RateLimit;
+
+
+/**
+ * An S3Bandwidth gives the bandwidth limits of an S3RequestContext, or of
+ * one bucket within it, and the rates at which data has been transferred;
+ * see S3_get_request_context_bandwidth.
+ **/
+typedef struct S3Bandwidth
+{
+    /**
+     * The limits in bytes per second on data received and sent; 0 for no
+     * limit
+     **/
+    int64_t downloadLimit;
+    int64_t uploadLimit;
+
+    /**
+     * The rates in bytes per second at which data was received and sent,
+     * measured over about the last second
+     **/
+    double downloadBytesPerSecond;
+    double uploadBytesPerSecond;
+} S3Bandwidth;
+
+
+/**
+ * S3EndpointBalancing says how an S3RequestContext spreads its connections
+ * over the addresses of the hosts it connects to; see
+ * S3_set_request_context_endpoint_balancing.
+ **/
+typedef enum
+{
+    /**
+     * Connections go wherever curl's own resolution of the host takes them
+     **/
+    S3EndpointBalancingNone                         = 0,
+
+    /**
+     * Each request is given the next of the host's addresses in turn
+     **/
+    S3EndpointBalancingRoundRobin                   = 1,
+
+    /**
+     * Each request is given the address with the fewest requests in flight,
+     * taking them in turn among those with equally few
+     **/
+    S3EndpointBalancingLeastLoaded                  = 2
+} S3EndpointBalancing;
+
+
+/**
+ * An S3EndpointAddress describes one address of a host which an
+ * S3RequestContext balances its connections over; see
+ * S3_get_request_context_endpoints.
+ **/
+typedef struct S3EndpointAddress
+{
+    /**
+     * The host and port, as "host:port"
+     **/
+    const char *hostName;
+
+    /**
+     * The numeric address, with an IPv6 address in brackets
+     **/
+    const char *address;
+
+    /**
+     * The number of requests in flight which were given the address, and
+     * the number ever given it
+     **/
+    int inFlight;
+    int64_t requestCount;
+
+    /**
+     * Nonzero while the address is ejected for failing to connect
+     **/
+    int ejected;
+} S3EndpointAddress;
+
+
+/**
+ * An S3RequestTimeouts limits how long the requests of an S3RequestContext
+ * may take over each phase; see S3_set_request_context_timeouts.  A request
+ * which runs out of time fails with S3StatusErrorRequestTimeout.
+ **/
+typedef struct S3RequestTimeouts
+{
+    /**
+     * The most milliseconds that each attempt at a request may take to
+     * connect, including looking up the host name and any TLS handshake; 0
+     * means libcurl's default of 300 seconds.  An attempt on a connection
+     * which is already open has nothing to wait for.
+     **/
+    int connectTimeoutMs;
+
+    /**
+     * The most milliseconds that each attempt at a request may wait, from
+     * when it starts, for the first of its response headers; 0 for no limit
+     **/
+    int firstByteTimeoutMs;
+
+    /**
+     * The most milliseconds that each attempt at a request may go on
+     * transferring less than 1024 bytes a second before it is given up on as
+     * stalled, rounded up to whole seconds; 0 means 15 seconds
+     **/
+    int stallTimeoutMs;
+
+    /**
+     * The most milliseconds that a request may take from when it is made to
+     * when it completes, including any time spent waiting to start, waiting
+     * to be retried, and being retried; 0 for no limit.  The per-request
+     * timeoutMs of the request functions still limits each attempt.
+     **/
+    int deadlineMs;
+} S3RequestTimeouts;
+
 /** **************************************************************************
  * General Library Functions
  ************************************************************************** **/
@@ -1436,6 +1895,10 @@ typedef struct S3AbortMultipartUploadHandler
  *        all necessary initialization; however, be warned that things may
  *        break if your application re-initializes the dependent libraries
  *        later.
+ *
+ *        S3_INIT_VERIFY_PEER, S3_INIT_SHARE_CACHES and S3_INIT_SIGN_PAYLOADS
+ *        may additionally be or'd in to change the default behavior of
+ *        requests; see their descriptions.
  * @param defaultS3HostName is a string the specifies the default S3 server
  *        hostname to use when making S3 requests; this value is used
  *        whenever the hostName of an S3BucketContext is NULL.  If NULL is
@@ -1460,6 +1923,34 @@ S3Status S3_initialize(const char *userAgentInfo, int flags,
 void S3_deinitialize();
 
 
+/**
+ * Sets the number of idle request handles that libs3 will keep for re-use in
+ * the pool shared by all threads.  Each thread additionally keeps a small
+ * number of idle handles to itself, so that a thread issuing request after
+ * request does not need to touch the shared pool at all.  Handles returned
+ * when the pool is full are destroyed, along with their connections, so the
+ * capacity should be at least the number of requests expected to be in
+ * flight at once.
+ *
+ * This function must be called before S3_initialize() to have any effect;
+ * the pool is sized when libs3 is initialized.
+ *
+ * @param capacity is the number of handles to keep, or 0 to use the default,
+ *        which is a multiple of the number of online CPUs
+ **/
+void S3_set_request_pool_capacity(int capacity);
+
+
+/**
+ * Returns counts of how requests have been served by the request handle
+ * pool.  Counts made by other threads that are concurrently issuing requests
+ * may be slightly out of date.
+ *
+ * @param statsReturn returns the counts
+ **/
+void S3_get_request_pool_stats(S3RequestPoolStats *statsReturn);
+
+
 /**
  * Returns a string with the textual name of an S3Status code
  *
@@ -1558,6 +2049,40 @@ S3Status S3_convert_acl(char *aclXml, char *ownerId, char *ownerDisplayName,
 int S3_status_is_retryable(S3Status status);
 
 
+/**
+ * Computes the Content-MD5 of each of a number of buffers, such as the parts
+ * of a multipart upload, for the md5 of the S3PutProperties with which each
+ * is sent.  Where the CPU has AVX2 or AVX-512, the buffers are hashed 8 or
+ * 16 at a time, one to each lane of the vectors, which is many times
+ * faster than hashing them one after another; so it is better to pass
+ * several buffers to one call than one buffer to each of several calls.
+ *
+ * @param count is the number of buffers
+ * @param buffers gives the buffers
+ * @param sizes gives the size of each buffer, in bytes
+ * @param md5s returns the base64 MD5 of each buffer
+ **/
+void S3_compute_content_md5s(int count, const char *const *buffers,
+                             const uint64_t *sizes,
+                             char (*md5s)[S3_CONTENT_MD5_SIZE]);
+
+
+/**
+ * Computes the SHA-256 of each of a number of buffers, as
+ * S3_compute_content_md5s does the MD5.  Where the CPU has the SHA
+ * extensions, which hash one buffer at a time quickly, the buffers are only
+ * hashed together when there are enough of them to fill the vectors.
+ *
+ * @param count is the number of buffers
+ * @param buffers gives the buffers
+ * @param sizes gives the size of each buffer, in bytes
+ * @param sha256s returns the lowercase hex SHA-256 of each buffer
+ **/
+void S3_compute_sha256s(int count, const char *const *buffers,
+                        const uint64_t *sizes,
+                        char (*sha256s)[S3_SHA256_HEX_SIZE]);
+
+
 /** **************************************************************************
  * Request Context Management Functions
  ************************************************************************** **/
@@ -1583,6 +2108,117 @@ int S3_status_is_retryable(S3Status status);
 S3Status S3_create_request_context(S3RequestContext **requestContextReturn);
 
 
+/**
+ * Creates an S3RequestContext exactly as S3_create_request_context does, but
+ * with a choice of the event engine used to drive its requests.  A context
+ * created by S3_create_request_context uses S3RequestContextEngineSelect.
+ *
+ * All of the S3_XXX_request_context functions work with either engine.  With
+ * S3RequestContextEngineEpoll, S3_get_request_context_fdsets sets just one
+ * file descriptor, into readFdSet, which becomes readable whenever any of the
+ * context's requests has I/O pending.
+ *
+ * @param requestContextReturn returns the newly-created S3RequestContext
+ *        structure, as for S3_create_request_context
+ * @param engine gives the event engine to use
+ * @return One of:
+ *         S3StatusOK if the request context was successfully created
+ *         S3StatusOutOfMemory if the request context could not be created due
+ *             to an out of memory error
+ *         S3StatusNotSupported if the engine is not available on this
+ *             platform
+ *         S3StatusInternalError if the engine could not be set up
+ **/
+S3Status S3_create_request_context_with_engine
+    (S3RequestContext **requestContextReturn, S3RequestContextEngine engine);
+
+
+/**
+ * Creates an S3RequestContext which is driven by the caller's own event loop
+ * (epoll, kqueue, libevent, etc.) rather than by libs3 polling its sockets.
+ * libs3 tells the caller which sockets to watch, and for which events, via
+ * socketCallback, and when it next needs to be called regardless of socket
+ * activity via timerCallback; the caller reports socket events with
+ * S3_process_request_context_socket, and expired timeouts with
+ * S3_process_request_context_timeout.  Each of those only does the work
+ * made necessary by the event, without polling any other socket.
+ *
+ * Requests are added to the context in the usual way, by passing it to the
+ * libs3 request functions; doing so arms the timer (typically with a timeout
+ * of 0) so that the request is started by the next call to
+ * S3_process_request_context_timeout.  The timer also covers the context's
+ * own schedule (hedges, retries, resumes, time-to-first-byte limits, and
+ * requests and transfers held back by rate and bandwidth limits), so every
+ * S3_set_request_context_XXX setting works as it does for any other
+ * context.  S3_runall_request_context, S3_runonce_request_context,
+ * S3_get_request_context_fdsets and S3_get_request_context_timeout cannot be
+ * used with such a context, and return S3StatusNotSupported (or, for the
+ * timeout, -1).
+ *
+ * @param requestContextReturn returns the newly-created S3RequestContext
+ *        structure, as for S3_create_request_context
+ * @param socketCallback is called whenever the events of interest on one of
+ *        the context's sockets change
+ * @param timerCallback is called whenever the context's timeout changes
+ * @param callbackData is passed to socketCallback and timerCallback
+ * @return One of:
+ *         S3StatusOK if the request context was successfully created
+ *         S3StatusOutOfMemory if the request context could not be created due
+ *             to an out of memory error
+ *         S3StatusInternalError if the callbacks could not be installed
+ **/
+S3Status S3_create_request_context_with_event_callbacks
+    (S3RequestContext **requestContextReturn,
+     S3RequestContextSocketCallback *socketCallback,
+     S3RequestContextTimerCallback *timerCallback, void *callbackData);
+
+
+/**
+ * Creates an S3RequestContext whose requests are run by threadCount worker
+ * threads belonging to it, so that the work of many concurrent requests (TLS
+ * in particular) is spread over that many CPU cores.  Unlike any other
+ * S3RequestContext, requests may be added to it from any number of threads
+ * at once, without locking; each request is handed to the next worker in
+ * turn, which is woken up to start it straight away.
+ *
+ * The callbacks of the requests are made on the worker threads, several at a
+ * time, and so must be thread-safe.  They may add further requests to the
+ * context.
+ *
+ * The requests run without any help from the caller.
+ * S3_runall_request_context waits until every request added to the context
+ * has completed (and so must not be called from a request callback), and
+ * S3_runonce_request_context just returns the number of requests which have
+ * not completed.  S3_get_request_context_fdsets returns
+ * S3StatusNotSupported, and S3_get_request_context_timeout returns -1.
+ *
+ * S3_set_request_context_max_in_flight,
+ * S3_set_request_context_max_connections_per_host,
+ * S3_set_request_context_http2 and S3_set_request_context_hedging apply to
+ * each worker separately; for example,
+ * a maximum of 2 connections per host allows 2 per worker.  These, and the
+ * other S3_set_request_context_XXX functions, must not be called while
+ * another thread is adding requests to the context.
+ *
+ * Destroying the context stops the workers and completes every request not
+ * yet completed with S3StatusInterrupted.
+ *
+ * @param requestContextReturn returns the newly-created S3RequestContext
+ *        structure, as for S3_create_request_context
+ * @param threadCount is the number of worker threads to run requests on;
+ *        typically the number of CPU cores available
+ * @return One of:
+ *         S3StatusOK if the request context was successfully created
+ *         S3StatusOutOfMemory if the request context could not be created due
+ *             to an out of memory error
+ *         S3StatusNotSupported if the version of libcurl in use is older than
+ *             7.68.0, which is needed to wake up the workers
+ *         S3StatusInternalError if a worker thread could not be started
+ **/
+S3Status S3_create_request_context_threaded
+    (S3RequestContext **requestContextReturn, int threadCount);
+
+
 /**
  * Destroys an S3RequestContext which was created with
  * S3_create_request_context.  Any requests which are currently being
@@ -1705,6 +2341,596 @@ void S3_set_request_context_verify_peer(S3RequestContext *requestContext,
                                         int verifyPeer);
 
 
+/**
+ * Sets whether the requests of an S3RequestContext sign their payloads (see
+ * S3_INIT_SIGN_PAYLOADS), overriding the default set by the flags given to
+ * S3_initialize().  This only affects requests made after it is called.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param signPayloads is nonzero to sign payloads, 0 not to
+ **/
+void S3_set_request_context_sign_payloads(S3RequestContext *requestContext,
+                                          int signPayloads);
+
+
+/**
+ * Gives an S3RequestContext a completion queue, so that the complete
+ * callbacks of its requests are no longer made by whichever function of the
+ * context's is running the requests when they complete.  Instead, an
+ * S3Completion is posted to the queue for each request, holding its status
+ * together with copies of its error details and response properties, and the
+ * application takes completions from the queue with
+ * S3_get_request_context_completions whenever it chooses.  The complete
+ * callback of the request is then made by S3_release_completion, on the
+ * thread which calls it.  A slow complete callback therefore no longer holds
+ * up the context's other requests.
+ *
+ * The other callbacks of the requests (properties, data and so on) are still
+ * made while the requests are run, as are the complete callbacks of requests
+ * which could not even be made (for example, for lack of memory).  Requests
+ * interrupted by S3_destroy_request_context also have their complete
+ * callbacks made directly, as do those of any completions which were never
+ * taken from the queue.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param enable is nonzero to give the context a completion queue, zero to
+ *        go back to making complete callbacks directly
+ **/
+void S3_set_request_context_completion_queue(S3RequestContext *requestContext,
+                                             int enable);
+
+
+/**
+ * Takes up to maxCompletions completions from the completion queue of an
+ * S3RequestContext, in the order in which the requests completed.  Every
+ * completion taken must be released with S3_release_completion.  This
+ * function may be called while the context's requests are being run, but
+ * not by more than one thread at a time.
+ *
+ * @param requestContext is the S3RequestContext to take completions from
+ * @param completionsReturn is an array of maxCompletions elements, into the
+ *        first elements of which the completions are returned
+ * @param maxCompletions is the most completions to take
+ * @return the number of completions taken, which is 0 if there were none
+ **/
+int S3_get_request_context_completions(S3RequestContext *requestContext,
+                                       S3Completion **completionsReturn,
+                                       int maxCompletions);
+
+
+/**
+ * Makes the complete callback of the request described by an S3Completion,
+ * and frees the S3Completion.
+ *
+ * @param completion is the S3Completion to release
+ **/
+void S3_release_completion(S3Completion *completion);
+
+
+/**
+ * Limits the number of requests which an S3RequestContext has in flight at
+ * once.  Requests made on the context while it is at its limit wait, in the
+ * order in which they were made, until requests in flight complete; only a
+ * compact copy of each waiting request's parameters is kept, so queueing
+ * even very large numbers of requests costs neither sockets nor the memory
+ * of a full request.  Waiting requests are signed when they are started, not
+ * when they are queued.  Requests waiting when the context is destroyed
+ * complete with S3StatusInterrupted.
+ *
+ * Waiting requests count as remaining requests for the purposes of
+ * S3_runall_request_context and S3_runonce_request_context.
+ *
+ * @param requestContext is the S3RequestContext to limit
+ * @param maxInFlight is the maximum number of requests in flight, or 0 (the
+ *        default) for no limit
+ **/
+void S3_set_request_context_max_in_flight(S3RequestContext *requestContext,
+                                          int maxInFlight);
+
+
+/**
+ * Limits the number of connections which an S3RequestContext opens to any
+ * one host.  Requests in flight which cannot be given a connection wait
+ * until one is free.
+ *
+ * @param requestContext is the S3RequestContext to limit
+ * @param maxConnections is the maximum number of connections per host, or 0
+ *        (the default) for no limit
+ * @return One of:
+ *         S3StatusOK if the limit was set
+ *         S3StatusNotSupported if the version of libcurl in use cannot limit
+ *             connections per host
+ **/
+S3Status S3_set_request_context_max_connections_per_host
+    (S3RequestContext *requestContext, int maxConnections);
+
+
+/**
+ * Makes the requests of an S3RequestContext use HTTP/2, with many requests
+ * to the same host multiplexed as concurrent streams over a single
+ * connection, instead of one connection per request in flight.  This
+ * greatly reduces the number of connections (and TLS handshakes) needed for
+ * many small concurrent requests.  Synchronous requests (which have no
+ * S3RequestContext) are never affected.
+ *
+ * For S3ProtocolHTTPS, HTTP/2 is negotiated during the TLS handshake, and
+ * servers which do not support it are spoken to with HTTP/1.1 as usual.  For
+ * S3ProtocolHTTP there is no negotiation: HTTP/2 is spoken from the start,
+ * so the server must be known to support it.
+ *
+ * This should be called before any requests are added to the context.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param enable is nonzero to use HTTP/2, zero to go back to HTTP/1.1
+ * @param maxStreams is the maximum number of concurrent streams on one
+ *        connection (if the server allows that many), beyond which further
+ *        connections are opened; 0 means the default of 100.  Ignored by
+ *        versions of libcurl older than 7.67.0.
+ * @return One of:
+ *         S3StatusOK if the setting was changed
+ *         S3StatusNotSupported if the version of libcurl in use does not
+ *             support HTTP/2
+ *         S3StatusInternalError if libcurl rejected the setting
+ **/
+S3Status S3_set_request_context_http2(S3RequestContext *requestContext,
+                                      int enable, int maxStreams);
+
+
+/**
+ * Enables hedging of the GETs and HEADs (S3_get_object and S3_head_object)
+ * made in an S3RequestContext.  When such a request has not received a
+ * response within the hedging threshold, an identical request is started
+ * alongside it, and whichever of the two receives a response first is the
+ * one whose callbacks are made; the other is abandoned.  This trades a
+ * little extra load on the service for much lower tail latency when a small
+ * fraction of requests are slow to be answered.
+ *
+ * The threshold is either fixed, or follows a percentile of the times to
+ * first byte of recent requests in the context; for example, a percentile
+ * of 95 hedges roughly the slowest 5% of requests.  Until enough requests
+ * have completed to estimate the percentile, the fixed threshold is used, if
+ * given.
+ *
+ * Hedges are not counted against S3_set_request_context_max_in_flight.
+ * Requests whose callbacks have already received data cannot be hedged, and
+ * so only the time until the response headers arrive is measured.  For a
+ * threaded S3RequestContext, each worker keeps its own percentile.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param thresholdMs is the time in milliseconds after which a request
+ *        which has not received a response is hedged, or 0 for none
+ * @param percentile is the percentile (1 to 99) of recent times to first
+ *        byte after which a request is hedged, or 0 for none; if both this
+ *        and thresholdMs are 0, hedging is disabled
+ * @return S3StatusOK; the setting is always changed
+ **/
+S3Status S3_set_request_context_hedging(S3RequestContext *requestContext,
+                                        int thresholdMs, int percentile);
+
+
+/**
+ * Returns counts of how an S3RequestContext has hedged its requests; for a
+ * threaded S3RequestContext, these are the sums over its workers.
+ *
+ * @param requestContext is the S3RequestContext to get the counts of
+ * @param statsReturn returns the counts
+ **/
+void S3_get_request_context_hedge_stats(S3RequestContext *requestContext,
+                                        S3HedgeStats *statsReturn);
+
+
+/**
+ * Returns the handle of the request most recently made by the calling thread
+ * (by S3_get_object, S3_put_object, or any other function which makes a
+ * request), for passing to S3_cancel_request.  Call this straight after the
+ * function which made the request returns.
+ *
+ * @return the handle of the request, or 0 if the request was performed
+ *         synchronously (with no S3RequestContext), in which case it has
+ *         already completed
+ **/
+S3RequestHandle S3_get_last_request_handle();
+
+
+/**
+ * Cancels one request made on an S3RequestContext, leaving the context's
+ * other requests, and the connections that they use, untouched.  A request
+ * which is cancelled before it completes has its complete callback made
+ * with S3StatusInterrupted, and makes no further callbacks; its connection
+ * is closed if a response was still arriving on it, but its curl handle is
+ * kept for re-use by later requests.  Cancelling a request which has already
+ * completed does nothing.
+ *
+ * This may be called from within the callbacks of requests in the same
+ * S3RequestContext, including those of the request being cancelled; the
+ * request is then completed as soon as the callback returns.  For a threaded
+ * S3RequestContext, it may be called from any thread, and the request is
+ * completed on its worker thread shortly afterwards.
+ *
+ * @param requestContext is the S3RequestContext which the request was made
+ *        on
+ * @param handle is the handle of the request, as returned by
+ *        S3_get_last_request_handle
+ * @return One of:
+ *         S3StatusOK if the request has been, or will shortly be, cancelled,
+ *             or had already completed
+ *         S3StatusOutOfMemory if the workers of a threaded
+ *             S3RequestContext could not be asked to cancel the request
+ **/
+S3Status S3_cancel_request(S3RequestContext *requestContext,
+                           S3RequestHandle handle);
+
+
+/**
+ * Gives an S3RequestContext a policy for retrying its requests.  A request
+ * which fails with a status for which S3_status_is_retryable returns
+ * nonzero, or with S3StatusErrorSlowDown (for which a delay is just what the
+ * service asks for), is then made again after a delay, rather than
+ * completing, until it
+ * succeeds, fails in some other way, or the policy allows no more retries.
+ * Only the status of the last attempt is passed to the complete callback.
+ *
+ * The delay is waited out by the context's event loop along with everything
+ * else, so a request waiting to be retried counts among the requests
+ * remaining in the context, and S3_get_request_context_timeout allows for
+ * it.  A request is not retried once it has received a successful response,
+ * since its callbacks may already have been given some of that response;
+ * nor, if it sends data, unless the policy has a rewind callback.  Only the
+ * data of S3_put_object and S3_upload_part can be rewound; other requests
+ * which send data are never retried.  A request
+ * waiting to be retried may be cancelled with S3_cancel_request.
+ *
+ * Synchronous requests (which have no S3RequestContext) are never
+ * retried.  For a threaded
+ * S3RequestContext, each worker has its own retry budget.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param policy is the policy to use, which is copied; 0 disables retries
+ * @return S3StatusOK; the policy is always set
+ **/
+S3Status S3_set_request_context_retry_policy(S3RequestContext *requestContext,
+                                             const S3RetryPolicy *policy);
+
+
+/**
+ * Turns adaptive rate limiting on or off for an S3RequestContext.  S3
+ * answers requests beyond the rate which a bucket's key prefix can take
+ * with 503 SlowDown; with rate limiting on, the context then limits the
+ * rate at which it starts requests for that bucket and prefix (the key up
+ * to and including its last '/') to half of what it was, and halves it
+ * again on further SlowDowns, but no more than once a second and no lower
+ * than minRequestsPerSecond.  Each request which succeeds raises the rate a
+ * little, by about one request per second every second, to find the rate
+ * the prefix can take.  Requests held back by the limit wait within the
+ * context, like requests waiting to be retried, and count among the
+ * requests remaining in it.  Requests for prefixes which have never had a
+ * SlowDown are not limited.
+ *
+ * Rate limiting decides when requests start; whether a request which got
+ * SlowDown is itself made again is up to the retry policy (see
+ * S3_set_request_context_retry_policy), and its retry takes its place in
+ * the limited rate.
+ *
+ * Rate limiting is not available for a threaded S3RequestContext.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param enable is nonzero to turn rate limiting on, or 0 to turn it off
+ *        and forget the rates found so far
+ * @param minRequestsPerSecond is the lowest rate to limit to; anything less
+ *        than 0.1 means 0.1
+ * @return One of:
+ *         S3StatusOK if rate limiting was turned on or off
+ *         S3StatusNotSupported if the S3RequestContext is threaded
+ **/
+S3Status S3_set_request_context_rate_limiting
+    (S3RequestContext *requestContext, int enable,
+     double minRequestsPerSecond);
+
+
+/**
+ * Limits the bandwidth used by the requests of an S3RequestContext, either
+ * all of them together or those for one bucket.  The limits apply to all of
+ * the transfers together, not to each one: when they have used up what the
+ * limit allows, each transfer which wants to go on is paused until it allows
+ * more.  The limits are token buckets, which let through bursts of up to a
+ * tenth of a second's worth of data.  Only the bodies of requests and
+ * responses are counted, not their headers.  A request for a bucket with
+ * limits of its own is held to those as well as to the context's.
+ *
+ * Limits may be changed at any time, and take effect straight away; but a
+ * bucket's limits only apply to requests started after the bucket was
+ * first given limits.  Setting limits of 0 for a bucket leaves it unlimited,
+ * but has its rates measured (see S3_get_request_context_bandwidth); the
+ * rates of the context as a whole are measured once any limits have been
+ * set.
+ *
+ * Bandwidth limits are not available for a threaded S3RequestContext.
+ * Synchronous requests (which have no S3RequestContext) are not limited.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param bucketName is the name of the bucket to limit, or 0 to limit the
+ *        context as a whole
+ * @param downloadBytesPerSecond is the limit on the rate at which response
+ *        bodies are received, or 0 for no limit
+ * @param uploadBytesPerSecond is the limit on the rate at which request
+ *        bodies are sent, or 0 for no limit
+ * @return One of:
+ *         S3StatusOK if the limits were set
+ *         S3StatusOutOfMemory if there was no memory for them
+ *         S3StatusNotSupported if the S3RequestContext is threaded
+ **/
+S3Status S3_set_request_context_bandwidth_limit
+    (S3RequestContext *requestContext, const char *bucketName,
+     int64_t downloadBytesPerSecond, int64_t uploadBytesPerSecond);
+
+
+/**
+ * Returns the bandwidth limits of an S3RequestContext, or of one bucket
+ * within it, and the rates at which its requests have been transferring
+ * data (see S3_set_request_context_bandwidth_limit).  A bucket which has
+ * never been given limits, like a context which has none, reports zero for
+ * everything.
+ *
+ * @param requestContext is the S3RequestContext to query
+ * @param bucketName is the name of the bucket, or 0 for the context as a
+ *        whole
+ * @param bandwidthReturn returns the limits and rates
+ **/
+void S3_get_request_context_bandwidth(S3RequestContext *requestContext,
+                                      const char *bucketName,
+                                      S3Bandwidth *bandwidthReturn);
+
+
+/**
+ * Sets the timeouts which apply to the requests of an S3RequestContext, in
+ * addition to the timeoutMs given to each request function: how long each
+ * attempt at a request may take to connect, and to get the first of its
+ * response headers, and the deadline by which the request must have
+ * completed, however many times it is tried.  An attempt which runs out of
+ * time fails in a way which the retry policy (see
+ * S3_set_request_context_retry_policy) may retry, so that a stuck connection
+ * or an unresponsive server is soon given up on for another try; but no
+ * retry is made which could not start before the deadline.
+ *
+ * The deadline of a request is fixed when the request is made, so changing
+ * the timeouts only affects requests made afterwards.  A request which is
+ * still queued behind the context's in-flight limit when its deadline passes
+ * fails once it is admitted.  Synchronous requests (which have no
+ * S3RequestContext) are not affected.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param timeouts gives the timeouts, which are copied; 0 removes them all
+ * @return S3StatusOK; the timeouts are always set
+ **/
+S3Status S3_set_request_context_timeouts(S3RequestContext *requestContext,
+                                         const S3RequestTimeouts *timeouts);
+
+
+/**
+ * Allows the GETs of objects made in an S3RequestContext to be resumed when
+ * they stop partway through the object's data, because the transfer stalled
+ * (see S3RequestTimeouts) or the connection was lost.  Rather than failing,
+ * such a GET is made again, straight away, for the rest of the object: with
+ * a Range starting at the first byte not yet given to the
+ * S3GetObjectDataCallback, and with If-Match naming the ETag of the first
+ * response, so that the rest comes from the same version of the object.  The
+ * application sees one uninterrupted stream of data, and only one properties
+ * callback; the complete callback is made once, when the object has been
+ * received or the GET cannot be resumed again.  If the object has changed in
+ * the meantime, the GET completes with S3StatusErrorPreconditionFailed after
+ * the data already given.
+ *
+ * Each GET is resumed at most maxResumes times.  A resumed GET which fails
+ * before any of its response arrives may be retried by the retry policy (see
+ * S3_set_request_context_retry_policy), like any other request.
+ * Synchronous GETs (which have no S3RequestContext) are never resumed.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param maxResumes is the most times any one GET is resumed; 0 disables
+ *        resuming
+ * @return S3StatusOK; the limit is always set
+ **/
+S3Status S3_set_request_context_max_resumes(S3RequestContext *requestContext,
+                                            int maxResumes);
+
+
+/**
+ * Returns the rates to which an S3RequestContext is currently limiting
+ * requests, one for each bucket and key prefix which is limited (see
+ * S3_set_request_context_rate_limiting).  The strings returned belong to the
+ * context and remain valid until the next request is started in it, or it
+ * is run or destroyed.
+ *
+ * @param requestContext is the S3RequestContext to query
+ * @param limitsReturn returns the limits, up to maxLimits of them
+ * @param maxLimits is the number of S3RateLimits in limitsReturn
+ * @return the number of limits, which may be more than maxLimits
+ **/
+int S3_get_request_context_rate_limits(S3RequestContext *requestContext,
+                                       S3RateLimit *limitsReturn,
+                                       int maxLimits);
+
+
+/**
+ * Spreads the connections of an S3RequestContext over all of the addresses
+ * of the hosts it connects to.  S3 endpoints resolve to many addresses, but
+ * left to itself curl connects to the first address it resolved, so that
+ * all of the context's connections go to one of S3's front ends.  With
+ * balancing, the context resolves each host itself, keeps every IPv4 and
+ * IPv6 address found, and gives each request one of them to connect to, in
+ * turn or the least loaded.  The connections to each address are kept and
+ * re-used apart from the others.  Hosts are resolved again once their
+ * addresses are more than refreshSeconds old.  Host names are looked up on
+ * a thread of their own, so that no request waits for a lookup; until a
+ * host's first lookup has completed, its requests connect as they would
+ * without balancing.
+ *
+ * An address which a request fails to connect to (because the connection
+ * was refused, or timed out before it was made) is ejected: it is given no
+ * requests for five seconds, doubling with each failure in a row up to five
+ * minutes, unless every address of the host is ejected.  A request which
+ * gets any response brings its address back straight away.  A retry (see
+ * S3_set_request_context_retry_policy) of a request which failed to connect
+ * is given another address.
+ *
+ * For a threaded S3RequestContext, each worker thread balances its own
+ * requests, and S3_get_request_context_endpoints reports none.
+ *
+ * @param requestContext is the S3RequestContext to configure
+ * @param balancing says how addresses are chosen, S3EndpointBalancingNone
+ *        turning balancing off
+ * @param refreshSeconds is how long a host's addresses are used before it
+ *        is resolved again; 0 or less means 60 seconds
+ * @return One of:
+ *         S3StatusOK if balancing was set
+ *         S3StatusNotSupported if balancing is not one of the
+ *             S3EndpointBalancing values
+ **/
+S3Status S3_set_request_context_endpoint_balancing
+    (S3RequestContext *requestContext, S3EndpointBalancing balancing,
+     int refreshSeconds);
+
+
+/**
+ * Returns the addresses over which an S3RequestContext is balancing its
+ * connections (see S3_set_request_context_endpoint_balancing), with the
+ * requests given each.  The strings returned belong to the context and
+ * remain valid until the next request is started in it, or it is run or
+ * destroyed.
+ *
+ * @param requestContext is the S3RequestContext to query
+ * @param addressesReturn returns the addresses, up to maxAddresses of them
+ * @param maxAddresses is the number of S3EndpointAddresses in
+ *        addressesReturn
+ * @return the number of addresses, which may be more than maxAddresses
+ **/
+int S3_get_request_context_endpoints(S3RequestContext *requestContext,
+                                     S3EndpointAddress *addressesReturn,
+                                     int maxAddresses);
+
+
+/**
+ * Processes events which have occurred on one socket of an S3RequestContext
+ * created with S3_create_request_context_with_event_callbacks.  Any requests
+ * which complete as a result have their callbacks made before this function
+ * returns.
+ *
+ * @param requestContext is the S3RequestContext which owns the socket
+ * @param fd is the socket, as passed to the S3RequestContextSocketCallback
+ * @param events is the S3_SOCKET_EVENT_XXX flags, or'd together, of the
+ *        events which have occurred on the socket
+ * @param requestsRemainingReturn returns the number of requests remaining
+ *        and not yet completed within the S3RequestContext
+ * @return One of:
+ *         S3StatusOK if request processing proceeded without error
+ *         S3StatusNotSupported if the S3RequestContext was not created with
+ *             S3_create_request_context_with_event_callbacks
+ *         S3StatusInternalError if an internal error prevented the
+ *             S3RequestContext from running one or more requests
+ *         S3StatusOutOfMemory if requests could not be processed due to
+ *             an out of memory error
+ **/
+S3Status S3_process_request_context_socket(S3RequestContext *requestContext,
+                                           int fd, int events,
+                                           int *requestsRemainingReturn);
+
+
+/**
+ * Processes an expired timeout of an S3RequestContext created with
+ * S3_create_request_context_with_event_callbacks: starts newly added
+ * requests, enforces connect and transfer timeouts, and does whatever
+ * hedging, retrying, resuming, rate limiting and bandwidth limiting has
+ * fallen due.  Any requests which complete as a result have their callbacks
+ * made before this function returns.
+ *
+ * @param requestContext is the S3RequestContext whose timeout expired
+ * @param requestsRemainingReturn returns the number of requests remaining
+ *        and not yet completed within the S3RequestContext
+ * @return One of the statuses listed for S3_process_request_context_socket
+ **/
+S3Status S3_process_request_context_timeout(S3RequestContext *requestContext,
+                                            int *requestsRemainingReturn);
+
+
+/**
+ * Opens connections to the host of a bucket ahead of the requests which will
+ * use them, so that those requests do not have to wait for the DNS lookup,
+ * TCP connect and TLS handshake.  The connections are made by sending count
+ * HEAD requests for the bucket at the same time; their results are ignored,
+ * so the credentials in the bucket context need not allow access to it.
+ *
+ * If requestContext is non-NULL, the requests are added to it, and the
+ * connections are made as the S3RequestContext is run, after which they are
+ * kept by it for re-use by the requests subsequently added to it.  The
+ * number of connections made is also limited by any limits set on the
+ * context with S3_set_request_context_max_in_flight and
+ * S3_set_request_context_max_connections_per_host.  If the context has a
+ * completion queue, a completion with a NULL callbackData is posted to it for
+ * each of the requests.
+ *
+ * If requestContext is NULL, the connections are made before this function
+ * returns, and are then available to every request made by the program,
+ * synchronous or not.  This requires libs3 to have been initialized with
+ * S3_INIT_SHARE_CACHES, since otherwise there would be nowhere to keep them.
+ *
+ * @param requestContext if non-NULL, is the S3RequestContext to make the
+ *        connections in
+ * @param bucketContext gives the bucket and associated parameters for the
+ *        connections to make
+ * @param count is the number of connections to make
+ * @return One of:
+ *         S3StatusOK if the connections were made (or, with a non-NULL
+ *             requestContext, the requests to make them were added)
+ *         S3StatusNotSupported if requestContext is NULL and libs3 was not
+ *             initialized with S3_INIT_SHARE_CACHES
+ *         Otherwise, the status which prevented a connection from being
+ *             made, such as S3StatusFailedToConnect or
+ *             S3StatusNameLookupError
+ **/
+S3Status S3_prewarm_connections(S3RequestContext *requestContext,
+                                const S3BucketContext *bucketContext,
+                                int count);
+
+
+/**
+ * Starts a background thread which repeats S3_prewarm_connections (with a
+ * NULL S3RequestContext) every intervalMs milliseconds, so that count
+ * connections to the host of the bucket are kept open and ready for use even
+ * when the program makes no requests for longer than the server keeps idle
+ * connections open.  Requires libs3 to have been initialized with
+ * S3_INIT_SHARE_CACHES.  The S3KeepWarm must be stopped with
+ * S3_stop_keep_warm before S3_deinitialize() is called.
+ *
+ * @param bucketContext gives the bucket and associated parameters for the
+ *        connections to keep open; it is copied, and need not remain valid
+ *        after this function returns
+ * @param count is the number of connections to keep open
+ * @param intervalMs is the number of milliseconds between the times that the
+ *        connections are used; this should be less than the server's idle
+ *        connection timeout
+ * @param keepWarmReturn returns the S3KeepWarm, to be passed to
+ *        S3_stop_keep_warm, if the status returned is S3StatusOK
+ * @return One of:
+ *         S3StatusOK if the background thread was started
+ *         S3StatusNotSupported if libs3 was not initialized with
+ *             S3_INIT_SHARE_CACHES
+ *         S3StatusOutOfMemory if there was not enough memory
+ *         S3StatusInternalError if the thread could not be started
+ **/
+S3Status S3_start_keep_warm(const S3BucketContext *bucketContext, int count,
+                            int intervalMs, S3KeepWarm **keepWarmReturn);
+
+
+/**
+ * Stops the background thread of an S3KeepWarm, waiting for it to finish
+ * using any connections it is in the middle of using, and frees it.  The
+ * connections themselves are left open for use by other requests.
+ *
+ * @param keepWarm is the S3KeepWarm to stop
+ **/
+void S3_stop_keep_warm(S3KeepWarm *keepWarm);
+
+
 /** **************************************************************************
  * S3 Utility Functions
  ************************************************************************** **/
@@ -1742,6 +2968,55 @@ S3Status S3_generate_authenticated_query_string
      const char *httpMethod);
 
 
+/**
+ * Generates the HTTP authenticated query strings of many keys at once, each
+ * the same as S3_generate_authenticated_query_string would generate for the
+ * key, into an arena supplied by the caller.  What is the same for every
+ * key, such as the signing key, the canonical headers and the parts of the
+ * URL and of the canonical request around the key, is worked out once, and
+ * the hashes of the keys' signatures are computed several keys at a time
+ * (see S3_compute_sha256s), so that this is many times faster per key.
+ * Every URL of a call has the same X-Amz-Date.
+ *
+ * The URLs are written one after another into the arena, each followed by
+ * a terminating \0.  If the arena fills, or a key's URL cannot be generated,
+ * the keys before it still have their URLs; the call can be repeated for
+ * the rest of the keys with another arena.
+ *
+ * @param bucketContext gives the bucket and associated parameters for the
+ *        requests to generate.
+ * @param keyCount is the number of keys
+ * @param keys gives the keys which the authenticated requests will access
+ * @param expires gives the expiration, as for
+ *        S3_generate_authenticated_query_string
+ * @param resource gives a sub-resource to be fetched for the requests, or
+ *        NULL for none, as for S3_generate_authenticated_query_string
+ * @param httpMethod the HTTP request method that will be used with the
+ *        generated query strings (e.g. "GET").
+ * @param arena is the buffer into which the URLs are written
+ * @param arenaSize is the size of the arena in bytes
+ * @param urls returns, for each key whose URL was generated, where its URL
+ *        is in the arena
+ * @param urlCountReturn returns the number of keys, from the first, whose
+ *        URLs were generated
+ * @return One of:
+ *         S3StatusOK if the URLs of all of the keys were generated
+ *         S3StatusBufferTooSmall if the URL of keys[*urlCountReturn] did
+ *             not fit in what was left of the arena
+ *         S3StatusOutOfMemory if there was not enough memory to sign the
+ *             URLs
+ *         S3StatusUriTooLong if the URL of keys[*urlCountReturn] would be
+ *             longer than S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE bytes
+ *         or another status if the bucket context is invalid, in which case
+ *             no URLs were generated
+ **/
+S3Status S3_generate_authenticated_query_strings
+    (const S3BucketContext *bucketContext, int keyCount,
+     const char *const *keys, int expires, const char *resource,
+     const char *httpMethod, char *arena, int arenaSize, const char **urls,
+     int *urlCountReturn);
+
+
 /** **************************************************************************
  * Service Functions
  ************************************************************************** **/
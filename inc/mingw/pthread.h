@@ -42,4 +42,36 @@ int pthread_mutex_lock(pthread_mutex_t *mutex);
 int pthread_mutex_unlock(pthread_mutex_t *mutex);
 int pthread_mutex_destroy(pthread_mutex_t *mutex);
 
+// Threads.  Thread attributes and return values are not supported.
+typedef HANDLE pthread_t;
+
+int pthread_create(pthread_t *thread, void *attr,
+                   void *(*start_routine)(void *), void *arg);
+int pthread_join(pthread_t thread, void **retval);
+
+// Condition variables; these require Windows Vista or later
+typedef struct
+{
+    CONDITION_VARIABLE conditionVariable;
+} pthread_cond_t;
+
+struct timespec;
+
+int pthread_cond_init(pthread_cond_t *cond, void *);
+int pthread_cond_signal(pthread_cond_t *cond);
+int pthread_cond_broadcast(pthread_cond_t *cond);
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *abstime);
+int pthread_cond_destroy(pthread_cond_t *cond);
+
+// Thread-specific data.  Note that key destructors are not supported; they
+// are never called.
+typedef DWORD pthread_key_t;
+
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *));
+int pthread_key_delete(pthread_key_t key);
+void *pthread_getspecific(pthread_key_t key);
+int pthread_setspecific(pthread_key_t key, const void *value);
+
 #endif /* PTHREAD_H */
@@ -0,0 +1,72 @@
+/** **************************************************************************
+ * multihash.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#ifndef MULTIHASH_H
+#define MULTIHASH_H
+
+#include <stdint.h>
+
+// The most buffers that are hashed side by side, one to each lane of the
+// widest vectors used
+#define MULTIHASH_MAX_LANES 16
+
+#define MULTIHASH_MD5_SIZE 16
+#define MULTIHASH_SHA256_SIZE 32
+
+// Computes the MD5 of each of count buffers, data[i] of lens[i] bytes, into
+// digests[i].  Where the CPU has the vector instructions for it (AVX2 or
+// AVX-512, found at run time), the buffers are hashed several at a time, one
+// to each lane of a vector, each taking the place of the one before as it
+// finishes; otherwise they are hashed one after another.
+void multihash_md5(int count, const unsigned char *const *data,
+                   const uint64_t *lens,
+                   unsigned char (*digests)[MULTIHASH_MD5_SIZE]);
+
+// Computes the SHA-256 of each of count buffers, as multihash_md5 does the
+// MD5.  Where the CPU has the SHA extensions, the one-at-a-time hashing they
+// speed up is used instead unless there are enough buffers to fill the
+// vectors.
+void multihash_sha256(int count, const unsigned char *const *data,
+                      const uint64_t *lens,
+                      unsigned char (*digests)[MULTIHASH_SHA256_SIZE]);
+
+// Computes the SHA-256 of each of count messages which all start with the
+// same 64 byte block, prefix, followed by data[i] of lens[i] bytes, as the
+// inner and outer hashes of HMACs with the same key do.  The prefix is only
+// hashed once.
+void multihash_sha256_prefixed
+    (const unsigned char *prefix, int count, const unsigned char *const *data,
+     const uint64_t *lens, unsigned char (*digests)[MULTIHASH_SHA256_SIZE]);
+
+// Sets the lanes to use whatever the buffers, as far as the CPU has them:
+// 1 to hash one buffer at a time, 8 or 16 to hash them side by side, or 0 to
+// choose for each call as is fastest.  This is for testing and measuring the
+// implementations against one another.  Returns the widest vectors the CPU
+// has, in lanes.
+int multihash_set_lanes(int lanes);
+
+#endif /* MULTIHASH_H */
@@ -0,0 +1,144 @@
+/** **************************************************************************
+ * multihash_kernels.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+// The MD5 and SHA-256 block functions of multihash.c, for vectors of
+// MULTIHASH_LANES 32-bit lanes.  This is included by multihash.c once for
+// each vector width, with MULTIHASH_LANES, MULTIHASH_TARGET (the instruction
+// set to compile for) and MULTIHASH_NAME (which names the functions for the
+// width) defined; so it has no include guard.
+//
+// Each function hashes one 64 byte block into each lane's hash state, the
+// state being held as an array of words, each word an array of lanes.  The
+// blocks are transposed so that each message word is a vector of the lanes'
+// words, and from there on every lane is hashed at once by the same
+// instructions.
+
+typedef uint32_t MULTIHASH_NAME(Vector)
+    __attribute__((vector_size(MULTIHASH_LANES * 4)));
+
+#define V MULTIHASH_NAME(Vector)
+
+__attribute__((target(MULTIHASH_TARGET)))
+static void MULTIHASH_NAME(md5_blocks)(uint32_t *state,
+                                       const unsigned char **blocks)
+{
+    uint32_t words[16][MULTIHASH_LANES];
+    V m[16], a, b, c, d, aa, bb, cc, dd;
+    int i, lane;
+
+    for (lane = 0; lane < MULTIHASH_LANES; lane++) {
+        for (i = 0; i < 16; i++) {
+            words[i][lane] = load_le32(&(blocks[lane][4 * i]));
+        }
+    }
+    for (i = 0; i < 16; i++) {
+        memcpy(&(m[i]), words[i], sizeof(V));
+    }
+
+    memcpy(&a, &(state[0 * MULTIHASH_LANES]), sizeof(V));
+    memcpy(&b, &(state[1 * MULTIHASH_LANES]), sizeof(V));
+    memcpy(&c, &(state[2 * MULTIHASH_LANES]), sizeof(V));
+    memcpy(&d, &(state[3 * MULTIHASH_LANES]), sizeof(V));
+    aa = a, bb = b, cc = c, dd = d;
+
+    for (i = 0; i < 16; i += 4) {
+        MD5_STEP(MD5_F, a, b, c, d, m[i], md5K[i], 7);
+        MD5_STEP(MD5_F, d, a, b, c, m[i + 1], md5K[i + 1], 12);
+        MD5_STEP(MD5_F, c, d, a, b, m[i + 2], md5K[i + 2], 17);
+        MD5_STEP(MD5_F, b, c, d, a, m[i + 3], md5K[i + 3], 22);
+    }
+    for (i = 16; i < 32; i += 4) {
+        MD5_STEP(MD5_G, a, b, c, d, m[((5 * i) + 1) & 15], md5K[i], 5);
+        MD5_STEP(MD5_G, d, a, b, c, m[((5 * i) + 6) & 15], md5K[i + 1], 9);
+        MD5_STEP(MD5_G, c, d, a, b, m[((5 * i) + 11) & 15], md5K[i + 2], 14);
+        MD5_STEP(MD5_G, b, c, d, a, m[(5 * i) & 15], md5K[i + 3], 20);
+    }
+    for (i = 32; i < 48; i += 4) {
+        MD5_STEP(MD5_H, a, b, c, d, m[((3 * i) + 5) & 15], md5K[i], 4);
+        MD5_STEP(MD5_H, d, a, b, c, m[((3 * i) + 8) & 15], md5K[i + 1], 11);
+        MD5_STEP(MD5_H, c, d, a, b, m[((3 * i) + 11) & 15], md5K[i + 2], 16);
+        MD5_STEP(MD5_H, b, c, d, a, m[((3 * i) + 14) & 15], md5K[i + 3], 23);
+    }
+    for (i = 48; i < 64; i += 4) {
+        MD5_STEP(MD5_I, a, b, c, d, m[(7 * i) & 15], md5K[i], 6);
+        MD5_STEP(MD5_I, d, a, b, c, m[((7 * i) + 7) & 15], md5K[i + 1], 10);
+        MD5_STEP(MD5_I, c, d, a, b, m[((7 * i) + 14) & 15], md5K[i + 2], 15);
+        MD5_STEP(MD5_I, b, c, d, a, m[((7 * i) + 21) & 15], md5K[i + 3], 21);
+    }
+
+    a += aa, b += bb, c += cc, d += dd;
+    memcpy(&(state[0 * MULTIHASH_LANES]), &a, sizeof(V));
+    memcpy(&(state[1 * MULTIHASH_LANES]), &b, sizeof(V));
+    memcpy(&(state[2 * MULTIHASH_LANES]), &c, sizeof(V));
+    memcpy(&(state[3 * MULTIHASH_LANES]), &d, sizeof(V));
+}
+
+
+__attribute__((target(MULTIHASH_TARGET)))
+static void MULTIHASH_NAME(sha256_blocks)(uint32_t *state,
+                                          const unsigned char **blocks)
+{
+    uint32_t words[16][MULTIHASH_LANES];
+    V w[16], s[8], t1;
+    int i, lane;
+
+    for (lane = 0; lane < MULTIHASH_LANES; lane++) {
+        for (i = 0; i < 16; i++) {
+            words[i][lane] = load_be32(&(blocks[lane][4 * i]));
+        }
+    }
+    for (i = 0; i < 16; i++) {
+        memcpy(&(w[i]), words[i], sizeof(V));
+    }
+    for (i = 0; i < 8; i++) {
+        memcpy(&(s[i]), &(state[i * MULTIHASH_LANES]), sizeof(V));
+    }
+
+    V a = s[0], b = s[1], c = s[2], d = s[3];
+    V e = s[4], f = s[5], g = s[6], h = s[7];
+
+    // Eight rounds at a time, so that the working variables are renamed
+    // rather than moved
+    for (i = 0; i < 64; i += 8) {
+        SHA256_ROUND(a, b, c, d, e, f, g, h, i);
+        SHA256_ROUND(h, a, b, c, d, e, f, g, i + 1);
+        SHA256_ROUND(g, h, a, b, c, d, e, f, i + 2);
+        SHA256_ROUND(f, g, h, a, b, c, d, e, i + 3);
+        SHA256_ROUND(e, f, g, h, a, b, c, d, i + 4);
+        SHA256_ROUND(d, e, f, g, h, a, b, c, i + 5);
+        SHA256_ROUND(c, d, e, f, g, h, a, b, i + 6);
+        SHA256_ROUND(b, c, d, e, f, g, h, a, i + 7);
+    }
+
+    s[0] += a, s[1] += b, s[2] += c, s[3] += d;
+    s[4] += e, s[5] += f, s[6] += g, s[7] += h;
+    for (i = 0; i < 8; i++) {
+        memcpy(&(state[i * MULTIHASH_LANES]), &(s[i]), sizeof(V));
+    }
+}
+
+#undef V
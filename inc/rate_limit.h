@@ -0,0 +1,94 @@
+/** **************************************************************************
+ * rate_limit.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include "request.h"
+
+// The adaptive rate limits of an S3RequestContext (see
+// S3_set_request_context_rate_limiting).  Requests are grouped by bucket and
+// key prefix, the prefix being the key up to and including its last '/'.  A
+// group is not limited until one of its requests gets a SlowDown response;
+// from then on, its requests are started no more often than its rate
+// allows.  The rate is halved on SlowDown (at most once a second, since the
+// requests already in flight are likely to get SlowDown too) and raised by
+// about one request per second every second on success: additive increase,
+// multiplicative decrease.
+//
+// Requests are spaced out by giving each the later of now and one interval
+// after the start of the one before it, so a request which must wait knows
+// straight away when it may start.
+
+
+typedef struct RateLimit
+{
+    struct RateLimit *next;
+
+    // Of the bucket name and prefix, which are stored after the structure
+    uint64_t hash;
+    const char *bucketName, *prefix;
+
+    // The requests per second allowed, or 0 while the group is not limited
+    double rate;
+
+    // The earliest time at which the group's next request may start
+    int64_t nextStartMs;
+
+    // The number of requests started since windowStartMs, and the rate
+    // measured over the last complete window of a second; this gives the
+    // rate to start limiting from
+    int64_t windowStartMs;
+    int windowCount;
+    double measuredRate;
+
+    // When the rate was last decreased, and when the group was last used
+    int64_t decreasedMs, usedMs;
+
+    // The group's requests in flight, which refer to it
+    int inFlight;
+} RateLimit;
+
+
+// Returns the context's RateLimit for the bucket and key prefix of a request,
+// creating it if need be, or 0 if the context is not limiting rates or there
+// was no memory for it
+RateLimit *rate_limit_get(S3RequestContext *context,
+                          const RequestParams *params);
+
+// Returns the time at which a request of the group may start, being no
+// earlier than earliestMs, and counts it as started then
+int64_t rate_limit_schedule(RateLimit *limit, int64_t earliestMs);
+
+// Adjusts the group's rate for a request which has completed with status
+void rate_limit_update(S3RequestContext *context, RateLimit *limit,
+                       S3Status status);
+
+// Frees all of the context's RateLimits
+void rate_limits_destroy(S3RequestContext *context);
+
+#endif /* RATE_LIMIT_H */
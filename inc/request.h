@@ -45,6 +45,14 @@ typedef enum
 } HttpRequestType;
 
 
+// The most headers that a request sends: Content-Length and
+// Transfer-Encoding, 13 standard headers, and the x-amz- headers
+#define REQUEST_MAX_HEADERS (2 + 13 + S3_MAX_METADATA_COUNT + 2)
+
+// Room for all of those headers, each with its terminating \0
+#define REQUEST_HEADERS_SIZE (COMPACTED_METADATA_BUFFER_SIZE + 4096)
+
+
 // This completely describes a request.  A RequestParams is not required to be
 // allocated from the heap and its lifetime is not assumed to extend beyond
 // the lifetime of the function to which it has been passed.
@@ -105,6 +113,10 @@ typedef struct RequestParams
 
     // Request timeout. If 0, no timeout will be enforced
     int timeoutMs;
+
+    // Nonzero if toS3Callback supplies the application's data, which the
+    // rewind callback of a retry policy can rewind
+    int toS3CallbackRewindable;
 } RequestParams;
 
 
@@ -126,8 +138,13 @@ typedef struct Request
     // errors the same way
     int httpResponseCode;
 
-    // The HTTP headers to use for the curl request
-    struct curl_slist *headers;
+    // The HTTP headers to use for the curl request.  They are kept in the
+    // request itself, rather than in a curl_slist allocated header by header,
+    // so that a request reused from the request pool reuses their storage.
+    struct curl_slist headers[REQUEST_MAX_HEADERS];
+    int headersCount;
+    char headersRaw[REQUEST_HEADERS_SIZE];
+    int headersRawLength;
 
     // The CURL structure driving the request
     CURL *curl;
@@ -163,6 +180,87 @@ typedef struct Request
 
     // Parser of errors
     ErrorParser errorParser;
+
+    // The context which is performing the request, or 0 if it is being
+    // performed synchronously
+    S3RequestContext *context;
+
+    // For hedging (see S3_set_request_context_hedging): the monotonic time
+    // at which the request was started (0 if the context was not hedging),
+    // and nonzero once response headers have started to arrive
+    int64_t startMs;
+    int responseStarted;
+
+    // While the request is a hedge candidate, a copy of its parameters to
+    // issue the hedge from, and its links on the context's candidate list;
+    // hedgeNext also links requests on the context's list of losers
+    struct QueuedRequest *hedgeParams;
+    struct Request *hedgePrev, *hedgeNext;
+
+    // The other request of a hedged pair, while both are racing; isHedge is
+    // nonzero for the duplicate, and hedgeLost once the other has won, after
+    // which the request makes no more callbacks
+    struct Request *hedgePartner;
+    int isHedge, hedgeLost;
+
+    // The handle which S3_cancel_request cancels the request by; a hedge
+    // shares the handle of the request it duplicates
+    S3RequestHandle handle;
+
+    // Nonzero once the request has been cancelled from within a curl
+    // callback, after which it makes no more callbacks until it is removed
+    // from the context's list of cancelled requests, which cancelNext links
+    int cancelled;
+    struct Request *cancelNext;
+
+    // If the context has a retry policy, a copy of the request's parameters
+    // to retry it from, how many times it has been retried already, and the
+    // delay before the last retry
+    struct QueuedRequest *retryParams;
+    int retries, retryDelayMs;
+
+    // If the context resumes GETs which stop partway (see
+    // S3_set_request_context_max_resumes), a copy of the request's parameters
+    // to resume it from, and the number of bytes given to fromS3Callback so
+    // far
+    struct QueuedRequest *resumeParams;
+    uint64_t bytesReceived;
+
+    // For a resumed GET: how many times it has been resumed, and the offset
+    // in the object at which it resumes
+    int resumes;
+    size_t resumeFrom;
+
+    // The bandwidth limits of the request's bucket, if it has any, and while
+    // the request's transfer is paused for want of bandwidth, the
+    // CURLPAUSE_XXX directions paused and its link on the context's list of
+    // paused requests
+    struct BandwidthLimit *bandwidth;
+    int pausedDirections;
+    struct Request *pausedNext;
+
+    // If the context is balancing endpoints, the host the request connects
+    // to and the address of it the request was given, and the
+    // CURLOPT_CONNECT_TO list which connects it there
+    struct Endpoint *endpoint;
+    struct EndpointAddress *endpointAddress;
+    struct curl_slist *connectTo;
+
+    // If the request's payload is signed chunk by chunk, what signs it
+    struct ChunkSigner *chunkSigner;
+
+    // The rate limit group of the request, if the context is limiting rates
+    struct RateLimit *rateLimit;
+
+    // The monotonic time by which the request must have completed, however
+    // many times it is tried, or 0 if there is no deadline
+    int64_t deadlineMs;
+
+    // While the request waits for its first response header under the
+    // context's time-to-first-byte limit: the monotonic time at which it
+    // times out, and its links on the context's list of such requests
+    int64_t firstByteDueMs;
+    struct Request *firstBytePrev, *firstByteNext;
 } Request;
 
 
@@ -176,16 +274,67 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
 // Deinitialize the API
 void request_api_deinitialize();
 
+// Returns nonzero if S3_initialize was given S3_INIT_SHARE_CACHES, so that
+// connections are shared by all requests
+int request_shares_caches();
+
 // Perform a request; if context is 0, performs the request immediately;
-// otherwise, sets it up to be performed by context.
-void request_perform(const RequestParams *params, S3RequestContext *context);
+// otherwise, sets it up to be performed by context.  Returns the handle which
+// identifies the request within context, or 0 if context is 0.
+S3RequestHandle request_perform(const RequestParams *params,
+                                S3RequestContext *context);
+
+// As request_perform, for a request already given a handle, and a deadline
+// (0 for none)
+void request_start(const RequestParams *params, S3RequestContext *context,
+                   S3RequestHandle handle, int64_t deadlineMs);
+
+// Starts as many of the context's queued requests as its in-flight limit
+// allows; called by the internal request context code when requests finish
+void request_admit_queued(S3RequestContext *context);
 
 // Called by the internal request code or internal request context code when a
 // curl has finished the request
 void request_finish(Request *request);
 
+// Removes a request from the context's list of requests in flight
+void request_unlink(S3RequestContext *context, Request *request);
+
+// Removes the requests which have lost to their hedges from the context, and
+// issues hedges for the GETs and HEADs which have waited too long for a
+// response; returns nonzero if any hedges were issued
+int request_hedge(S3RequestContext *context);
+
+// Cancels the request with the given handle, if it is queued or in flight in
+// the context, completing it with S3StatusInterrupted; returns nonzero if it
+// was found.  Requests cannot be removed from within curl callbacks, so those
+// cancelled from one wait for request_cancel_deferred.
+int request_cancel(S3RequestContext *context, S3RequestHandle handle);
+
+// Completes the requests which were cancelled from within curl callbacks;
+// returns nonzero if there were any
+int request_cancel_deferred(S3RequestContext *context);
+
+// Times out the requests which have waited too long for their first response
+// headers; returns nonzero if there were any
+int request_expire(S3RequestContext *context);
+
+// Starts the requests whose retry delays or rate limits have let them wait
+// until now, and the GETs to be resumed; returns nonzero if there were any
+int request_start_delayed(S3RequestContext *context);
+
+// Returns the number of milliseconds until request_hedge, request_expire,
+// request_start_delayed, request_cancel_deferred or request_bandwidth_resume
+// next needs to be called, or -1 if there is no need
+int64_t request_timeout(S3RequestContext *context);
+
 // Convert a CURLE code to an S3Status
 S3Status request_curl_code_to_status(CURLcode code);
 
+// Canonicalizes the query string and sub-resource of a request into buffer,
+// which must have room for both, with two characters more and a terminator
+void request_canonicalize_query_string(const char *queryParams,
+                                       const char *subResource, char *buffer);
+
 
 #endif /* REQUEST_H */
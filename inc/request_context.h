@@ -27,8 +27,14 @@
 #ifndef REQUEST_CONTEXT_H
 #define REQUEST_CONTEXT_H
 
+#include <pthread.h>
 #include "libs3.h"
 
+// The number of recent response times kept for hedging on a percentile, and
+// the number needed before the percentile is used
+#define HEDGE_SAMPLE_COUNT 256
+#define HEDGE_MIN_SAMPLES 32
+
 struct S3RequestContext
 {
     CURLM *curlm;
@@ -36,8 +42,151 @@ struct S3RequestContext
     int verifyPeerSet;
     long verifyPeer;
 
+    // Whether requests sign their payloads, or -1 for the library's default
+    // (see S3_set_request_context_sign_payloads)
+    int signPayloads;
+
     struct Request *requests;
+
+    // Number of requests in the curl multi handle, and the most there may be
+    // (0 for no limit); requests beyond the limit wait on the queue, from
+    // queueHead (oldest) to queueTail, of which there are queuedCount
+    int inFlightCount, maxInFlight;
+    struct QueuedRequest *queueHead, *queueTail;
+    int queuedCount;
+
+    // Nonzero if requests use HTTP/2, multiplexed over shared connections
+    int http2;
+
+    // The event engine which drives the curl multi handle
+    S3RequestContextEngine engine;
+
+    // For S3RequestContextEngineEpoll: the epoll instance watching every
+    // socket curl is interested in; and for it and
+    // S3RequestContextEngineExternal, the monotonic time in milliseconds at
+    // which curl next wants a timeout action (-1 for never)
+    int epollFd;
+    int64_t timerDeadline;
+
+    // For the socket-driven engines: the number of transfers curl last
+    // reported as running
+    int runningCount;
+
+    // For S3RequestContextEngineExternal: the caller's event loop callbacks,
+    // and the monotonic time in milliseconds last passed to timerCallback
+    // (-1 for none), which is the earlier of curl's and the context's own
+    S3RequestContextSocketCallback *socketCallback;
+    S3RequestContextTimerCallback *timerCallback;
+    void *eventCallbackData;
+    int64_t reportedDeadline;
+
+    // For S3RequestContextEngineThreaded: the workers which run the requests
+    // (see request_worker.h), the one the next request goes to, and the
+    // number of requests submitted which have not completed, which waiters
+    // for it to reach zero watch using idleMutex and idleCond
+    struct RequestWorker *workers;
+    int workerCount;
+    volatile unsigned int nextWorker;
+    volatile int pendingCount;
+    pthread_mutex_t idleMutex;
+    pthread_cond_t idleCond;
+
+    // Also for S3RequestContextEngineThreaded: the settings which the
+    // workers apply to their own contexts, and a count of the changes to
+    // them
+    int maxHostConnections, maxStreams;
+    volatile int configGeneration;
+
+    // The context whose completion queue this context's finished requests
+    // are posted to: itself, or for a worker's context, the threaded context
+    // it belongs to; or 0 to make their complete callbacks instead
+    struct S3RequestContext *completionQueue;
+
+    // Completions posted and not yet taken, most recent first, and those
+    // moved from there but not yet returned to the application, oldest first
+    // (see request_queue.h)
+    struct RequestCompletion * volatile completionsPosted;
+    struct RequestCompletion *completionsTaken;
+
+    // Hedging (see S3_set_request_context_hedging): the fixed threshold in
+    // milliseconds and the percentile to use instead once known (0 for none)
+    int hedgeThresholdMs, hedgePercentile;
+
+    // GETs and HEADs which may yet be hedged, oldest (and so first due)
+    // first, and requests which have lost to their hedge partners and are to
+    // be removed
+    struct Request *hedgeCandidatesHead, *hedgeCandidatesTail;
+    struct Request *hedgeLosers;
+
+    // The times to first response headers of recent requests, as a ring
+    // indexed by the number recorded, and the percentile last computed from
+    // them
+    int hedgeSamples[HEDGE_SAMPLE_COUNT];
+    uint64_t hedgeSampleCount;
+    int hedgePercentileMs;
+
+    S3HedgeStats hedgeStats;
+
+    // Nonzero during the multi calls which transfer data, from within which
+    // (that is, from request callbacks) no request may be removed; requests
+    // cancelled then wait on cancelledRequests until the multi call returns
+    int performing;
+    struct Request *cancelledRequests;
+
+    // Retrying (see S3_set_request_context_retry_policy): the policy, with
+    // its defaults filled in, the tokens left in the retry budget, and the
+    // state of the generator of random retry delays
+    S3RetryPolicy retryPolicy;
+    int retryTokens;
+    uint64_t retryRandom;
+
+    // Requests waiting to be retried or for their rate limits to let them
+    // start, in the order in which they fall due, of which there are
+    // delayedCount
+    struct QueuedRequest *delayedHead;
+    int delayedCount;
+
+    // Rate limiting (see S3_set_request_context_rate_limiting): whether it is
+    // on, the lowest rate it goes down to, and the groups of requests limited
+    // (see rate_limit.h), most recently used first, of which there are
+    // rateLimitCount
+    int rateLimiting;
+    double rateLimitMin;
+    struct RateLimit *rateLimits;
+    int rateLimitCount;
+
+    // See S3_set_request_context_timeouts and
+    // S3_set_request_context_max_resumes
+    S3RequestTimeouts timeouts;
+    int maxResumes;
+
+    // Bandwidth limits (see bandwidth.h): those of the context as a whole,
+    // which are also on the list of all of them, and the requests whose
+    // transfers are paused for want of bandwidth
+    struct BandwidthLimit *bandwidth, *bandwidthLimits;
+    struct Request *pausedRequests;
+
+    // Endpoint balancing (see S3_set_request_context_endpoint_balancing):
+    // how addresses are chosen, how often hosts are resolved again, and the
+    // hosts connected to (see endpoint.h), most recently used first, of
+    // which there are endpointCount
+    S3EndpointBalancing endpointBalancing;
+    int endpointRefreshMs;
+    struct Endpoint *endpoints;
+    int endpointCount;
+
+    // Requests waiting for their first response headers under
+    // timeouts.firstByteTimeoutMs, oldest (and so first due) first
+    struct Request *firstByteHead, *firstByteTail;
 };
 
 
+// For S3RequestContextEngineExternal: passes the time at which the context
+// next needs S3_process_request_context_timeout to the caller's timer
+// callback, if it has changed.  That is the earlier of curl's timeout and the
+// next hedge, retry, first byte timeout or bandwidth resume (see
+// request_timeout).
+void request_context_update_timer(S3RequestContext *context);
+
+
 #endif /* REQUEST_CONTEXT_H */
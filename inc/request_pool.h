@@ -0,0 +1,58 @@
+/** **************************************************************************
+ * request_pool.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#ifndef REQUEST_POOL_H
+#define REQUEST_POOL_H
+
+#include "request.h"
+
+// The request pool keeps idle Request structures (and, more importantly,
+// their curl handles and the live connections those hold) for re-use.  Each
+// thread has a small private cache which is used without any locking; behind
+// that is a lock-free shared pool whose capacity is fixed at initialization
+// time.  Requests are always handed out most-recently-used first, to maximize
+// the chances of re-using a TCP connection before it times out.
+
+
+// Called to destroy a Request that the pool has no room for
+typedef void (RequestPoolDestroyFunc)(Request *request);
+
+// Initializes the pool, with the capacity given to
+// S3_set_request_pool_capacity or else a default based on the number of
+// online CPUs
+S3Status request_pool_initialize(RequestPoolDestroyFunc *destroyFunc);
+
+// Destroys every Request held by the pool, including those in per-thread
+// caches, and releases the pool's resources
+void request_pool_deinitialize();
+
+// Returns an idle Request from the pool, or 0 if there is none
+Request *request_pool_get();
+
+// Returns a Request to the pool; if the pool is full the Request is destroyed
+void request_pool_put(Request *request);
+
+#endif /* REQUEST_POOL_H */
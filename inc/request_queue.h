@@ -0,0 +1,124 @@
+/** **************************************************************************
+ * request_queue.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#ifndef REQUEST_QUEUE_H
+#define REQUEST_QUEUE_H
+
+#include "request.h"
+
+// The request queue holds requests made on an S3RequestContext which has no
+// room for them to be in flight yet (see S3_set_request_context_max_in_flight)
+// in first-in, first-out order.  A queued request holds only a copy of its
+// RequestParams, together with everything they point to, in a single
+// allocation; the much larger Request, curl handle and computed headers are
+// not set up until the request is admitted.
+
+
+typedef struct QueuedRequest
+{
+    struct QueuedRequest *next;
+
+    // The handle that the request will have once started
+    S3RequestHandle handle;
+
+    // For a request waiting to be retried: the monotonic time at which it
+    // falls due, how many times it will have been retried, and the delay
+    // before this retry
+    int64_t dueMs;
+    int retries, retryDelayMs;
+
+    // For a GET resuming where an earlier attempt stopped, how many times it
+    // will have been resumed
+    int resumes;
+
+    // The monotonic time by which the request must have completed, however
+    // many times it is tried, or 0 if there is no deadline (see
+    // S3_set_request_context_timeouts)
+    int64_t deadlineMs;
+
+    // Refers only to memory within this QueuedRequest's allocation
+    RequestParams params;
+} QueuedRequest;
+
+
+// Returns a newly allocated QueuedRequest holding a copy of params, not on
+// any queue, or 0 if it could not be allocated; the caller frees it with
+// free()
+QueuedRequest *queued_request_create(const RequestParams *params);
+
+// Adds a copy of the request to the tail of the context's queue; returns
+// S3StatusOutOfMemory if the copy could not be allocated
+S3Status request_queue_push(S3RequestContext *context,
+                            const RequestParams *params,
+                            S3RequestHandle handle, int64_t deadlineMs);
+
+// Removes the request with the given handle from the context's queue and
+// returns it, or 0 if it is not queued; the caller frees it with free()
+QueuedRequest *request_queue_remove(S3RequestContext *context,
+                                    S3RequestHandle handle);
+
+// Adds a QueuedRequest, not on any queue, to the tail of the context's queue
+void request_queue_append(S3RequestContext *context, QueuedRequest *queued);
+
+// Removes and returns the request at the head of the context's queue, or 0 if
+// the queue is empty; the caller frees it with free()
+QueuedRequest *request_queue_pop(S3RequestContext *context);
+
+
+// The completion queue of a context (see
+// S3_set_request_context_completion_queue) holds the completions of its
+// finished requests until the application takes them.  A completion holds
+// copies of the request's error details and response properties in the same
+// allocation, so it outlives the Request.  Completions are posted, possibly
+// by several worker threads at once, to a stack with a compare-and-swap, and
+// the application takes the whole stack at once, in the same way as the
+// submission stacks of request_worker.h.
+
+typedef struct RequestCompletion
+{
+    // What the application sees; first, so that the application's pointer to
+    // it is also a pointer to the RequestCompletion
+    S3Completion completion;
+
+    struct RequestCompletion *next;
+
+    // Made when the application releases the completion
+    S3ResponseCompleteCallback *completeCallback;
+} RequestCompletion;
+
+
+// Reports that a request made on context (0 for a synchronous request) has
+// completed: if the context has a completion queue, posts a completion to it;
+// otherwise, makes the complete callback, if there is one.  error and
+// properties may be 0.
+void request_complete(S3RequestContext *context,
+                      S3ResponseCompleteCallback *completeCallback,
+                      void *callbackData, S3Status status,
+                      const S3ErrorDetails *error,
+                      const S3ResponseProperties *properties);
+
+#endif /* REQUEST_QUEUE_H */
@@ -0,0 +1,112 @@
+/** **************************************************************************
+ * request_worker.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#ifndef REQUEST_WORKER_H
+#define REQUEST_WORKER_H
+
+#include <pthread.h>
+#include "request.h"
+#include "request_queue.h"
+
+// The worker threads of an S3RequestContext created by
+// S3_create_request_context_threaded.  Each worker runs requests in an
+// ordinary S3RequestContext of its own, which only it ever touches.  Any
+// thread may submit requests: a submission is a copy of the request's
+// RequestParams (see request_queue.h), pushed onto one worker's submission
+// stack with a compare-and-swap, after which the worker is woken with
+// curl_multi_wakeup.  The worker takes the whole stack at once, which
+// restores submission order and makes the stack immune to ABA.
+//
+// Cancellations are pushed onto a second stack of every worker in the same
+// way, since any of them may have the request.  A worker takes its
+// cancellations before its submissions, so that it has always seen the
+// submission of any request that it is asked to cancel.
+
+
+typedef struct RequestCancel
+{
+    struct RequestCancel *next;
+
+    S3RequestHandle handle;
+} RequestCancel;
+
+
+typedef struct RequestWorker
+{
+    // The threaded S3RequestContext which the worker belongs to
+    S3RequestContext *owner;
+
+    // The worker's own context, in which it runs its requests
+    S3RequestContext *context;
+
+    // Requests submitted to the worker and not yet taken by it, most
+    // recently submitted first
+    QueuedRequest * volatile submissions;
+
+    // Requests to cancel, most recently cancelled first
+    RequestCancel * volatile cancels;
+
+    // Set to make the worker exit
+    volatile int stop;
+
+    // The owner's configGeneration when the worker last applied the owner's
+    // settings to its context
+    int configGeneration;
+
+    // The number of requests the worker has taken which have not completed
+    int takenCount;
+
+    pthread_t thread;
+} RequestWorker;
+
+
+// Creates the context's workers and starts their threads; returns
+// S3StatusNotSupported if libcurl is too old to wake a worker up
+S3Status request_workers_start(S3RequestContext *context, int workerCount);
+
+// Stops and joins the context's workers, then completes every request they
+// have not with S3StatusInterrupted
+void request_workers_stop(S3RequestContext *context);
+
+// Submits a copy of the request, with the handle and deadline it has been
+// given, to one of the context's workers
+void request_workers_submit(S3RequestContext *context,
+                            const RequestParams *params,
+                            S3RequestHandle handle, int64_t deadlineMs);
+
+// Asks every worker to cancel the request with the given handle; returns
+// S3StatusOutOfMemory if they could not be asked
+S3Status request_workers_cancel(S3RequestContext *context,
+                                S3RequestHandle handle);
+
+// Waits until every request submitted to the context has completed
+void request_workers_wait(S3RequestContext *context);
+
+// Makes the workers apply the context's current settings to their contexts
+void request_workers_configure(S3RequestContext *context);
+
+#endif /* REQUEST_WORKER_H */
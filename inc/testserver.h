@@ -0,0 +1,119 @@
+/** **************************************************************************
+ * testserver.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#ifndef TESTSERVER_H
+#define TESTSERVER_H
+
+#include <pthread.h>
+
+// A minimal HTTP/1.1 stand-in for S3, used by the libs3 test programs.  It
+// runs on its own thread, listens on a loopback port, keeps connections
+// alive, and answers every request with a canned success response:
+//   GET    - 200 with bodySize bytes of body
+//   HEAD   - 200 with a Content-Length of bodySize and no body
+//   PUT    - reads the request body, then 200 with an ETag
+//   POST   - reads the request body, then 200 with an empty body
+//   DELETE - 204
+// except that any request for a path containing "/missing" gets a 404 with
+// a NoSuchKey error document.  Those, and the responses to GET and HEAD,
+// carry an x-amz-request-id of "testrequestid".  Requests for a path
+// containing "/slow" can be left unanswered (see slowCount), those for a
+// path containing "/flaky" can be failed (see failCount), and those for a
+// path containing "/busy" can be told to slow down (see busyCount).  GETs
+// honour Range and If-Match (against the one ETag, TEST_SERVER_ETAG, which
+// every object has), their bodies are TEST_SERVER_BODY_BYTE repeated, and
+// those for a path containing "/stall" or "/cut" can be stopped halfway
+// (see stallCount and cutCount).  It is not a real S3 and checks no request
+// signatures, except those of the chunks of bodies sent in aws-chunked
+// encoding (see secretAccessKey).
+// The ETag of every object, and the byte at each offset of every object's
+// body
+#define TEST_SERVER_ETAG "\"0123456789abcdef\""
+#define TEST_SERVER_BODY_BYTE(offset) ((char) ('a' + ((offset) % 26)))
+
+typedef struct TestServer
+{
+    // The loopback port the server is listening on, filled in by
+    // test_server_start
+    int port;
+
+    // Number of bytes of body to return from GET (and advertise from HEAD)
+    int bodySize;
+
+    // Number of further requests for a path containing "/slow" to leave
+    // unanswered, as a stand-in for a server which is slow to respond; each
+    // one left unanswered counts this down
+    volatile int slowCount;
+
+    // Number of further requests for a path containing "/flaky" to answer
+    // with a 500 InternalError; each one answered so counts this down
+    volatile int failCount;
+
+    // Number of further requests for a path containing "/busy" to answer
+    // with a 503 SlowDown; each one answered so counts this down
+    volatile int busyCount;
+
+    // Number of further GETs for a path containing "/stall" to stop sending
+    // halfway through the body, leaving the connection open; and likewise
+    // for "/cut", closing the connection
+    volatile int stallCount, cutCount;
+
+    // The secret access key with which to check the chunk signatures of
+    // bodies sent in aws-chunked encoding (0 to check only their framing and
+    // length), and the number of such bodies received intact, and not; those
+    // not received intact are answered with a 403 SignatureDoesNotMatch
+    const char *secretAccessKey;
+    volatile int chunkedCount, badChunkedCount;
+
+    // Number of TCP connections that have been accepted
+    volatile int acceptCount;
+
+    // Number of HTTP requests that have been answered
+    volatile int requestCount;
+
+    // The request line (e.g. "GET /bucket/key HTTP/1.1") of the most recent
+    // request, and the SignedHeaders of its Authorization header (empty if
+    // it has none)
+    char lastRequestLine[256];
+    char lastSignedHeaders[4096];
+
+    // Number of requests whose Authorization header signs a header which
+    // the request does not have
+    volatile int unsentSignedCount;
+
+    // Internal state
+    int listenFd, epollFd, stopPipe[2];
+    pthread_t thread;
+} TestServer;
+
+
+// Starts the server; returns 0 on success, nonzero on failure
+int test_server_start(TestServer *server);
+
+// Stops the server thread and closes its listening socket
+void test_server_stop(TestServer *server);
+
+#endif /* TESTSERVER_H */
@@ -0,0 +1,107 @@
+/** **************************************************************************
+ * urlencode_kernels.h
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+
+// The URL-encoding loop of util.c, for vectors of URLENCODE_WIDTH bytes.
+// This is included by util.c once for each vector width, with
+// URLENCODE_WIDTH, URLENCODE_TARGET (the instruction set to compile for) and
+// URLENCODE_NAME (which names the function for the width) defined; so it has
+// no include guard.
+//
+// Every byte of a vector is classified at once; a vector which is all
+// unreserved characters, as most of a typical key is, is copied whole, and
+// only the bytes of other vectors are handled one at a time.
+
+typedef unsigned char URLENCODE_NAME(Vector)
+    __attribute__((vector_size(URLENCODE_WIDTH)));
+typedef signed char URLENCODE_NAME(Mask)
+    __attribute__((vector_size(URLENCODE_WIDTH)));
+
+#define V URLENCODE_NAME(Vector)
+#define M URLENCODE_NAME(Mask)
+
+// URL-encodes the first len bytes of src into dest, as urlEncode does, a
+// vector at a time for as long as there is a whole vector left; returns the
+// number of bytes of src encoded, having advanced *destp past what was
+// written
+__attribute__((target(URLENCODE_TARGET)))
+static int URLENCODE_NAME(url_encode_vectors)(char **destp,
+                                              const unsigned char *src,
+                                              int len, int encodeSlash)
+{
+    char *dest = *destp;
+    signed char keepSlash = encodeSlash ? 0 : -1;
+    int i = 0, j;
+
+    while ((len - i) >= URLENCODE_WIDTH) {
+        V c, lower;
+        M unreserved;
+        uint64_t words[URLENCODE_WIDTH / 8];
+
+        memcpy(&c, &(src[i]), sizeof(V));
+        lower = c | 0x20;
+        unreserved = (((c >= '0') & (c <= '9')) |
+                      ((lower >= 'a') & (lower <= 'z')) |
+                      (c == '-') | (c == '.') | (c == '_') | (c == '~') |
+                      ((c == '/') & keepSlash));
+
+        // The vector is copied whole, which dest has room for since it has
+        // room for every byte left to be encoded three times over; what
+        // follows the run of unreserved characters it starts with is then
+        // written over
+        memcpy(dest, &c, sizeof(V));
+        memcpy(words, &unreserved, sizeof(words));
+        int run = 0;
+        for (j = 0; j < (URLENCODE_WIDTH / 8); j++) {
+            if (words[j] != ~((uint64_t) 0)) {
+                run += __builtin_ctzll(~words[j]) / 8;
+                break;
+            }
+            run += 8;
+        }
+        dest += run;
+
+        // The rest of the vector, by the classification already made
+        const unsigned char *flags = (const unsigned char *) words;
+        for (j = run; j < URLENCODE_WIDTH; j++) {
+            if (flags[j]) {
+                *dest++ = src[i + j];
+            }
+            else {
+                dest = url_encode_byte(dest, src[i + j]);
+            }
+        }
+        i += URLENCODE_WIDTH;
+    }
+
+    *destp = dest;
+
+    return i;
+}
+
+#undef V
+#undef M
@@ -78,6 +78,13 @@
 // urlEncode, else nonzero is returned.
 int urlEncode(char *dest, const char *src, int maxSrcSize, int encodeSlash);
 
+// Sets the widest vectors which urlEncode uses, as far as the CPU has them:
+// 1 to encode one byte at a time, 16 or 32 for vectors of that many bytes,
+// or 0 for the widest there are.  This is for testing and measuring the
+// implementations against one another.  Returns the width of the widest
+// vectors the CPU has, in bytes.
+int urlEncodeSetWidth(int width);
+
 // Returns < 0 on failure >= 0 on success
 int64_t parseIso8601Time(const char *str);
 
@@ -87,4 +94,14 @@ uint64_t parseUnsignedInt(const char *str);
 // easy function to write in any case
 int is_blank(char c);
 
+// Returns the current time in milliseconds from an arbitrary fixed point,
+// unaffected by changes to the system clock
+int64_t monotonic_ms();
+
+// Writes the lowercase hex of len bytes to hex, followed by a nul
+void hex_encode(const unsigned char *bytes, int len, char *hex);
+
+// Writes the base64 of len bytes to base64, padded, followed by a nul
+void base64_encode(const unsigned char *bytes, int len, char *base64);
+
 #endif /* UTIL_H */
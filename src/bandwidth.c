@@ -0,0 +1,356 @@
+/** **************************************************************************
+ * bandwidth.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "bandwidth.h"
+#include "request_context.h"
+#include "util.h"
+
+
+// Returns the most that a token bucket may hold
+static double bucket_capacity(const TokenBucket *bucket)
+{
+    double capacity = bucket->rate / 10.0;
+
+    return (capacity < CURL_MAX_WRITE_SIZE) ? CURL_MAX_WRITE_SIZE : capacity;
+}
+
+
+// Adds the tokens which have accrued since the bucket was last filled
+static void bucket_fill(TokenBucket *bucket, int64_t now)
+{
+    if (bucket->rate) {
+        bucket->tokens += ((now - bucket->filledMs) * bucket->rate) / 1000.0;
+        double capacity = bucket_capacity(bucket);
+        if (bucket->tokens > capacity) {
+            bucket->tokens = capacity;
+        }
+    }
+    bucket->filledMs = now;
+}
+
+
+// Counts bytes towards the bucket's measured rate, starting a new window
+// once the current one has lasted a second
+static void bucket_measure(TokenBucket *bucket, int64_t now, size_t bytes)
+{
+    if ((now - bucket->windowStartMs) >= 1000) {
+        bucket->previousStartMs = bucket->windowStartMs;
+        bucket->previousBytes = bucket->windowBytes;
+        bucket->windowStartMs = now;
+        bucket->windowBytes = 0;
+    }
+    bucket->windowBytes += bytes;
+}
+
+
+// Returns the request's token buckets for the given direction: that of the
+// context as a whole, and that of its bucket, either of which may be 0
+static void request_buckets(Request *request, int direction,
+                            TokenBucket *bucketsReturn[2])
+{
+    BandwidthLimit *limits[2] = { request->context->bandwidth,
+                                  request->bandwidth };
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        bucketsReturn[i] = !limits[i] ? 0 : (direction == BANDWIDTH_UPLOAD) ?
+            &(limits[i]->upload) : &(limits[i]->download);
+    }
+}
+
+
+static void bucket_initialize(TokenBucket *bucket, int64_t now)
+{
+    bucket->rate = 0;
+    bucket->tokens = 0;
+    bucket->filledMs = now;
+    bucket->windowStartMs = now;
+    bucket->windowBytes = 0;
+    bucket->previousStartMs = now;
+    bucket->previousBytes = 0;
+}
+
+
+BandwidthLimit *bandwidth_limit_get(S3RequestContext *context,
+                                    const char *bucketName, int create)
+{
+    BandwidthLimit *limit;
+
+    for (limit = context->bandwidthLimits; limit; limit = limit->next) {
+        if (bucketName ? (limit->bucketName &&
+                          !strcmp(limit->bucketName, bucketName)) :
+            !limit->bucketName) {
+            return limit;
+        }
+    }
+
+    if (!create) {
+        return 0;
+    }
+
+    size_t nameSize = bucketName ? (strlen(bucketName) + 1) : 0;
+    if (!(limit = (BandwidthLimit *) malloc(sizeof(BandwidthLimit) +
+                                            nameSize))) {
+        return 0;
+    }
+
+    if (bucketName) {
+        memcpy(&(limit[1]), bucketName, nameSize);
+        limit->bucketName = (const char *) &(limit[1]);
+    }
+    else {
+        limit->bucketName = 0;
+        context->bandwidth = limit;
+    }
+
+    int64_t now = monotonic_ms();
+    bucket_initialize(&(limit->download), now);
+    bucket_initialize(&(limit->upload), now);
+
+    limit->next = context->bandwidthLimits;
+    context->bandwidthLimits = limit;
+
+    return limit;
+}
+
+
+void bandwidth_set_rate(TokenBucket *bucket, int64_t rate)
+{
+    int64_t now = monotonic_ms();
+
+    // Whatever accrued at the old rate is kept; a bucket which was not
+    // limited starts out full
+    bucket_fill(bucket, now);
+    int wasLimited = (bucket->rate != 0);
+    bucket->rate = (rate > 0) ? rate : 0;
+    if (!wasLimited || (bucket->tokens > bucket_capacity(bucket))) {
+        bucket->tokens = bucket_capacity(bucket);
+    }
+}
+
+
+double bandwidth_measured_rate(TokenBucket *bucket)
+{
+    int64_t now = monotonic_ms();
+
+    bucket_measure(bucket, now, 0);
+
+    if (now == bucket->previousStartMs) {
+        return 0;
+    }
+
+    return ((bucket->previousBytes + bucket->windowBytes) * 1000.0) /
+        (now - bucket->previousStartMs);
+}
+
+
+size_t bandwidth_allow(Request *request, int direction, size_t len)
+{
+    TokenBucket *buckets[2];
+    int64_t now = monotonic_ms();
+    int i;
+
+    request_buckets(request, direction, buckets);
+
+    for (i = 0; i < 2; i++) {
+        if (!buckets[i] || !buckets[i]->rate) {
+            continue;
+        }
+        bucket_fill(buckets[i], now);
+        if (buckets[i]->tokens < 1) {
+            len = 0;
+            break;
+        }
+        if (buckets[i]->tokens < len) {
+            len = (size_t) buckets[i]->tokens;
+        }
+    }
+
+    if (!len) {
+        if (!request->pausedDirections) {
+            S3RequestContext *context = request->context;
+            request->pausedNext = context->pausedRequests;
+            context->pausedRequests = request;
+        }
+        request->pausedDirections |= (direction == BANDWIDTH_UPLOAD) ?
+            CURLPAUSE_SEND : CURLPAUSE_RECV;
+    }
+
+    return len;
+}
+
+
+void bandwidth_use(Request *request, int direction, size_t bytes)
+{
+    TokenBucket *buckets[2];
+    int64_t now = monotonic_ms();
+    int i;
+
+    request_buckets(request, direction, buckets);
+
+    for (i = 0; i < 2; i++) {
+        if (buckets[i]) {
+            if (buckets[i]->rate) {
+                buckets[i]->tokens -= bytes;
+            }
+            bucket_measure(buckets[i], now, bytes);
+        }
+    }
+}
+
+
+// Returns nonzero if the request may transfer in the given direction
+static int request_may_transfer(Request *request, int direction, int64_t now)
+{
+    TokenBucket *buckets[2];
+    int i;
+
+    request_buckets(request, direction, buckets);
+
+    for (i = 0; i < 2; i++) {
+        if (buckets[i] && buckets[i]->rate) {
+            bucket_fill(buckets[i], now);
+            if (buckets[i]->tokens < 1) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+int request_bandwidth_resume(S3RequestContext *context)
+{
+    Request *paused = context->pausedRequests;
+    int64_t now = monotonic_ms();
+    int resumed = 0;
+
+    context->pausedRequests = 0;
+
+    // Unpausing hands the transfer buffered data straight away, from within
+    // curl, so callbacks are made
+    context->performing = 1;
+
+    while (paused) {
+        Request *request = paused;
+        paused = request->pausedNext;
+        request->pausedNext = 0;
+
+        int directions = request->pausedDirections, stillPaused = 0;
+        request->pausedDirections = 0;
+        if ((directions & CURLPAUSE_RECV) &&
+            !request_may_transfer(request, BANDWIDTH_DOWNLOAD, now)) {
+            stillPaused |= CURLPAUSE_RECV;
+        }
+        if ((directions & CURLPAUSE_SEND) &&
+            !request_may_transfer(request, BANDWIDTH_UPLOAD, now)) {
+            stillPaused |= CURLPAUSE_SEND;
+        }
+
+        // The callbacks made on unpausing may pause it again, which puts it
+        // back on the list
+        if (stillPaused) {
+            request->pausedDirections = stillPaused;
+            request->pausedNext = context->pausedRequests;
+            context->pausedRequests = request;
+        }
+        if (stillPaused != directions) {
+            curl_easy_pause(request->curl, stillPaused);
+            resumed = 1;
+        }
+    }
+
+    context->performing = 0;
+
+    return resumed;
+}
+
+
+void bandwidth_paused_remove(Request *request)
+{
+    Request **link = &(request->context->pausedRequests);
+
+    while (*link && (*link != request)) {
+        link = &((*link)->pausedNext);
+    }
+    if (*link) {
+        *link = request->pausedNext;
+    }
+    request->pausedNext = 0;
+    request->pausedDirections = 0;
+}
+
+
+int64_t bandwidth_timeout(S3RequestContext *context)
+{
+    if (!context->pausedRequests) {
+        return -1;
+    }
+
+    // Paused requests wait on whichever empty bucket fills soonest; if none
+    // is empty (its limit having been raised or removed), they can go now
+    int64_t timeout = 0, now = monotonic_ms();
+    int empty = 0;
+    BandwidthLimit *limit;
+
+    for (limit = context->bandwidthLimits; limit; limit = limit->next) {
+        TokenBucket *buckets[2] = { &(limit->download), &(limit->upload) };
+        int i;
+        for (i = 0; i < 2; i++) {
+            TokenBucket *bucket = buckets[i];
+            if (!bucket->rate) {
+                continue;
+            }
+            bucket_fill(bucket, now);
+            if (bucket->tokens >= 1) {
+                continue;
+            }
+            int64_t untilFilled =
+                (int64_t) (((1 - bucket->tokens) * 1000) / bucket->rate) + 1;
+            if (!empty || (untilFilled < timeout)) {
+                timeout = untilFilled;
+            }
+            empty = 1;
+        }
+    }
+
+    return timeout;
+}
+
+
+void bandwidth_limits_destroy(S3RequestContext *context)
+{
+    while (context->bandwidthLimits) {
+        BandwidthLimit *limit = context->bandwidthLimits;
+        context->bandwidthLimits = limit->next;
+        free(limit);
+    }
+    context->bandwidth = 0;
+}
@@ -27,13 +27,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifndef __APPLE__
-    #include <openssl/md5.h>
-    #include <openssl/bio.h>
-    #include <openssl/evp.h>
-    #include <openssl/buffer.h>
-#endif
-
 #include "libs3.h"
 #include "request.h"
 
@@ -154,7 +147,8 @@ void S3_get_acl(const S3BucketContext *bucketContext, const char *key,
         &getAclDataCallback,                          // fromS3Callback
         &getAclCompleteCallback,                      // completeCallback
         gaData,                                       // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -360,7 +354,8 @@ void S3_set_acl(const S3BucketContext *bucketContext, const char *key,
         0,                                            // fromS3Callback
         &setXmlCompleteCallback,                      // completeCallback
         data,                                         // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -468,7 +463,8 @@ void S3_get_lifecycle(const S3BucketContext *bucketContext,
         &getLifecycleDataCallback,                    // fromS3Callback
         &getLifecycleCompleteCallback,                // completeCallback
         gaData,                                       // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -476,43 +472,21 @@ void S3_get_lifecycle(const S3BucketContext *bucketContext,
 }
 
 
-#ifndef __APPLE__
 // Calculate MD5 and encode it as base64
 void generate_content_md5(const char* data, int size,
                           char* retBuffer, int retBufferSize) {
-    MD5_CTX mdContext;
-    BIO *bio, *b64;
-    BUF_MEM *bufferPtr;
-
-    char md5Buffer[MD5_DIGEST_LENGTH];
-
-    MD5_Init(&mdContext);
-    MD5_Update(&mdContext, data, size);
-    MD5_Final((unsigned char*)md5Buffer, &mdContext);
+    char md5[S3_CONTENT_MD5_SIZE];
+    uint64_t len = size;
 
+    S3_compute_content_md5s(1, &data, &len, &md5);
 
-    b64 = BIO_new(BIO_f_base64());
-    bio = BIO_new(BIO_s_mem());
-    bio = BIO_push(b64, bio);
-
-    BIO_set_flags(bio, BIO_FLAGS_BASE64_NO_NL); //Ignore newlines - write everything in one line
-    BIO_write(bio, md5Buffer, sizeof(md5Buffer));
-    (void) BIO_flush(bio);
-    BIO_get_mem_ptr(bio, &bufferPtr);
-    (void) BIO_set_close(bio, BIO_NOCLOSE);
-
-    if ((unsigned int)retBufferSize + 1 < bufferPtr->length) {
+    if (retBufferSize < (int) sizeof(md5)) {
         retBuffer[0] = '\0';
-        BIO_free_all(bio);
         return;
     }
 
-    memcpy(retBuffer, bufferPtr->data, bufferPtr->length);
-    retBuffer[bufferPtr->length] = '\0';
-
-    BIO_free_all(bio);
+    memcpy(retBuffer, md5, sizeof(md5));
 }
-#endif
 
 
 void S3_set_lifecycle(const S3BucketContext *bucketContext,
@@ -521,15 +495,7 @@ void S3_set_lifecycle(const S3BucketContext *bucketContext,
                       int timeoutMs,
                       const S3ResponseHandler *handler, void *callbackData)
 {
-#ifdef __APPLE__
-    /* This request requires calculating MD5 sum.
-     * MD5 sum requires OpenSSL library, which is not used on Apple.
-     * TODO Implement some MD5+Base64 caculation on Apple
-     */
-    (*(handler->completeCallback))(S3StatusNotSupported, 0, callbackData);
-    return;
-#else
-    char md5Base64[MD5_DIGEST_LENGTH * 2];
+    char md5Base64[S3_CONTENT_MD5_SIZE];
 
     SetXmlData *data = (SetXmlData *) malloc(sizeof(SetXmlData));
     if (!data) {
@@ -592,11 +558,11 @@ void S3_set_lifecycle(const S3BucketContext *bucketContext,
         0,                                            // fromS3Callback
         &setXmlCompleteCallback,                      // completeCallback
         data,                                         // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
     request_perform(&params, requestContext);
-#endif
 }
 
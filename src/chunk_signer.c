@@ -0,0 +1,257 @@
+/** **************************************************************************
+ * chunk_signer.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chunk_signer.h"
+#include "util.h"
+
+#ifdef __APPLE__
+#include <CommonCrypto/CommonHMAC.h>
+#define S3_SHA256_DIGEST_LENGTH CC_SHA256_DIGEST_LENGTH
+#else
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#define S3_SHA256_DIGEST_LENGTH SHA256_DIGEST_LENGTH
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+#endif
+
+// Room for the longest chunk header: the hex size, ";chunk-signature=", the
+// signature and "\r\n"
+#define CHUNK_HEADER_SIZE (8 + 17 + (2 * S3_SHA256_DIGEST_LENGTH) + 2)
+
+
+struct ChunkSigner
+{
+    // What the chunk signatures are made with, and the signature of the
+    // chunk before (or of the request, for the first chunk)
+    unsigned char signingKey[S3_SHA256_DIGEST_LENGTH];
+    char date[17];
+    char scope[128];
+    char previousSignature[(2 * S3_SHA256_DIGEST_LENGTH) + 1];
+
+    // The digest of the data of the chunk being filled
+#ifdef __APPLE__
+    CC_SHA256_CTX digest;
+#else
+    EVP_MD_CTX *digest;
+#endif
+
+    // The bytes of data in the chunk, and nonzero once it has been signed,
+    // and once the empty chunk has been
+    int dataLen, sealed, ended;
+
+    // The bytes of buffer still to be sent, from outPos to outEnd
+    int outPos, outEnd;
+
+    // The chunk, its header written just before its data once it is signed
+    char buffer[CHUNK_HEADER_SIZE + CHUNK_SIGNER_CHUNK_SIZE + 2];
+};
+
+
+static void digest_init(ChunkSigner *signer)
+{
+#ifdef __APPLE__
+    CC_SHA256_Init(&(signer->digest));
+#else
+    EVP_DigestInit_ex(signer->digest, EVP_sha256(), NULL);
+#endif
+}
+
+
+// Returns the length of the encoding of a chunk of size bytes
+static int64_t chunk_length(int64_t size)
+{
+    int digits = 1;
+
+    while (size >> (4 * digits)) {
+        digits++;
+    }
+
+    return digits + sizeof(";chunk-signature=") - 1 +
+        (2 * S3_SHA256_DIGEST_LENGTH) + 2 + size + 2;
+}
+
+
+int64_t chunk_signer_encoded_length(int64_t length)
+{
+    int64_t last = length % CHUNK_SIGNER_CHUNK_SIZE;
+
+    return ((length / CHUNK_SIGNER_CHUNK_SIZE) *
+            chunk_length(CHUNK_SIGNER_CHUNK_SIZE)) +
+        (last ? chunk_length(last) : 0) + chunk_length(0);
+}
+
+
+ChunkSigner *chunk_signer_create(const unsigned char *signingKey,
+                                 const char *date, const char *scope,
+                                 const char *seedSignature)
+{
+    ChunkSigner *signer = (ChunkSigner *) malloc(sizeof(ChunkSigner));
+
+    if (!signer) {
+        return 0;
+    }
+
+#ifndef __APPLE__
+    if (!(signer->digest = EVP_MD_CTX_new())) {
+        free(signer);
+        return 0;
+    }
+#endif
+
+    memcpy(signer->signingKey, signingKey, S3_SHA256_DIGEST_LENGTH);
+    snprintf(signer->date, sizeof(signer->date), "%s", date);
+    snprintf(signer->scope, sizeof(signer->scope), "%s", scope);
+    snprintf(signer->previousSignature, sizeof(signer->previousSignature),
+             "%s", seedSignature);
+    signer->dataLen = 0;
+    signer->sealed = 0;
+    signer->ended = 0;
+    signer->outPos = signer->outEnd = 0;
+    digest_init(signer);
+
+    return signer;
+}
+
+
+void chunk_signer_destroy(ChunkSigner *signer)
+{
+#ifndef __APPLE__
+    EVP_MD_CTX_free(signer->digest);
+#endif
+    free(signer);
+}
+
+
+char *chunk_signer_space(ChunkSigner *signer, int *lenReturn)
+{
+    if (signer->sealed || (signer->dataLen == CHUNK_SIGNER_CHUNK_SIZE)) {
+        *lenReturn = 0;
+        return 0;
+    }
+
+    *lenReturn = CHUNK_SIGNER_CHUNK_SIZE - signer->dataLen;
+
+    return &(signer->buffer[CHUNK_HEADER_SIZE + signer->dataLen]);
+}
+
+
+void chunk_signer_add(ChunkSigner *signer, int len)
+{
+    const char *data = &(signer->buffer[CHUNK_HEADER_SIZE + signer->dataLen]);
+
+#ifdef __APPLE__
+    CC_SHA256_Update(&(signer->digest), data, len);
+#else
+    EVP_DigestUpdate(signer->digest, data, len);
+#endif
+
+    signer->dataLen += len;
+}
+
+
+void chunk_signer_seal(ChunkSigner *signer)
+{
+    unsigned char hash[S3_SHA256_DIGEST_LENGTH];
+    char hashHex[(2 * S3_SHA256_DIGEST_LENGTH) + 1];
+
+#ifdef __APPLE__
+    CC_SHA256_Final(hash, &(signer->digest));
+#else
+    EVP_DigestFinal_ex(signer->digest, hash, NULL);
+#endif
+    hex_encode(hash, S3_SHA256_DIGEST_LENGTH, hashHex);
+
+    char stringToSign[sizeof("AWS4-HMAC-SHA256-PAYLOAD\n") +
+                      sizeof(signer->date) + sizeof(signer->scope) +
+                      (3 * sizeof(hashHex))];
+    int len = snprintf(stringToSign, sizeof(stringToSign),
+                       "AWS4-HMAC-SHA256-PAYLOAD\n%s\n%s\n%s\n%s\n%s",
+                       signer->date, signer->scope,
+                       signer->previousSignature, EMPTY_PAYLOAD_HASH,
+                       hashHex);
+
+    unsigned char signature[S3_SHA256_DIGEST_LENGTH];
+#ifdef __APPLE__
+    CCHmac(kCCHmacAlgSHA256, signer->signingKey, S3_SHA256_DIGEST_LENGTH,
+           stringToSign, len, signature);
+#else
+    HMAC(EVP_sha256(), signer->signingKey, S3_SHA256_DIGEST_LENGTH,
+         (const unsigned char *) stringToSign, len, signature, NULL);
+#endif
+    hex_encode(signature, S3_SHA256_DIGEST_LENGTH,
+               signer->previousSignature);
+
+    // The header goes just before the data, and the trailing CRLF just after
+    char header[CHUNK_HEADER_SIZE + 1];
+    int headerLen = snprintf(header, sizeof(header),
+                             "%x;chunk-signature=%s\r\n", signer->dataLen,
+                             signer->previousSignature);
+    signer->outPos = CHUNK_HEADER_SIZE - headerLen;
+    memcpy(&(signer->buffer[signer->outPos]), header, headerLen);
+    signer->outEnd = CHUNK_HEADER_SIZE + signer->dataLen;
+    signer->buffer[signer->outEnd++] = '\r';
+    signer->buffer[signer->outEnd++] = '\n';
+
+    signer->sealed = 1;
+    signer->ended = !signer->dataLen;
+}
+
+
+int chunk_signer_output(ChunkSigner *signer, char *buffer, int len)
+{
+    if (!signer->sealed) {
+        return 0;
+    }
+
+    if (len > (signer->outEnd - signer->outPos)) {
+        len = signer->outEnd - signer->outPos;
+    }
+    memcpy(buffer, &(signer->buffer[signer->outPos]), len);
+    signer->outPos += len;
+
+    // Once sent, the chunk makes way for the next
+    if ((signer->outPos == signer->outEnd) && !signer->ended) {
+        signer->sealed = 0;
+        signer->dataLen = 0;
+        digest_init(signer);
+    }
+
+    return len;
+}
+
+
+int chunk_signer_ended(const ChunkSigner *signer)
+{
+    return signer->ended;
+}
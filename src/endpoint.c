@@ -0,0 +1,533 @@
+/** **************************************************************************
+ * endpoint.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <ws2tcpip.h>
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#endif
+#include "endpoint.h"
+#include "request_context.h"
+#include "util.h"
+
+// The most addresses kept for one host
+#define ENDPOINT_MAX_ADDRESSES 16
+
+// Beyond this many hosts, those not in use are forgotten
+#define ENDPOINT_MAX_HOSTS 64
+
+// An address is ejected for this long after its first failure, twice as
+// long after its second, and so on up to the most
+#define ENDPOINT_EJECT_MS 5000
+#define ENDPOINT_MAX_EJECT_MS 300000
+
+
+// The addresses of a host, resolved on a thread of its own
+struct EndpointLookup
+{
+    pthread_t thread;
+
+    // The host, without any IPv6 brackets, and port to resolve
+    char host[256], port[16];
+
+    // Set once the lookup has completed, after which the addresses found,
+    // as EndpointAddress has them, are given by count, which is -1 if the
+    // host could not be resolved
+    volatile int done;
+    int count;
+    char addresses[ENDPOINT_MAX_ADDRESSES][64];
+};
+
+
+// Waits for the host's lookup, if it has one under way, and discards it
+static void lookup_discard(Endpoint *endpoint)
+{
+    if (endpoint->lookup) {
+        pthread_join(endpoint->lookup->thread, 0);
+        free(endpoint->lookup);
+        endpoint->lookup = 0;
+    }
+}
+
+
+static void endpoint_free(Endpoint *endpoint)
+{
+    // A lookup under way is waited for, since it writes to the EndpointLookup
+    lookup_discard(endpoint);
+    while (endpoint->addresses) {
+        EndpointAddress *address = endpoint->addresses;
+        endpoint->addresses = address->next;
+        free(address);
+    }
+    free(endpoint);
+}
+
+
+// Forgets the hosts which have no requests in flight, nor a lookup which
+// would have to be waited for
+static void forget_idle(S3RequestContext *context)
+{
+    Endpoint **link = &(context->endpoints);
+
+    while (*link) {
+        Endpoint *endpoint = *link;
+        if (!endpoint->inFlight &&
+            (!endpoint->lookup || endpoint->lookup->done)) {
+            *link = endpoint->next;
+            context->endpointCount--;
+            endpoint_free(endpoint);
+        }
+        else {
+            link = &(endpoint->next);
+        }
+    }
+}
+
+
+// Resolves the lookup's host into its addresses, with the getaddrinfo flags
+// given; returns nonzero if it could not be
+static int lookup_resolve(EndpointLookup *lookup, int flags)
+{
+    struct addrinfo hints, *results, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = flags;
+
+    lookup->count = -1;
+    if (getaddrinfo(lookup->host, lookup->port, &hints, &results)) {
+        return -1;
+    }
+
+    lookup->count = 0;
+    for (result = results;
+         result && (lookup->count < ENDPOINT_MAX_ADDRESSES);
+         result = result->ai_next) {
+        char numeric[56];
+        if (getnameinfo(result->ai_addr, result->ai_addrlen, numeric,
+                        sizeof(numeric), 0, 0, NI_NUMERICHOST)) {
+            continue;
+        }
+        snprintf(lookup->addresses[lookup->count],
+                 sizeof(lookup->addresses[0]),
+                 (result->ai_family == AF_INET6) ? "[%s]" : "%s", numeric);
+        // An address may be listed more than once, once for each protocol
+        int i;
+        for (i = 0; i < lookup->count; i++) {
+            if (!strcmp(lookup->addresses[i],
+                        lookup->addresses[lookup->count])) {
+                break;
+            }
+        }
+        if (i == lookup->count) {
+            lookup->count++;
+        }
+    }
+
+    freeaddrinfo(results);
+
+    return 0;
+}
+
+
+static void *lookup_thread(void *arg)
+{
+    EndpointLookup *lookup = (EndpointLookup *) arg;
+
+    lookup_resolve(lookup, 0);
+
+    // The results are written before they are seen to be done
+    __sync_synchronize();
+    lookup->done = 1;
+
+    return 0;
+}
+
+
+// Takes the addresses the host has been resolved to, marking those which
+// it no longer resolves to as stale.  If it could not be resolved, the
+// addresses already known are kept until the next refresh.
+static void endpoint_update(Endpoint *endpoint, const EndpointLookup *lookup)
+{
+    EndpointAddress *address, **tail = &(endpoint->addresses);
+    int i;
+
+    if (lookup->count < 0) {
+        return;
+    }
+
+    for (address = endpoint->addresses; address; address = address->next) {
+        address->stale = 1;
+        tail = &(address->next);
+    }
+
+    for (i = 0; i < lookup->count; i++) {
+        // Addresses already known keep their counts and ejections
+        for (address = endpoint->addresses; address;
+             address = address->next) {
+            if (!strcmp(address->address, lookup->addresses[i])) {
+                break;
+            }
+        }
+        if (address) {
+            address->stale = 0;
+            continue;
+        }
+        if (!(address = (EndpointAddress *) malloc(sizeof(EndpointAddress)))) {
+            break;
+        }
+        address->next = 0;
+        strcpy(address->address, lookup->addresses[i]);
+        address->stale = 0;
+        address->inFlight = 0;
+        address->requestCount = 0;
+        address->failures = 0;
+        address->ejectedUntilMs = 0;
+        *tail = address;
+        tail = &(address->next);
+    }
+
+    // Addresses no longer resolved go once nothing uses them
+    EndpointAddress **link = &(endpoint->addresses);
+    while ((address = *link)) {
+        if (address->stale && !address->inFlight) {
+            *link = address->next;
+            free(address);
+        }
+        else {
+            link = &(address->next);
+        }
+    }
+}
+
+
+// Resolves the host afresh.  A numeric address is resolved straight away;
+// a host name is looked up on a thread of its own, so that the requests of
+// the context are not held up by it, and its addresses are taken by
+// endpoint_get once the lookup has completed.
+static void endpoint_resolve(Endpoint *endpoint, int64_t now)
+{
+    const char *name = endpoint->name;
+    int hostLen = endpoint->hostLen;
+
+    endpoint->resolvedMs = now;
+
+    if (endpoint->lookup) {
+        return;
+    }
+
+    EndpointLookup *lookup = (EndpointLookup *) malloc(sizeof(*lookup));
+    if (!lookup) {
+        return;
+    }
+
+    // An IPv6 address is resolved without its brackets
+    if ((hostLen > 1) && (name[0] == '[')) {
+        name++;
+        hostLen -= 2;
+    }
+    if (hostLen >= (int) sizeof(lookup->host)) {
+        free(lookup);
+        return;
+    }
+    memcpy(lookup->host, name, hostLen);
+    lookup->host[hostLen] = 0;
+    snprintf(lookup->port, sizeof(lookup->port), "%s",
+             &(endpoint->name[endpoint->hostLen + 1]));
+    lookup->done = 0;
+
+    if (!lookup_resolve(lookup, AI_NUMERICHOST)) {
+        endpoint_update(endpoint, lookup);
+        free(lookup);
+        return;
+    }
+
+    // If the lookup cannot be started, it is tried again at the next refresh
+    if (pthread_create(&(lookup->thread), 0, &lookup_thread, lookup)) {
+        free(lookup);
+        return;
+    }
+    endpoint->lookup = lookup;
+}
+
+
+// Returns the context's Endpoint for the host and port, resolving it if it
+// is new or due to be refreshed, and taking the addresses of its lookup if
+// that has completed; or 0 if there was no memory for it
+static Endpoint *endpoint_get(S3RequestContext *context, const char *host,
+                              int hostLen, const char *port)
+{
+    int64_t now = monotonic_ms();
+    size_t portLen = strlen(port);
+
+    Endpoint **link = &(context->endpoints), *endpoint;
+    while ((endpoint = *link)) {
+        if ((endpoint->hostLen == hostLen) &&
+            !strncmp(endpoint->name, host, hostLen) &&
+            !strcmp(&(endpoint->name[hostLen + 1]), port)) {
+            // Busy hosts stay near the front
+            *link = endpoint->next;
+            endpoint->next = context->endpoints;
+            context->endpoints = endpoint;
+            break;
+        }
+        link = &(endpoint->next);
+    }
+
+    if (!endpoint) {
+        if (context->endpointCount >= ENDPOINT_MAX_HOSTS) {
+            forget_idle(context);
+        }
+        if (!(endpoint = (Endpoint *) malloc(sizeof(Endpoint) + hostLen +
+                                             portLen + 2))) {
+            return 0;
+        }
+        char *name = (char *) &(endpoint[1]);
+        memcpy(name, host, hostLen);
+        name[hostLen] = ':';
+        memcpy(&(name[hostLen + 1]), port, portLen + 1);
+        endpoint->name = name;
+        endpoint->hostLen = hostLen;
+        endpoint->addresses = 0;
+        endpoint->lookup = 0;
+        endpoint->cursor = 0;
+        endpoint->resolvedMs = 0;
+        endpoint->inFlight = 0;
+        endpoint->next = context->endpoints;
+        context->endpoints = endpoint;
+        context->endpointCount++;
+        endpoint_resolve(endpoint, now);
+    }
+    else {
+        // A lookup which has completed gives its addresses
+        if (endpoint->lookup && endpoint->lookup->done) {
+            __sync_synchronize();
+            endpoint_update(endpoint, endpoint->lookup);
+            lookup_discard(endpoint);
+        }
+        if ((now - endpoint->resolvedMs) >= context->endpointRefreshMs) {
+            endpoint_resolve(endpoint, now);
+        }
+    }
+
+    endpoint->usedMs = now;
+
+    return endpoint;
+}
+
+
+// Chooses the address for the host's next request, or returns 0 if it has
+// none
+static EndpointAddress *endpoint_choose(Endpoint *endpoint,
+                                        S3EndpointBalancing balancing)
+{
+    EndpointAddress *usable[ENDPOINT_MAX_ADDRESSES], *address;
+    int count = 0;
+
+    for (address = endpoint->addresses; address; address = address->next) {
+        if (!address->stale && (count < ENDPOINT_MAX_ADDRESSES)) {
+            usable[count++] = address;
+        }
+    }
+
+    if (!count) {
+        return 0;
+    }
+
+    // Starting from the cursor, take the first address which is not
+    // ejected, or the least loaded one, the first of them winning a tie
+    int64_t now = monotonic_ms();
+    int i, chosen = -1, soonest = -1;
+    for (i = 0; i < count; i++) {
+        int index = (endpoint->cursor + i) % count;
+        address = usable[index];
+        if (address->ejectedUntilMs > now) {
+            if ((soonest < 0) || (address->ejectedUntilMs <
+                                  usable[soonest]->ejectedUntilMs)) {
+                soonest = index;
+            }
+            continue;
+        }
+        if (chosen < 0) {
+            chosen = index;
+            if (balancing == S3EndpointBalancingRoundRobin) {
+                break;
+            }
+        }
+        else if (address->inFlight < usable[chosen]->inFlight) {
+            chosen = index;
+        }
+    }
+
+    if (chosen < 0) {
+        chosen = soonest;
+    }
+
+    endpoint->cursor = (chosen + 1) % count;
+
+    return usable[chosen];
+}
+
+
+S3Status endpoint_assign(Request *request)
+{
+    S3RequestContext *context = request->context;
+
+    if (!context ||
+        (context->endpointBalancing == S3EndpointBalancingNone)) {
+        return S3StatusOK;
+    }
+
+    // The host and port are those of the URI, which is what curl connects to
+    const char *authority = strstr(request->uri, "://");
+    if (!authority) {
+        return S3StatusOK;
+    }
+    authority += 3;
+    int authorityLen = strcspn(authority, "/?");
+    const char *hostEnd = authority;
+    if (*authority == '[') {
+        hostEnd = memchr(authority, ']', authorityLen);
+        if (!hostEnd) {
+            return S3StatusOK;
+        }
+        hostEnd++;
+    }
+    else {
+        while ((hostEnd < &(authority[authorityLen])) && (*hostEnd != ':')) {
+            hostEnd++;
+        }
+    }
+    int hostLen = hostEnd - authority;
+
+    char port[16];
+    int portLen = &(authority[authorityLen]) - hostEnd - 1;
+    if ((portLen > 0) && (portLen < (int) sizeof(port)) &&
+        (*hostEnd == ':')) {
+        memcpy(port, &(hostEnd[1]), portLen);
+        port[portLen] = 0;
+    }
+    else {
+        strcpy(port, strncmp(request->uri, "https:", 6) ? "80" : "443");
+    }
+
+    Endpoint *endpoint = endpoint_get(context, authority, hostLen, port);
+    EndpointAddress *address =
+        endpoint ? endpoint_choose(endpoint, context->endpointBalancing) : 0;
+    if (!address) {
+        return S3StatusOK;
+    }
+
+    // HOST:PORT:CONNECT-TO-HOST:CONNECT-TO-PORT
+    char connectTo[512];
+    if (snprintf(connectTo, sizeof(connectTo), "%s:%s:%s", endpoint->name,
+                 address->address, port) >= (int) sizeof(connectTo)) {
+        return S3StatusOK;
+    }
+
+    if (!(request->connectTo = curl_slist_append(0, connectTo)) ||
+        (curl_easy_setopt(request->curl, CURLOPT_CONNECT_TO,
+                          request->connectTo) != CURLE_OK)) {
+        return S3StatusFailedToInitializeRequest;
+    }
+
+    request->endpoint = endpoint;
+    request->endpointAddress = address;
+    endpoint->inFlight++;
+    address->inFlight++;
+    address->requestCount++;
+
+    return S3StatusOK;
+}
+
+
+void endpoint_release(Request *request, S3Status status)
+{
+    Endpoint *endpoint = request->endpoint;
+    EndpointAddress *address = request->endpointAddress;
+
+    if (!address) {
+        return;
+    }
+
+    request->endpoint = 0;
+    request->endpointAddress = 0;
+    endpoint->inFlight--;
+    address->inFlight--;
+
+    // A request which got a response shows the address to be working; one
+    // which never connected, whether refused or timed out, counts against it
+    double connectTime = 0;
+    if (request->httpResponseCode) {
+        address->failures = 0;
+        address->ejectedUntilMs = 0;
+    }
+    else if ((status == S3StatusFailedToConnect) ||
+             ((status == S3StatusErrorRequestTimeout) &&
+              (curl_easy_getinfo(request->curl, CURLINFO_CONNECT_TIME,
+                                 &connectTime) == CURLE_OK) &&
+              (connectTime == 0))) {
+        int64_t ejectMs = ENDPOINT_EJECT_MS;
+        int i;
+        for (i = 0; (i < address->failures) &&
+                 (ejectMs < ENDPOINT_MAX_EJECT_MS); i++) {
+            ejectMs *= 2;
+        }
+        if (ejectMs > ENDPOINT_MAX_EJECT_MS) {
+            ejectMs = ENDPOINT_MAX_EJECT_MS;
+        }
+        address->failures++;
+        address->ejectedUntilMs = monotonic_ms() + ejectMs;
+    }
+
+    // An address which has dropped out of the resolution goes once nothing
+    // uses it
+    if (address->stale && !address->inFlight) {
+        EndpointAddress **link = &(endpoint->addresses);
+        while (*link != address) {
+            link = &((*link)->next);
+        }
+        *link = address->next;
+        free(address);
+    }
+}
+
+
+void endpoints_destroy(S3RequestContext *context)
+{
+    while (context->endpoints) {
+        Endpoint *endpoint = context->endpoints;
+        context->endpoints = endpoint->next;
+        endpoint_free(endpoint);
+    }
+    context->endpointCount = 0;
+}
@@ -194,6 +194,7 @@ const char *S3_get_status_name(S3Status status)
         handlecase(HttpErrorNotFound);
         handlecase(HttpErrorConflict);
         handlecase(HttpErrorUnknown);
+        handlecase(BufferTooSmall);
     }
 
     return "Unknown";
@@ -24,8 +24,12 @@
  *
  ************************************************************************** **/
 
+#include <errno.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <sys/time.h>
 #include <sys/utsname.h>
+#include <time.h>
 
 unsigned long pthread_self()
 {
@@ -67,6 +71,157 @@ int pthread_mutex_destroy(pthread_mutex_t *mutex)
 }
 
 
+typedef struct ThreadStart
+{
+    void *(*startRoutine)(void *);
+
+    void *arg;
+} ThreadStart;
+
+
+static DWORD WINAPI thread_start(LPVOID param)
+{
+    ThreadStart start = *((ThreadStart *) param);
+
+    free(param);
+
+    (*(start.startRoutine))(start.arg);
+
+    return 0;
+}
+
+
+int pthread_create(pthread_t *thread, void *attr,
+                   void *(*start_routine)(void *), void *arg)
+{
+    (void) attr;
+
+    ThreadStart *start = (ThreadStart *) malloc(sizeof(ThreadStart));
+    if (!start) {
+        return ENOMEM;
+    }
+
+    start->startRoutine = start_routine;
+    start->arg = arg;
+
+    if (!(*thread = CreateThread(0, 0, &thread_start, start, 0, 0))) {
+        free(start);
+        return EAGAIN;
+    }
+
+    return 0;
+}
+
+
+int pthread_join(pthread_t thread, void **retval)
+{
+    WaitForSingleObject(thread, INFINITE);
+
+    CloseHandle(thread);
+
+    if (retval) {
+        *retval = 0;
+    }
+
+    return 0;
+}
+
+
+int pthread_cond_init(pthread_cond_t *cond, void *v)
+{
+    (void) v;
+
+    InitializeConditionVariable(&(cond->conditionVariable));
+
+    return 0;
+}
+
+
+int pthread_cond_signal(pthread_cond_t *cond)
+{
+    WakeConditionVariable(&(cond->conditionVariable));
+
+    return 0;
+}
+
+
+int pthread_cond_broadcast(pthread_cond_t *cond)
+{
+    WakeAllConditionVariable(&(cond->conditionVariable));
+
+    return 0;
+}
+
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    SleepConditionVariableCS(&(cond->conditionVariable),
+                             &(mutex->criticalSection), INFINITE);
+
+    return 0;
+}
+
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *abstime)
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+
+    // Convert the absolute deadline into the relative wait that Windows
+    // expects
+    long long waitMs = (((long long) (abstime->tv_sec - now.tv_sec)) * 1000 +
+                        (abstime->tv_nsec / 1000000) - (now.tv_usec / 1000));
+    if (waitMs < 0) {
+        waitMs = 0;
+    }
+
+    if (!SleepConditionVariableCS(&(cond->conditionVariable),
+                                  &(mutex->criticalSection), (DWORD) waitMs)) {
+        return (GetLastError() == ERROR_TIMEOUT) ? ETIMEDOUT : EINVAL;
+    }
+
+    return 0;
+}
+
+
+int pthread_cond_destroy(pthread_cond_t *cond)
+{
+    // Windows condition variables need no cleanup
+    (void) cond;
+
+    return 0;
+}
+
+
+int pthread_key_create(pthread_key_t *key, void (*destructor)(void *))
+{
+    (void) destructor;
+
+    *key = TlsAlloc();
+
+    return (*key == TLS_OUT_OF_INDEXES) ? -1 : 0;
+}
+
+
+int pthread_key_delete(pthread_key_t key)
+{
+    return TlsFree(key) ? 0 : -1;
+}
+
+
+void *pthread_getspecific(pthread_key_t key)
+{
+    return TlsGetValue(key);
+}
+
+
+int pthread_setspecific(pthread_key_t key, const void *value)
+{
+    return TlsSetValue(key, (LPVOID) value) ? 0 : -1;
+}
+
+
 int uname(struct utsname *u)
 {
     OSVERSIONINFO info;
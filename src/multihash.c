@@ -0,0 +1,552 @@
+/** **************************************************************************
+ * multihash.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <string.h>
+#include "libs3.h"
+#include "multihash.h"
+#include "util.h"
+
+#ifdef __APPLE__
+#include <CommonCrypto/CommonDigest.h>
+#else
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+#endif
+
+// The vector block functions need GCC's vector extensions and function
+// targets, and CPU detection
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(__APPLE__)
+#define MULTIHASH_VECTORS
+#endif
+
+// The fewest buffers worth hashing side by side, in vectors of 16 lanes,
+// rather than one at a time with the SHA extensions, which are about 60% as
+// fast as 16 busy lanes
+#define SHA256_SHA_EXTENSIONS_MIN_COUNT 12
+
+// The lanes set by multihash_set_lanes (0 to choose them)
+static int setLanesG = 0;
+
+
+#ifdef MULTIHASH_VECTORS
+
+#include <cpuid.h>
+
+// A hash function which works on 64 byte blocks, for vectors of some number
+// of lanes
+typedef struct Algorithm
+{
+    // Words of hash state, the initial state, and words of digest
+    int stateWords;
+    const uint32_t *initialState;
+    int digestWords;
+
+    // The bytes already hashed into the initial state, before each buffer
+    uint64_t prefixLen;
+
+    // Nonzero if the length at the end, and the digest, are big-endian
+    int bigEndian;
+
+    // Hashes one block into the state of each lane
+    void (*blocks)(uint32_t *state, const unsigned char **blocks);
+} Algorithm;
+
+// What one lane is hashing: the index of its buffer (-1 if it has none);
+// the whole blocks of the buffer still to hash; and the last blocks, which
+// are the end of the buffer padded and followed by its length
+typedef struct Lane
+{
+    int index;
+    const unsigned char *data;
+    uint64_t blocks;
+    unsigned char tail[128];
+    int tailBlocks, tailBlock;
+} Lane;
+
+static const uint32_t md5InitialState[4] =
+{
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476
+};
+
+static const uint32_t sha256InitialState[8] =
+{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static void store_be32(unsigned char *out, uint32_t value)
+{
+    out[0] = value >> 24, out[1] = value >> 16, out[2] = value >> 8;
+    out[3] = value;
+}
+
+
+static void store_le32(unsigned char *out, uint32_t value)
+{
+    out[0] = value, out[1] = value >> 8, out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+
+static uint32_t load_be32(const unsigned char *in)
+{
+    return (((uint32_t) in[0] << 24) | ((uint32_t) in[1] << 16) |
+            ((uint32_t) in[2] << 8) | in[3]);
+}
+
+
+static uint32_t load_le32(const unsigned char *in)
+{
+    uint32_t value;
+
+    // Every target with the vectors is little-endian
+    memcpy(&value, in, 4);
+    return value;
+}
+
+
+static const uint32_t md5K[64] =
+{
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint32_t sha256K[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+// The rotations are written out so that they compile to single
+// instructions where there are some
+#define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+#define MD5_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define MD5_G(x, y, z) ((y) ^ ((z) & ((x) ^ (y))))
+#define MD5_H(x, y, z) ((x) ^ (y) ^ (z))
+#define MD5_I(x, y, z) ((y) ^ ((x) | ~(z)))
+
+#define MD5_STEP(f, a, b, c, d, m, k, s)                                \
+    do {                                                                \
+        (a) += f(b, c, d) + (m) + (k);                                  \
+        (a) = ROTL(a, s) + (b);                                         \
+    } while (0)
+
+#define SHA256_CH(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define SHA256_MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define SHA256_SUM0(x) (ROTR(x, 2) ^ ROTR(x, 13) ^ ROTR(x, 22))
+#define SHA256_SUM1(x) (ROTR(x, 6) ^ ROTR(x, 11) ^ ROTR(x, 25))
+#define SHA256_SIGMA0(x) (ROTR(x, 7) ^ ROTR(x, 18) ^ ((x) >> 3))
+#define SHA256_SIGMA1(x) (ROTR(x, 17) ^ ROTR(x, 19) ^ ((x) >> 10))
+
+// A round, from the 16th on extending the message schedule, which is kept
+// to its last 16 words; the caller renames the working variables
+#define SHA256_ROUND(a, b, c, d, e, f, g, h, i)                         \
+    do {                                                                \
+        if ((i) >= 16) {                                                \
+            w[(i) & 15] += SHA256_SIGMA1(w[((i) - 2) & 15]) +           \
+                w[((i) - 7) & 15] + SHA256_SIGMA0(w[((i) - 15) & 15]);  \
+        }                                                               \
+        t1 = (h) + SHA256_SUM1(e) + SHA256_CH(e, f, g) + sha256K[i] +   \
+            w[(i) & 15];                                                \
+        (d) += t1;                                                      \
+        (h) = t1 + SHA256_SUM0(a) + SHA256_MAJ(a, b, c);                \
+    } while (0)
+
+#define MULTIHASH_LANES 8
+#define MULTIHASH_TARGET "avx2"
+#define MULTIHASH_NAME(name) name##_avx2
+#include "multihash_kernels.h"
+#undef MULTIHASH_LANES
+#undef MULTIHASH_TARGET
+#undef MULTIHASH_NAME
+
+#define MULTIHASH_LANES 16
+#define MULTIHASH_TARGET "avx512f"
+#define MULTIHASH_NAME(name) name##_avx512
+#include "multihash_kernels.h"
+#undef MULTIHASH_LANES
+#undef MULTIHASH_TARGET
+#undef MULTIHASH_NAME
+
+
+// Returns the lanes of the widest vectors the CPU has (1 if it has none
+// which are used)
+static int cpu_lanes()
+{
+    static int lanesG = 0;
+
+    if (!lanesG) {
+        __builtin_cpu_init();
+        lanesG = __builtin_cpu_supports("avx512f") ? 16 :
+            __builtin_cpu_supports("avx2") ? 8 : 1;
+    }
+
+    return lanesG;
+}
+
+
+// Returns nonzero if the CPU has the SHA extensions, which OpenSSL uses
+static int cpu_has_sha()
+{
+    static int hasShaG = -1;
+
+    if (hasShaG < 0) {
+        unsigned int eax, ebx, ecx, edx;
+        hasShaG = __get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) &&
+            (ebx & bit_SHA);
+    }
+
+    return hasShaG;
+}
+
+
+// Sets up the lane to hash the buffer, and its state to the initial state
+static void lane_start(const Algorithm *algorithm, Lane *lane, int lanes,
+                       uint32_t *state, int laneIndex, int index,
+                       const unsigned char *data, uint64_t len)
+{
+    int i;
+
+    lane->index = index;
+    lane->data = data;
+    lane->blocks = len / 64;
+
+    // The last part block, then 0x80, zeros, and the length in bits in the
+    // last 8 bytes
+    int rest = len % 64;
+    memcpy(lane->tail, &(data[len - rest]), rest);
+    lane->tail[rest] = 0x80;
+    lane->tailBlocks = ((rest + 9) <= 64) ? 1 : 2;
+    int end = lane->tailBlocks * 64;
+    memset(&(lane->tail[rest + 1]), 0, end - 8 - (rest + 1));
+    uint64_t bits = (algorithm->prefixLen + len) * 8;
+    for (i = 0; i < 8; i++) {
+        lane->tail[algorithm->bigEndian ? (end - 1 - i) : (end - 8 + i)] =
+            (unsigned char) (bits >> (8 * i));
+    }
+    lane->tailBlock = 0;
+
+    for (i = 0; i < algorithm->stateWords; i++) {
+        state[(i * lanes) + laneIndex] = algorithm->initialState[i];
+    }
+}
+
+
+// Hashes the buffers, each lane taking the next buffer as it finishes its
+// last, until every buffer is hashed
+static void hash_lanes(const Algorithm *algorithm, int lanes, int count,
+                       const unsigned char *const *data, const uint64_t *lens,
+                       unsigned char *digests, int digestSize)
+{
+    static const unsigned char idleBlock[64];
+    uint32_t state[8 * MULTIHASH_MAX_LANES];
+    const unsigned char *blocks[MULTIHASH_MAX_LANES];
+    Lane laneStates[MULTIHASH_MAX_LANES];
+    int next = 0, busy = 0, i, j;
+
+    for (i = 0; i < lanes; i++) {
+        laneStates[i].index = -1;
+        blocks[i] = idleBlock;
+    }
+
+    while (1) {
+        for (i = 0; (i < lanes) && (next < count); i++) {
+            if (laneStates[i].index < 0) {
+                lane_start(algorithm, &(laneStates[i]), lanes, state, i, next,
+                           data[next], lens[next]);
+                next++, busy++;
+            }
+        }
+        if (!busy) {
+            return;
+        }
+
+        for (i = 0; i < lanes; i++) {
+            Lane *lane = &(laneStates[i]);
+            if (lane->index < 0) {
+                blocks[i] = idleBlock;
+            }
+            else if (lane->blocks) {
+                blocks[i] = lane->data;
+            }
+            else {
+                blocks[i] = &(lane->tail[64 * lane->tailBlock]);
+            }
+        }
+
+        (*(algorithm->blocks))(state, blocks);
+
+        for (i = 0; i < lanes; i++) {
+            Lane *lane = &(laneStates[i]);
+            if (lane->index < 0) {
+                continue;
+            }
+            if (lane->blocks) {
+                lane->data += 64;
+                lane->blocks--;
+            }
+            else if (++(lane->tailBlock) == lane->tailBlocks) {
+                unsigned char *digest = &(digests[lane->index * digestSize]);
+                for (j = 0; j < algorithm->digestWords; j++) {
+                    uint32_t word = state[(j * lanes) + i];
+                    if (algorithm->bigEndian) {
+                        store_be32(&(digest[4 * j]), word);
+                    }
+                    else {
+                        store_le32(&(digest[4 * j]), word);
+                    }
+                }
+                lane->index = -1;
+                busy--;
+            }
+        }
+    }
+}
+
+
+// Returns the lanes to hash count buffers with: those set, as far as the CPU
+// has them, or else the widest vectors there are, unless the narrower ones
+// would be as full
+static int lanes_for(int count)
+{
+    int lanes = cpu_lanes();
+
+    if (setLanesG) {
+        return ((setLanesG >= 16) && (lanes >= 16)) ? 16 :
+            ((setLanesG >= 8) && (lanes >= 8)) ? 8 : 1;
+    }
+
+    return ((lanes == 16) && (count <= 8)) ? 8 : lanes;
+}
+
+#endif /* MULTIHASH_VECTORS */
+
+
+void multihash_md5(int count, const unsigned char *const *data,
+                   const uint64_t *lens,
+                   unsigned char (*digests)[MULTIHASH_MD5_SIZE])
+{
+    int i;
+
+#ifdef MULTIHASH_VECTORS
+    // Vector lanes outrun the one-at-a-time MD5 even when only two of them
+    // are busy
+    int lanes = lanes_for(count);
+    if (!setLanesG && (count < 2)) {
+        lanes = 1;
+    }
+    if (lanes > 1) {
+        Algorithm algorithm =
+            { 4, md5InitialState, 4, 0, 0,
+              (lanes == 16) ? &md5_blocks_avx512 : &md5_blocks_avx2 };
+        hash_lanes(&algorithm, lanes, count, data, lens,
+                   (unsigned char *) digests, MULTIHASH_MD5_SIZE);
+        return;
+    }
+#endif
+
+    for (i = 0; i < count; i++) {
+#ifdef __APPLE__
+        CC_MD5(data[i], (CC_LONG) lens[i], digests[i]);
+#else
+        EVP_Digest(data[i], lens[i], digests[i], NULL, EVP_md5(), NULL);
+#endif
+    }
+}
+
+
+// Computes the SHA-256 of each buffer, after the 64 byte prefix if there is
+// one
+static void sha256_prefixed(const unsigned char *prefix, int count,
+                            const unsigned char *const *data,
+                            const uint64_t *lens,
+                            unsigned char (*digests)[MULTIHASH_SHA256_SIZE])
+{
+    int i;
+
+#ifdef MULTIHASH_VECTORS
+    // Against the SHA extensions, only the widest vector lanes pay, and only
+    // when most of them are busy
+    int lanes = lanes_for(count);
+    if (!setLanesG && ((count < 2) ||
+                       (cpu_has_sha() &&
+                        ((lanes < 16) ||
+                         (count < SHA256_SHA_EXTENSIONS_MIN_COUNT))))) {
+        lanes = 1;
+    }
+    if (lanes > 1) {
+        Algorithm algorithm =
+            { 8, sha256InitialState, 8, 0, 1,
+              (lanes == 16) ? &sha256_blocks_avx512 : &sha256_blocks_avx2 };
+        // The prefix is hashed once, in every lane, for the state each
+        // buffer starts from
+        uint32_t prefixState[8 * MULTIHASH_MAX_LANES];
+        if (prefix) {
+            const unsigned char *blocks[MULTIHASH_MAX_LANES];
+            for (i = 0; i < lanes; i++) {
+                blocks[i] = prefix;
+            }
+            for (i = 0; i < (8 * lanes); i++) {
+                prefixState[i] = sha256InitialState[i / lanes];
+            }
+            (*(algorithm.blocks))(prefixState, blocks);
+            for (i = 0; i < 8; i++) {
+                prefixState[i] = prefixState[i * lanes];
+            }
+            algorithm.initialState = prefixState;
+            algorithm.prefixLen = 64;
+        }
+        hash_lanes(&algorithm, lanes, count, data, lens,
+                   (unsigned char *) digests, MULTIHASH_SHA256_SIZE);
+        return;
+    }
+#endif
+
+    if (!prefix) {
+        for (i = 0; i < count; i++) {
+#ifdef __APPLE__
+            CC_SHA256(data[i], (CC_LONG) lens[i], digests[i]);
+#else
+            SHA256(data[i], lens[i], digests[i]);
+#endif
+        }
+        return;
+    }
+
+#ifdef __APPLE__
+    for (i = 0; i < count; i++) {
+        CC_SHA256_CTX context;
+        CC_SHA256_Init(&context);
+        CC_SHA256_Update(&context, prefix, 64);
+        CC_SHA256_Update(&context, data[i], (CC_LONG) lens[i]);
+        CC_SHA256_Final(digests[i], &context);
+    }
+#else
+    EVP_MD_CTX *context = EVP_MD_CTX_new();
+    for (i = 0; i < count; i++) {
+        EVP_DigestInit_ex(context, EVP_sha256(), NULL);
+        EVP_DigestUpdate(context, prefix, 64);
+        EVP_DigestUpdate(context, data[i], lens[i]);
+        EVP_DigestFinal_ex(context, digests[i], NULL);
+    }
+    EVP_MD_CTX_free(context);
+#endif
+}
+
+
+void multihash_sha256(int count, const unsigned char *const *data,
+                      const uint64_t *lens,
+                      unsigned char (*digests)[MULTIHASH_SHA256_SIZE])
+{
+    sha256_prefixed(0, count, data, lens, digests);
+}
+
+
+void multihash_sha256_prefixed
+    (const unsigned char *prefix, int count, const unsigned char *const *data,
+     const uint64_t *lens, unsigned char (*digests)[MULTIHASH_SHA256_SIZE])
+{
+    sha256_prefixed(prefix, count, data, lens, digests);
+}
+
+
+int multihash_set_lanes(int lanes)
+{
+    setLanesG = lanes;
+
+#ifdef MULTIHASH_VECTORS
+    return cpu_lanes();
+#else
+    return 1;
+#endif
+}
+
+
+// The buffers hashed by each call of multihash_xxx from S3_compute_xxx
+#define COMPUTE_BATCH_SIZE 64
+
+void S3_compute_content_md5s(int count, const char *const *buffers,
+                             const uint64_t *sizes,
+                             char (*md5s)[S3_CONTENT_MD5_SIZE])
+{
+    unsigned char digests[COMPUTE_BATCH_SIZE][MULTIHASH_MD5_SIZE];
+    int i, j;
+
+    for (i = 0; i < count; i += COMPUTE_BATCH_SIZE) {
+        int batch = ((count - i) < COMPUTE_BATCH_SIZE) ?
+            (count - i) : COMPUTE_BATCH_SIZE;
+        multihash_md5(batch, (const unsigned char *const *) &(buffers[i]),
+                      &(sizes[i]), digests);
+        for (j = 0; j < batch; j++) {
+            base64_encode(digests[j], MULTIHASH_MD5_SIZE, md5s[i + j]);
+        }
+    }
+}
+
+
+void S3_compute_sha256s(int count, const char *const *buffers,
+                        const uint64_t *sizes,
+                        char (*sha256s)[S3_SHA256_HEX_SIZE])
+{
+    unsigned char digests[COMPUTE_BATCH_SIZE][MULTIHASH_SHA256_SIZE];
+    int i, j;
+
+    for (i = 0; i < count; i += COMPUTE_BATCH_SIZE) {
+        int batch = ((count - i) < COMPUTE_BATCH_SIZE) ?
+            (count - i) : COMPUTE_BATCH_SIZE;
+        multihash_sha256(batch, (const unsigned char *const *) &(buffers[i]),
+                         &(sizes[i]), digests);
+        for (j = 0; j < batch; j++) {
+            hex_encode(digests[j], MULTIHASH_SHA256_SIZE, sha256s[i + j]);
+        }
+    }
+}
@@ -135,7 +135,8 @@ void S3_initiate_multipart(S3BucketContext *bucketContext, const char *key,
         InitialMultipartCallback,                     // fromS3Callback
         InitialMultipartCompleteCallback,             // completeCallback
         mdata,                                        // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -177,7 +178,8 @@ void S3_abort_multipart_upload(S3BucketContext *bucketContext, const char *key,
         0,                                            // fromS3Callback
         AbortMultipartUploadCompleteCallback,         // completeCallback
         0,                                            // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -226,7 +228,8 @@ void S3_upload_part(S3BucketContext *bucketContext, const char *key,
         0,                                            // fromS3Callback
         handler->responseHandler.completeCallback,    // completeCallback
         callbackData,                                 // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        1                                             // toS3CallbackRewindable
     };
 
     request_perform(&params, requestContext);
@@ -366,7 +369,8 @@ void S3_complete_multipart_upload(S3BucketContext *bucketContext,
         commitMultipartCallback,                      // fromS3Callback
         commitMultipartCompleteCallback,              // completeCallback
         data,                                         // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     request_perform(&params, requestContext);
@@ -961,7 +965,8 @@ void S3_list_multipart_uploads(S3BucketContext *bucketContext,
             &listMultipartDataCallback,              // fromS3Callback
             &listMultipartCompleteCallback,          // completeCallback
             lmData,                                  // callbackData
-            timeoutMs                                // timeoutMs
+            timeoutMs,                               // timeoutMs
+            0                                        // toS3CallbackRewindable
         };
 
         // Perform the request
@@ -1085,7 +1090,8 @@ void S3_list_parts(S3BucketContext *bucketContext, const char *key,
             &listPartsDataCallback,                  // fromS3Callback
             &listPartsCompleteCallback,              // completeCallback
             lpData,                                  // callbackData
-            timeoutMs                                // timeoutMs
+            timeoutMs,                               // timeoutMs
+            0                                        // toS3CallbackRewindable
         };
 
         // Perform the request
@@ -66,7 +66,8 @@ void S3_put_object(const S3BucketContext *bucketContext, const char *key,
         0,                                            // fromS3Callback
         handler->responseHandler.completeCallback,    // completeCallback
         callbackData,                                 // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        1                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -261,7 +262,8 @@ void S3_copy_object_range(const S3BucketContext *bucketContext, const char *key,
         &copyObjectDataCallback,                      // fromS3Callback
         &copyObjectCompleteCallback,                  // completeCallback
         data,                                         // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -305,7 +307,8 @@ void S3_get_object(const S3BucketContext *bucketContext, const char *key,
         handler->getObjectDataCallback,               // fromS3Callback
         handler->responseHandler.completeCallback,    // completeCallback
         callbackData,                                 // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -347,7 +350,8 @@ void S3_head_object(const S3BucketContext *bucketContext, const char *key,
         0,                                            // fromS3Callback
         handler->completeCallback,                    // completeCallback
         callbackData,                                 // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -389,7 +393,8 @@ void S3_delete_object(const S3BucketContext *bucketContext, const char *key,
         0,                                            // fromS3Callback
         handler->completeCallback,                    // completeCallback
         callbackData,                                 // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
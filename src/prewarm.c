@@ -0,0 +1,262 @@
+/** **************************************************************************
+ * prewarm.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "libs3.h"
+#include "request.h"
+#include "request_queue.h"
+
+
+// Collects the outcome of the requests made by a synchronous prewarm
+typedef struct PrewarmData
+{
+    S3Status status;
+} PrewarmData;
+
+
+static void prewarmCompleteCallback(S3Status status,
+                                    const S3ErrorDetails *error,
+                                    void *callbackData)
+{
+    PrewarmData *data = (PrewarmData *) callbackData;
+
+    (void) error;
+
+    if (!data) {
+        return;
+    }
+
+    // Any HTTP response at all means that the connection was made; only
+    // failures to get one matter
+    switch (status) {
+    case S3StatusInternalError:
+    case S3StatusOutOfMemory:
+    case S3StatusInterrupted:
+    case S3StatusFailedToInitializeRequest:
+    case S3StatusNameLookupError:
+    case S3StatusFailedToConnect:
+    case S3StatusServerFailedVerification:
+    case S3StatusConnectionFailed:
+        data->status = status;
+        break;
+    default:
+        break;
+    }
+}
+
+
+// Adds count HEAD requests on the bucket to the context; while all of them
+// are in flight at once, each needs a connection of its own
+static void add_prewarm_requests(S3RequestContext *requestContext,
+                                 const S3BucketContext *bucketContext,
+                                 int count, PrewarmData *data)
+{
+    RequestParams params =
+    {
+        HttpRequestTypeHEAD,                          // httpRequestType
+        { bucketContext->hostName,                    // hostName
+          bucketContext->bucketName,                  // bucketName
+          bucketContext->protocol,                    // protocol
+          bucketContext->uriStyle,                    // uriStyle
+          bucketContext->accessKeyId,                 // accessKeyId
+          bucketContext->secretAccessKey,             // secretAccessKey
+          bucketContext->securityToken,               // securityToken
+          bucketContext->authRegion },                // authRegion
+        0,                                            // key
+        0,                                            // queryParams
+        0,                                            // subResource
+        0,                                            // copySourceBucketName
+        0,                                            // copySourceKey
+        0,                                            // getConditions
+        0,                                            // startByte
+        0,                                            // byteCount
+        0,                                            // putProperties
+        0,                                            // propertiesCallback
+        0,                                            // toS3Callback
+        0,                                            // toS3CallbackTotalSize
+        0,                                            // fromS3Callback
+        &prewarmCompleteCallback,                     // completeCallback
+        data,                                         // callbackData
+        0,                                            // timeoutMs
+        0                                             // toS3CallbackRewindable
+    };
+
+    int i;
+    for (i = 0; i < count; i++) {
+        request_perform(&params, requestContext);
+    }
+}
+
+
+S3Status S3_prewarm_connections(S3RequestContext *requestContext,
+                                const S3BucketContext *bucketContext,
+                                int count)
+{
+    if (requestContext) {
+        add_prewarm_requests(requestContext, bucketContext, count, 0);
+        return S3StatusOK;
+    }
+
+    // Connections made by a temporary context only outlive it if they are
+    // kept in the shared connection cache
+    if (!request_shares_caches()) {
+        return S3StatusNotSupported;
+    }
+
+    S3RequestContext *context;
+    S3Status status = S3_create_request_context(&context);
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    PrewarmData data;
+    data.status = S3StatusOK;
+
+    add_prewarm_requests(context, bucketContext, count, &data);
+
+    status = S3_runall_request_context(context);
+
+    S3_destroy_request_context(context);
+
+    return (status == S3StatusOK) ? data.status : status;
+}
+
+
+struct S3KeepWarm
+{
+    // Holds a copy of the bucket context given to S3_start_keep_warm
+    QueuedRequest *params;
+
+    int count;
+
+    int intervalMs;
+
+    int stop;
+
+    pthread_mutex_t mutex;
+
+    pthread_cond_t cond;
+
+    pthread_t thread;
+};
+
+
+static void *keep_warm_thread(void *arg)
+{
+    S3KeepWarm *keepWarm = (S3KeepWarm *) arg;
+
+    pthread_mutex_lock(&(keepWarm->mutex));
+
+    while (!keepWarm->stop) {
+        pthread_mutex_unlock(&(keepWarm->mutex));
+
+        // Re-using the idle connections resets the server's idle timer on
+        // them, and any which the server has closed anyway are replaced
+        S3_prewarm_connections(0, &(keepWarm->params->params.bucketContext),
+                               keepWarm->count);
+
+        struct timeval now;
+        gettimeofday(&now, 0);
+        int64_t wakeUs = (((int64_t) now.tv_sec) * 1000000 + now.tv_usec +
+                          ((int64_t) keepWarm->intervalMs) * 1000);
+        struct timespec wake = { wakeUs / 1000000, (wakeUs % 1000000) * 1000 };
+
+        pthread_mutex_lock(&(keepWarm->mutex));
+        while (!keepWarm->stop) {
+            if (pthread_cond_timedwait(&(keepWarm->cond), &(keepWarm->mutex),
+                                       &wake) == ETIMEDOUT) {
+                break;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&(keepWarm->mutex));
+
+    return 0;
+}
+
+
+S3Status S3_start_keep_warm(const S3BucketContext *bucketContext, int count,
+                            int intervalMs, S3KeepWarm **keepWarmReturn)
+{
+    if (!request_shares_caches()) {
+        return S3StatusNotSupported;
+    }
+
+    S3KeepWarm *keepWarm = (S3KeepWarm *) malloc(sizeof(S3KeepWarm));
+    if (!keepWarm) {
+        return S3StatusOutOfMemory;
+    }
+
+    // Only the bucket context matters; a RequestParams is just a convenient
+    // way to get a self-contained copy of it
+    RequestParams params;
+    memset(&params, 0, sizeof(params));
+    params.bucketContext = *bucketContext;
+    if (!(keepWarm->params = queued_request_create(&params))) {
+        free(keepWarm);
+        return S3StatusOutOfMemory;
+    }
+
+    keepWarm->count = count;
+    keepWarm->intervalMs = (intervalMs > 0) ? intervalMs : 1;
+    keepWarm->stop = 0;
+    pthread_mutex_init(&(keepWarm->mutex), 0);
+    pthread_cond_init(&(keepWarm->cond), 0);
+
+    if (pthread_create(&(keepWarm->thread), 0, &keep_warm_thread, keepWarm)) {
+        pthread_cond_destroy(&(keepWarm->cond));
+        pthread_mutex_destroy(&(keepWarm->mutex));
+        free(keepWarm->params);
+        free(keepWarm);
+        return S3StatusInternalError;
+    }
+
+    *keepWarmReturn = keepWarm;
+
+    return S3StatusOK;
+}
+
+
+void S3_stop_keep_warm(S3KeepWarm *keepWarm)
+{
+    pthread_mutex_lock(&(keepWarm->mutex));
+    keepWarm->stop = 1;
+    pthread_cond_signal(&(keepWarm->cond));
+    pthread_mutex_unlock(&(keepWarm->mutex));
+
+    pthread_join(keepWarm->thread, 0);
+
+    pthread_cond_destroy(&(keepWarm->cond));
+    pthread_mutex_destroy(&(keepWarm->mutex));
+    free(keepWarm->params);
+    free(keepWarm);
+}
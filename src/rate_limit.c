@@ -0,0 +1,206 @@
+/** **************************************************************************
+ * rate_limit.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "rate_limit.h"
+#include "request_context.h"
+#include "util.h"
+
+// Beyond this many groups, those not in use are forgotten
+#define RATE_LIMIT_MAX_GROUPS 256
+
+// A limited group is forgotten once it has been idle this long
+#define RATE_LIMIT_IDLE_MS 60000
+
+
+static uint64_t hash_bytes(uint64_t hash, const char *bytes, size_t len)
+{
+    // FNV-1a
+    while (len--) {
+        hash ^= (unsigned char) *bytes++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+
+// Forgets the groups which are not in use and have nothing worth keeping
+static void forget_idle(S3RequestContext *context, int64_t now)
+{
+    RateLimit **link = &(context->rateLimits);
+
+    while (*link) {
+        RateLimit *limit = *link;
+        if (!limit->inFlight && (limit->nextStartMs <= now) &&
+            ((now - limit->usedMs) >
+             (limit->rate ? RATE_LIMIT_IDLE_MS : 1000))) {
+            *link = limit->next;
+            context->rateLimitCount--;
+            free(limit);
+        }
+        else {
+            link = &(limit->next);
+        }
+    }
+}
+
+
+RateLimit *rate_limit_get(S3RequestContext *context,
+                          const RequestParams *params)
+{
+    if (!context || !context->rateLimiting) {
+        return 0;
+    }
+
+    const char *bucketName = params->bucketContext.bucketName ?
+        params->bucketContext.bucketName : "";
+    const char *key = params->key ? params->key : "";
+    const char *slash = strrchr(key, '/');
+    size_t bucketLen = strlen(bucketName);
+    size_t prefixLen = slash ? (size_t) (slash - key) + 1 : 0;
+
+    uint64_t hash = hash_bytes(0xcbf29ce484222325ULL, bucketName,
+                               bucketLen + 1);
+    hash = hash_bytes(hash, key, prefixLen);
+
+    int64_t now = monotonic_ms();
+
+    RateLimit **link = &(context->rateLimits), *limit;
+    while ((limit = *link)) {
+        if ((limit->hash == hash) && !strcmp(limit->bucketName, bucketName) &&
+            !strncmp(limit->prefix, key, prefixLen) &&
+            !limit->prefix[prefixLen]) {
+            // Busy groups stay near the front
+            *link = limit->next;
+            limit->next = context->rateLimits;
+            context->rateLimits = limit;
+            limit->usedMs = now;
+            return limit;
+        }
+        link = &(limit->next);
+    }
+
+    if (context->rateLimitCount >= RATE_LIMIT_MAX_GROUPS) {
+        forget_idle(context, now);
+    }
+
+    if (!(limit = (RateLimit *) malloc(sizeof(RateLimit) + bucketLen +
+                                       prefixLen + 2))) {
+        return 0;
+    }
+
+    char *strings = (char *) &(limit[1]);
+    memcpy(strings, bucketName, bucketLen + 1);
+    memcpy(&(strings[bucketLen + 1]), key, prefixLen);
+    strings[bucketLen + 1 + prefixLen] = 0;
+
+    limit->hash = hash;
+    limit->bucketName = strings;
+    limit->prefix = &(strings[bucketLen + 1]);
+    limit->rate = 0;
+    limit->nextStartMs = 0;
+    limit->windowStartMs = now;
+    limit->windowCount = 0;
+    limit->measuredRate = 0;
+    limit->decreasedMs = 0;
+    limit->usedMs = now;
+    limit->inFlight = 0;
+
+    limit->next = context->rateLimits;
+    context->rateLimits = limit;
+    context->rateLimitCount++;
+
+    return limit;
+}
+
+
+int64_t rate_limit_schedule(RateLimit *limit, int64_t earliestMs)
+{
+    int64_t now = monotonic_ms();
+
+    if ((now - limit->windowStartMs) >= 1000) {
+        limit->measuredRate =
+            (limit->windowCount * 1000.0) / (now - limit->windowStartMs);
+        limit->windowStartMs = now;
+        limit->windowCount = 0;
+    }
+    limit->windowCount++;
+
+    if (!limit->rate) {
+        return earliestMs;
+    }
+
+    int64_t startMs = (limit->nextStartMs > earliestMs) ?
+        limit->nextStartMs : earliestMs;
+    limit->nextStartMs = startMs + (int64_t) (1000.0 / limit->rate);
+
+    return startMs;
+}
+
+
+void rate_limit_update(S3RequestContext *context, RateLimit *limit,
+                       S3Status status)
+{
+    if (!context->rateLimiting) {
+        return;
+    }
+
+    if (status == S3StatusErrorSlowDown) {
+        int64_t now = monotonic_ms();
+        if (limit->rate && ((now - limit->decreasedMs) < 1000)) {
+            return;
+        }
+        // The first time, start from the rate that brought this on; the
+        // window so far counts for at least its requests
+        double rate = limit->rate;
+        if (!rate) {
+            rate = (limit->measuredRate > limit->windowCount) ?
+                limit->measuredRate : limit->windowCount;
+        }
+        rate /= 2;
+        limit->rate = (rate > context->rateLimitMin) ?
+            rate : context->rateLimitMin;
+        limit->decreasedMs = now;
+    }
+    else if ((status == S3StatusOK) && limit->rate) {
+        // One more request per second for each second's worth of successes
+        limit->rate += 1 / limit->rate;
+    }
+}
+
+
+void rate_limits_destroy(S3RequestContext *context)
+{
+    while (context->rateLimits) {
+        RateLimit *limit = context->rateLimits;
+        context->rateLimits = limit->next;
+        free(limit);
+    }
+    context->rateLimitCount = 0;
+}
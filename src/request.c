@@ -30,8 +30,16 @@
 #include <string.h>
 #include <sys/utsname.h>
 #include <libxml/parser.h>
+#include "bandwidth.h"
+#include "chunk_signer.h"
+#include "endpoint.h"
+#include "multihash.h"
+#include "rate_limit.h"
 #include "request.h"
 #include "request_context.h"
+#include "request_pool.h"
+#include "request_queue.h"
+#include "request_worker.h"
 #include "response_headers_handler.h"
 
 #ifdef __APPLE__
@@ -44,92 +52,175 @@
 #endif
 
 #define USER_AGENT_SIZE 256
-#define REQUEST_STACK_SIZE 32
 #define SIGNATURE_SCOPE_SIZE 64
 
+// The number of signing keys each thread keeps (see signing_key)
+#define SIGNING_KEY_CACHE_SIZE 4
+
 //#define SIGNATURE_DEBUG
 
 static int verifyPeer;
 
+// Nonzero if S3_INIT_SIGN_PAYLOADS was given
+static int signPayloadsG;
+
 static char userAgentG[USER_AGENT_SIZE];
 
-static pthread_mutex_t requestStackMutexG;
+// If S3_INIT_SHARE_CACHES was given, the share through which all curl handles
+// share their DNS, SSL session and connection caches, else 0
+static CURLSH *curlShareG;
+
+// One lock for each kind of data shared through curlShareG
+static pthread_mutex_t curlShareMutexesG[CURL_LOCK_DATA_LAST];
+
+// The handle most recently given to a request on a context
+static volatile S3RequestHandle nextRequestHandleG;
 
-static Request *requestStackG[REQUEST_STACK_SIZE];
+// The handle of the request most recently made by each thread, for
+// S3_get_last_request_handle
+static __thread S3RequestHandle lastRequestHandleG;
 
-static int requestStackCountG;
+// The time for which each thread last formatted a request date, and the date
+// formatted, which serves every request made within the same second
+static __thread time_t requestDateTimeG;
+static __thread char requestDateG[17];
+
+// A SigV4 signing key, derived from a secret access key for one date and
+// region.  The secret itself is not kept, only its length and a hash of it;
+// the empty region marks an entry not yet used.
+typedef struct SigningKey
+{
+    size_t secretLen;
+    uint64_t secretHash;
+    char date[8];
+    char region[64];
+    unsigned char key[S3_SHA256_DIGEST_LENGTH];
+} SigningKey;
+
+// The signing keys each thread has derived most recently, and the entry the
+// next one replaces
+static __thread SigningKey signingKeysG[SIGNING_KEY_CACHE_SIZE];
+static __thread int nextSigningKeyG;
+
+// Bumped by each S3_deinitialize, so that the signing keys which threads
+// derived before it are wiped rather than used; and the value of it when
+// each thread's keys were last wiped
+static volatile int signingKeysGenerationG;
+static __thread int threadSigningKeysGenerationG;
 
 char defaultHostNameG[S3_MAX_HOSTNAME_SIZE];
 
 
+// The storage a RequestArena starts with, which holds the computed values of
+// most requests; a request with a lot of metadata or a long key takes more,
+// in blocks of at least REQUEST_ARENA_BLOCK_SIZE bytes
+#define REQUEST_ARENA_INITIAL_SIZE 2048
+#define REQUEST_ARENA_BLOCK_SIZE 8192
+
+// The most bytes of each standard header, Host included, terminator and all
+#define STANDARD_HEADER_SIZE 128
+
+// The x-amz- headers other than metadata which a request may have: acl,
+// server-side-encryption, date, copy-source, copy-source-range,
+// metadata-directive, security-token, decoded-content-length and
+// content-sha256
+#define MAX_OTHER_AMZ_HEADERS 9
+
+// A block of a RequestArena beyond its initial storage, which the block's
+// storage follows
+typedef struct RequestArenaBlock
+{
+    struct RequestArenaBlock *next;
+} RequestArenaBlock;
+
+// Where the strings computed for a request are kept, for as long as the
+// request is being set up.  Each is allocated after the last, and the last
+// can be shrunk once its length is known, so that the arena holds little
+// more than the strings themselves.
+typedef struct RequestArena
+{
+    // Where the next allocation may start, and the end of the storage it
+    // may be made from
+    char *next, *end;
+
+    // The most recent allocation
+    char *last;
+
+    // The blocks allocated beyond the initial storage, most recent first
+    RequestArenaBlock *blocks;
+
+    // The initial storage, in pointers for their alignment
+    void *initial[REQUEST_ARENA_INITIAL_SIZE / sizeof(void *)];
+} RequestArena;
+
+
 typedef struct RequestComputedValues
 {
     // All x-amz- headers, in normalized form (i.e. NAME: VALUE, no other ws)
-    char *amzHeaders[S3_MAX_METADATA_COUNT + 2]; // + 2 for acl and date
+    char **amzHeaders;
 
     // The number of x-amz- headers
     int amzHeadersCount;
 
-    // Storage for amzHeaders (the +256 is for x-amz-acl and x-amz-date)
-    char amzHeadersRaw[COMPACTED_METADATA_BUFFER_SIZE + 256 + 1];
-
-    // Length of populated data in raw buffer
-    int amzHeadersRawLength;
+    // Total length of the x-amz- headers
+    int amzHeadersLength;
 
     // Canonicalized headers for signature
-    string_multibuffer(canonicalizedSignatureHeaders,
-                       COMPACTED_METADATA_BUFFER_SIZE + 256 + 1);
+    char *canonicalizedSignatureHeaders;
 
     // Delimited list of header names used for signature
-    char signedHeaders[COMPACTED_METADATA_BUFFER_SIZE];
+    char *signedHeaders;
 
     // URL-Encoded key
-    char urlEncodedKey[MAX_URLENCODED_KEY_SIZE + 1];
+    char *urlEncodedKey;
 
     // Canonicalized resource
-    char canonicalURI[MAX_CANONICALIZED_RESOURCE_SIZE + 1];
+    char *canonicalURI;
 
     // Canonical sub-resource & query string
-    char canonicalQueryString[MAX_CANONICALIZED_RESOURCE_SIZE + 1];
+    char *canonicalQueryString;
 
     // Cache-Control header (or empty)
-    char cacheControlHeader[128];
+    const char *cacheControlHeader;
 
     // Content-Type header (or empty)
-    char contentTypeHeader[128];
+    const char *contentTypeHeader;
 
     // Content-MD5 header (or empty)
-    char md5Header[128];
+    const char *md5Header;
 
     // Content-Disposition header (or empty)
-    char contentDispositionHeader[128];
+    const char *contentDispositionHeader;
 
     // Content-Encoding header (or empty)
-    char contentEncodingHeader[128];
+    const char *contentEncodingHeader;
 
     // Expires header (or empty)
-    char expiresHeader[128];
+    const char *expiresHeader;
 
     // If-Modified-Since header
-    char ifModifiedSinceHeader[128];
+    const char *ifModifiedSinceHeader;
 
     // If-Unmodified-Since header
-    char ifUnmodifiedSinceHeader[128];
+    const char *ifUnmodifiedSinceHeader;
 
     // If-Match header
-    char ifMatchHeader[128];
+    const char *ifMatchHeader;
 
     // If-None-Match header
-    char ifNoneMatchHeader[128];
+    const char *ifNoneMatchHeader;
 
     // Range header
-    char rangeHeader[128];
+    const char *rangeHeader;
 
     // Authorization header
-    char authorizationHeader[1024];
+    char *authorizationHeader;
+
+    // Host header
+    const char *hostHeader;
 
     // Request date stamp
-    char requestDateISO8601[64];
+    char requestDateISO8601[17];
 
     // Credential used for authorization signature
     char authCredential[MAX_CREDENTIAL_SIZE + 1];
@@ -137,14 +228,81 @@ typedef struct RequestComputedValues
     // Computed request signature (hex string)
     char requestSignatureHex[S3_SHA256_DIGEST_LENGTH * 2 + 1];
 
-    // Host header
-    char hostHeader[128];
-
     // Hex string of hash of request payload
     char payloadHash[S3_SHA256_DIGEST_LENGTH * 2 + 1];
+
+    // Nonzero if the payload is to be sent signed in aws-chunked encoding,
+    // and if so, the signing key and credential scope to sign its chunks
+    // with
+    int chunkedPayload;
+    unsigned char signingKey[S3_SHA256_DIGEST_LENGTH];
+    char signatureScope[SIGNATURE_SCOPE_SIZE + 1];
+
+    // Where the strings above which are not kept here are kept
+    RequestArena arena;
 } RequestComputedValues;
 
 
+static void arena_initialize(RequestArena *arena)
+{
+    arena->next = (char *) arena->initial;
+    arena->end = (char *) &(arena->initial[sizeof(arena->initial) /
+                                           sizeof(arena->initial[0])]);
+    arena->last = 0;
+    arena->blocks = 0;
+}
+
+
+// Returns size bytes of the arena, aligned for pointers, or 0 if there is no
+// memory for them
+static void *arena_alloc(RequestArena *arena, size_t size)
+{
+    uintptr_t align = sizeof(void *);
+    char *start = (char *) (((uintptr_t) arena->next + align - 1) &
+                            ~(align - 1));
+
+    if ((start > arena->end) || ((size_t) (arena->end - start) < size)) {
+        size_t blockSize = sizeof(RequestArenaBlock) + size;
+        if (blockSize < REQUEST_ARENA_BLOCK_SIZE) {
+            blockSize = REQUEST_ARENA_BLOCK_SIZE;
+        }
+        RequestArenaBlock *block = (RequestArenaBlock *) malloc(blockSize);
+        if (!block) {
+            return 0;
+        }
+        block->next = arena->blocks;
+        arena->blocks = block;
+        start = (char *) &(block[1]);
+        arena->end = &(((char *) block)[blockSize]);
+    }
+
+    arena->last = start;
+    arena->next = &(start[size]);
+
+    return start;
+}
+
+
+// Gives back all but the first used bytes of ptr, if it is the most recent
+// allocation
+static void arena_trim(RequestArena *arena, void *ptr, size_t used)
+{
+    if (ptr == arena->last) {
+        arena->next = &(((char *) ptr)[used]);
+    }
+}
+
+
+static void arena_deinitialize(RequestArena *arena)
+{
+    while (arena->blocks) {
+        RequestArenaBlock *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+}
+
+
 // Called whenever we detect that the request headers have been completely
 // processed; which happens either when we get our first read/write callback,
 // or the request is finished being processed.  Returns nonzero on success,
@@ -173,9 +331,22 @@ static void request_headers_done(Request *request)
     response_headers_handler_done(&(request->responseHeadersHandler),
                                   request->curl);
 
+    // A resumed GET has already given its properties, and must carry on from
+    // exactly where the last attempt stopped: a whole object is only right if
+    // that was the start of it
+    if (request->resumes) {
+        if ((request->httpResponseCode == 200) && request->resumeFrom) {
+            request->status = S3StatusInternalError;
+        }
+        return;
+    }
+
     // Only make the callback if it was a successful request; otherwise we're
-    // returning information about the error response itself
-    if (request->propertiesCallback &&
+    // returning information about the error response itself.  A request which
+    // has already failed (e.g. was interrupted before it started, in which
+    // case a recycled handle still reports its previous response code) gets
+    // no callback either.
+    if (request->propertiesCallback && (request->status == S3StatusOK) &&
         (request->httpResponseCode >= 200) &&
         (request->httpResponseCode <= 299)) {
         request->status = (*(request->propertiesCallback))
@@ -185,6 +356,107 @@ static void request_headers_done(Request *request)
 }
 
 
+// Takes a request off its context's list of hedge candidates
+static void hedge_candidate_remove(Request *request)
+{
+    S3RequestContext *context = request->context;
+
+    if (request->hedgePrev) {
+        request->hedgePrev->hedgeNext = request->hedgeNext;
+    }
+    else {
+        context->hedgeCandidatesHead = request->hedgeNext;
+    }
+    if (request->hedgeNext) {
+        request->hedgeNext->hedgePrev = request->hedgePrev;
+    }
+    else {
+        context->hedgeCandidatesTail = request->hedgePrev;
+    }
+    request->hedgePrev = request->hedgeNext = 0;
+
+    free(request->hedgeParams);
+    request->hedgeParams = 0;
+}
+
+
+// Takes a request off its context's list of requests waiting for their first
+// response headers
+static void first_byte_remove(Request *request)
+{
+    S3RequestContext *context = request->context;
+
+    if (request->firstBytePrev) {
+        request->firstBytePrev->firstByteNext = request->firstByteNext;
+    }
+    else {
+        context->firstByteHead = request->firstByteNext;
+    }
+    if (request->firstByteNext) {
+        request->firstByteNext->firstBytePrev = request->firstBytePrev;
+    }
+    else {
+        context->firstByteTail = request->firstBytePrev;
+    }
+    request->firstBytePrev = request->firstByteNext = 0;
+    request->firstByteDueMs = 0;
+}
+
+
+static int compare_ints(const void *a, const void *b)
+{
+    return *((const int *) a) - *((const int *) b);
+}
+
+
+// Called when response headers start to arrive for a request: the first of
+// a hedged pair to get here wins, and the other is marked to be removed
+static void hedge_response_started(Request *request)
+{
+    S3RequestContext *context = request->context;
+
+    request->responseStarted = 1;
+
+    if (request->startMs && context->hedgePercentile) {
+        context->hedgeSamples[context->hedgeSampleCount++ %
+                              HEDGE_SAMPLE_COUNT] =
+            (int) (monotonic_ms() - request->startMs);
+        // Recompute the percentile only every so often
+        if (!(context->hedgeSampleCount % HEDGE_MIN_SAMPLES)) {
+            int sorted[HEDGE_SAMPLE_COUNT];
+            int count = (context->hedgeSampleCount < HEDGE_SAMPLE_COUNT) ?
+                (int) context->hedgeSampleCount : HEDGE_SAMPLE_COUNT;
+            memcpy(sorted, context->hedgeSamples, count * sizeof(int));
+            qsort(sorted, count, sizeof(int), &compare_ints);
+            context->hedgePercentileMs =
+                sorted[(count * context->hedgePercentile) / 100];
+        }
+    }
+
+    // A request with a response has no need of a hedge, and can no longer
+    // time out waiting for one
+    if (request->hedgeParams) {
+        hedge_candidate_remove(request);
+    }
+    if (request->firstByteDueMs) {
+        first_byte_remove(request);
+    }
+
+    Request *loser = request->hedgePartner;
+    if (loser) {
+        loser->hedgePartner = request->hedgePartner = 0;
+        loser->hedgeLost = 1;
+        // It cannot be removed from within a curl callback, so it waits for
+        // request_hedge
+        loser->hedgeNext = context->hedgeLosers;
+        context->hedgeLosers = loser;
+        if (request->isHedge) {
+            context->hedgeStats.hedgeWinCount++;
+        }
+    }
+}
+
+
 static size_t curl_header_func(void *ptr, size_t size, size_t nmemb,
                                void *data)
 {
@@ -192,6 +464,14 @@ static size_t curl_header_func(void *ptr, size_t size, size_t nmemb,
 
     int len = size * nmemb;
 
+    if (request->hedgeLost || request->cancelled) {
+        return len;
+    }
+
+    if (!request->responseStarted && request->context) {
+        hedge_response_started(request);
+    }
+
     response_headers_handler_add
         (&(request->responseHeadersHandler), (char *) ptr, len);
 
@@ -199,6 +479,47 @@ static size_t curl_header_func(void *ptr, size_t size, size_t nmemb,
 }
 
 
+// As curl_read_func, for a payload signed chunk by chunk: fills a chunk from
+// the data callback, signs it, and then sends it, len bytes at a time
+static int read_signed_chunks(Request *request, char *buffer, int len)
+{
+    ChunkSigner *signer = request->chunkSigner;
+    int sent;
+
+    while (!(sent = chunk_signer_output(signer, buffer, len))) {
+        if (chunk_signer_ended(signer)) {
+            return 0;
+        }
+        // Fill the chunk until it is full or the data runs out, then sign it
+        int spaceLen;
+        char *space;
+        while (request->toS3Callback && request->toS3CallbackBytesRemaining &&
+               (space = chunk_signer_space(signer, &spaceLen))) {
+            if (spaceLen > request->toS3CallbackBytesRemaining) {
+                spaceLen = request->toS3CallbackBytesRemaining;
+            }
+            int ret = (*(request->toS3Callback))
+                (spaceLen, space, request->callbackData);
+            if (ret < 0) {
+                request->status = S3StatusAbortedByCallback;
+                return CURL_READFUNC_ABORT;
+            }
+            if (ret > spaceLen) {
+                ret = spaceLen;
+            }
+            chunk_signer_add(signer, ret);
+            // A callback which runs dry ends the payload early, which the
+            // server rejects as short
+            request->toS3CallbackBytesRemaining =
+                ret ? (request->toS3CallbackBytesRemaining - ret) : 0;
+        }
+        chunk_signer_seal(signer);
+    }
+
+    return sent;
+}
+
+
 static size_t curl_read_func(void *ptr, size_t size, size_t nmemb, void *data)
 {
     Request *request = (Request *) data;
@@ -214,6 +535,20 @@ static size_t curl_read_func(void *ptr, size_t size, size_t nmemb, void *data)
         return CURL_READFUNC_ABORT;
     }
 
+    // A payload signed chunk by chunk is sent through its chunk signer
+    if (request->chunkSigner) {
+        if (request->context && request->context->bandwidth &&
+            !(len = bandwidth_allow(request, BANDWIDTH_UPLOAD, len))) {
+            return CURL_READFUNC_PAUSE;
+        }
+        int ret = read_signed_chunks(request, (char *) ptr, len);
+        if ((ret != CURL_READFUNC_ABORT) && request->context &&
+            request->context->bandwidth) {
+            bandwidth_use(request, BANDWIDTH_UPLOAD, ret);
+        }
+        return ret;
+    }
+
     // If there is no data callback, or the data callback has already returned
     // contentLength bytes, return 0;
     if (!request->toS3Callback || !request->toS3CallbackBytesRemaining) {
@@ -226,6 +561,13 @@ static size_t curl_read_func(void *ptr, size_t size, size_t nmemb, void *data)
         len = request->toS3CallbackBytesRemaining;
     }
 
+    // Nor more than the context's bandwidth limits allow; none at all pauses
+    // the transfer until they allow some
+    if (request->context && request->context->bandwidth &&
+        !(len = bandwidth_allow(request, BANDWIDTH_UPLOAD, len))) {
+        return CURL_READFUNC_PAUSE;
+    }
+
     // Otherwise, make the data callback
     int ret = (*(request->toS3Callback))
         (len, (char *) ptr, request->callbackData);
@@ -238,6 +580,9 @@ static size_t curl_read_func(void *ptr, size_t size, size_t nmemb, void *data)
             ret = request->toS3CallbackBytesRemaining;
         }
         request->toS3CallbackBytesRemaining -= ret;
+        if (request->context && request->context->bandwidth) {
+            bandwidth_use(request, BANDWIDTH_UPLOAD, ret);
+        }
         return ret;
     }
 }
@@ -250,6 +595,21 @@ static size_t curl_write_func(void *ptr, size_t size, size_t nmemb,
 
     int len = size * nmemb;
 
+    // Whatever a request which has lost to its hedge, or has been cancelled,
+    // receives is discarded
+    if (request->hedgeLost || request->cancelled) {
+        return len;
+    }
+
+    // The data is taken whole, or not at all until the context's bandwidth
+    // limits allow
+    if (request->context && request->context->bandwidth) {
+        if (!bandwidth_allow(request, BANDWIDTH_DOWNLOAD, len)) {
+            return CURL_WRITEFUNC_PAUSE;
+        }
+        bandwidth_use(request, BANDWIDTH_DOWNLOAD, len);
+    }
+
     request_headers_done(request);
 
     if (request->status != S3StatusOK) {
@@ -266,6 +626,9 @@ static size_t curl_write_func(void *ptr, size_t size, size_t nmemb,
     else if (request->fromS3Callback) {
         request->status = (*(request->fromS3Callback))
             (len, (char *) ptr, request->callbackData);
+        if (request->status == S3StatusOK) {
+            request->bytesReceived += len;
+        }
     }
     // Else, consider this an error - S3 has sent back data when it was not
     // expected
@@ -282,42 +645,45 @@ static S3Status append_amz_header(RequestComputedValues *values,
                                   const char *headerName,
                                   const char *headerValue)
 {
-    int rawPos = values->amzHeadersRawLength + 1;
-    values->amzHeaders[values->amzHeadersCount++] = &(values->amzHeadersRaw[rawPos]);
-
-    const char *headerStr = headerName;
-    if (addPrefix) {
-        char headerNameWithPrefix[S3_MAX_METADATA_SIZE - sizeof(": v")];
-        snprintf(headerNameWithPrefix, sizeof(headerNameWithPrefix),
-                 S3_METADATA_HEADER_NAME_PREFIX "%s", headerName);
-        headerStr = headerNameWithPrefix;
-    }
-
-    // Make sure the new header (plus ": " plus string terminator) will fit
-    // in the buffer.
-    if ((values->amzHeadersRawLength + strlen(headerStr) + strlen(headerValue)
-        + 3) >= sizeof(values->amzHeadersRaw)) {
+    const char *prefix = addPrefix ? S3_METADATA_HEADER_NAME_PREFIX : "";
+    int prefixLen = strlen(prefix), nameLen = strlen(headerName);
+    int valueLen = strlen(headerValue);
+
+    // Make sure the new header (plus ": ") will fit within the limit on all
+    // of them together
+    int len = prefixLen + nameLen + 2 + valueLen;
+    if ((values->amzHeadersLength + len + 1) >=
+        (int) (COMPACTED_METADATA_BUFFER_SIZE + 256 + 1)) {
         return S3StatusMetaDataHeadersTooLong;
     }
 
-    unsigned long i = 0;
-    for (; i < strlen(headerStr); i++) {
-        values->amzHeadersRaw[rawPos++] = tolower(headerStr[i]);
+    char *header = (char *) arena_alloc(&(values->arena), len + 1);
+    if (!header) {
+        return S3StatusOutOfMemory;
     }
 
-    snprintf(&(values->amzHeadersRaw[rawPos]), 3, ": ");
-    rawPos += 2;
-
-    for (i = 0; i < strlen(headerValue); i++) {
-        values->amzHeadersRaw[rawPos++] = headerValue[i];
+    int pos = 0, i;
+    for (i = 0; i < prefixLen; i++) {
+        header[pos++] = tolower(prefix[i]);
+    }
+    for (i = 0; i < nameLen; i++) {
+        header[pos++] = tolower(headerName[i]);
     }
-    rawPos--;
+    header[pos++] = ':';
+    header[pos++] = ' ';
+    memcpy(&(header[pos]), headerValue, valueLen);
+    pos += valueLen;
 
-    while (isblank(values->amzHeadersRaw[rawPos])) {
-        rawPos--;
+    // Trailing blanks are trimmed from the value, but the ": " is kept even
+    // when that leaves the value empty
+    while ((pos > (len - valueLen)) && isblank(header[pos - 1])) {
+        pos--;
     }
-    values->amzHeadersRaw[++rawPos] = '\0';
-    values->amzHeadersRawLength = rawPos;
+    header[pos] = 0;
+    arena_trim(&(values->arena), header, pos + 1);
+
+    values->amzHeaders[values->amzHeadersCount++] = header;
+    values->amzHeadersLength += pos + 1;
     return S3StatusOK;
 }
 
@@ -327,29 +693,63 @@ static S3Status append_amz_header(RequestComputedValues *values,
 // x-amz-meta-${NAME}: ${VALUE}
 // It also adds the x-amz-acl, x-amz-copy-source, x-amz-metadata-directive,
 // and x-amz-server-side-encryption headers if necessary, and always adds the
-// x-amz-date header.  It copies the raw string values into
-// params->amzHeadersRaw, and creates an array of string pointers representing
-// these headers in params->amzHeaders (and also sets params->amzHeadersCount
-// to be the count of the total number of x-amz- headers thus created).
+// x-amz-date header.  It copies the raw string values into the arena, and
+// creates an array of string pointers representing these headers in
+// values->amzHeaders (and also sets values->amzHeadersCount to be the count
+// of the total number of x-amz- headers thus created).  The headers are
+// added in the order of their names, so that unless the metadata is out of
+// order, they are already as canonicalize_signature_headers sorts them.
 static S3Status compose_amz_headers(const RequestParams *params,
                                     int forceUnsignedPayload,
+                                    int signPayload,
                                     RequestComputedValues *values)
 {
     const S3PutProperties *properties = params->putProperties;
+    S3Status status;
+
+#define append_amz_header_safe(addPrefix, headerName, headerValue)      \
+    do {                                                                \
+        if ((status = append_amz_header(values, addPrefix, headerName,  \
+                                        headerValue)) != S3StatusOK) {  \
+            return status;                                              \
+        }                                                               \
+    } while (0)
+
+    int metaDataCount = (properties && (properties->metaDataCount > 0)) ?
+        properties->metaDataCount : 0;
+    if (metaDataCount > (int) S3_MAX_METADATA_COUNT) {
+        return S3StatusMetaDataHeadersTooLong;
+    }
 
     values->amzHeadersCount = 0;
-    values->amzHeadersRaw[0] = '\0';
-    values->amzHeadersRawLength = 0;
+    values->amzHeadersLength = 0;
+    if (!(values->amzHeaders = (char **) arena_alloc
+          (&(values->arena),
+           (metaDataCount + MAX_OTHER_AMZ_HEADERS) * sizeof(char *)))) {
+        return S3StatusOutOfMemory;
+    }
 
-    // Check and copy in the x-amz-meta headers
-    if (properties) {
-        int i;
-        for (i = 0; i < properties->metaDataCount; i++) {
-            const S3NameValue *property = &(properties->metaData[i]);
-            append_amz_header(values, 1, property->name, property->value);
-        }
+    int hasPayload = ((params->httpRequestType == HttpRequestTypePUT) ||
+                      (params->httpRequestType == HttpRequestTypePOST));
+
+    values->chunkedPayload = 0;
+    if (!forceUnsignedPayload &&
+        (!hasPayload || (signPayload && !params->toS3CallbackTotalSize))) {
+        // empty payload
+        strcpy(values->payloadHash, EMPTY_PAYLOAD_HASH);
+    }
+    else if (!forceUnsignedPayload && signPayload) {
+        // The payload is signed chunk by chunk as it is sent (see
+        // chunk_signer.h), so its length is that of the data it carries
+        strcpy(values->payloadHash, "STREAMING-AWS4-HMAC-SHA256-PAYLOAD");
+        values->chunkedPayload = 1;
+    }
+    else {
+        strcpy(values->payloadHash, "UNSIGNED-PAYLOAD");
+    }
 
-        // Add the x-amz-acl header, if necessary
+    // Add the x-amz-acl header, if necessary
+    if (properties) {
         const char *cannedAclString;
         switch (properties->cannedAcl) {
         case S3CannedAclPrivate:
@@ -366,18 +766,11 @@ static S3Status compose_amz_headers(const RequestParams *params,
             break;
         }
         if (cannedAclString) {
-            append_amz_header(values, 0, "x-amz-acl", cannedAclString);
-        }
-
-        // Add the x-amz-server-side-encryption header, if necessary
-        if (properties->useServerSideEncryption) {
-            append_amz_header(values, 0, "x-amz-server-side-encryption",
-                              "AES256");
+            append_amz_header_safe(0, "x-amz-acl", cannedAclString);
         }
     }
 
-    // Add the x-amz-date header
-    append_amz_header(values, 0, "x-amz-date", values->requestDateISO8601);
+    append_amz_header_safe(0, "x-amz-content-sha256", values->payloadHash);
 
     if (params->httpRequestType == HttpRequestTypeCOPY) {
         // Add the x-amz-copy-source header
@@ -386,69 +779,123 @@ static S3Status compose_amz_headers(const RequestParams *params,
             char bucketKey[S3_MAX_METADATA_SIZE];
             snprintf(bucketKey, sizeof(bucketKey), "/%s/%s",
                      params->copySourceBucketName, params->copySourceKey);
-            append_amz_header(values, 0, "x-amz-copy-source", bucketKey);
+            append_amz_header_safe(0, "x-amz-copy-source", bucketKey);
         }
         // If byteCount != 0 then we're just copying a range, add header
         if (params->byteCount > 0) {
             char byteRange[S3_MAX_METADATA_SIZE];
             snprintf(byteRange, sizeof(byteRange), "bytes=%zd-%zd",
                      params->startByte, params->startByte + params->byteCount);
-            append_amz_header(values, 0, "x-amz-copy-source-range", byteRange);
-        }
-        // And the x-amz-metadata-directive header
-        if (properties) {
-            append_amz_header(values, 0, "x-amz-metadata-directive", "REPLACE");
+            append_amz_header_safe(0, "x-amz-copy-source-range", byteRange);
         }
     }
 
+    // Add the x-amz-date header
+    append_amz_header_safe(0, "x-amz-date", values->requestDateISO8601);
+
+    if (values->chunkedPayload) {
+        char length[32];
+        snprintf(length, sizeof(length), "%lld",
+                 (long long) params->toS3CallbackTotalSize);
+        append_amz_header_safe(0, "x-amz-decoded-content-length", length);
+    }
+
+    // Check and copy in the x-amz-meta headers
+    int i;
+    for (i = 0; i < metaDataCount; i++) {
+        const S3NameValue *property = &(properties->metaData[i]);
+        append_amz_header_safe(1, property->name, property->value);
+    }
+
+    // And the x-amz-metadata-directive header of a copy
+    if ((params->httpRequestType == HttpRequestTypeCOPY) && properties) {
+        append_amz_header_safe(0, "x-amz-metadata-directive", "REPLACE");
+    }
+
     // Add the x-amz-security-token header if necessary
     if (params->bucketContext.securityToken) {
-        append_amz_header(values, 0, "x-amz-security-token",
-                          params->bucketContext.securityToken);
+        append_amz_header_safe(0, "x-amz-security-token",
+                               params->bucketContext.securityToken);
     }
 
-    if (!forceUnsignedPayload
-        && (params->httpRequestType == HttpRequestTypeGET
-            || params->httpRequestType == HttpRequestTypeCOPY
-            || params->httpRequestType == HttpRequestTypeDELETE
-            || params->httpRequestType == HttpRequestTypeHEAD)) {
-        // empty payload
-        unsigned char md[S3_SHA256_DIGEST_LENGTH];
-#ifdef __APPLE__
-        CC_SHA256("", 0, md);
-#else
-        SHA256((const unsigned char*) "", 0, md);
-#endif
-        values->payloadHash[0] = '\0';
-        int i = 0;
-        for (; i < S3_SHA256_DIGEST_LENGTH; i++) {
-            snprintf(&(values->payloadHash[i * 2]), 3, "%02x", md[i]);
+    // Add the x-amz-server-side-encryption header, if necessary
+    if (properties && properties->useServerSideEncryption) {
+        append_amz_header_safe(0, "x-amz-server-side-encryption", "AES256");
+    }
+
+    return S3StatusOK;
+
+#undef append_amz_header_safe
+}
+
+
+// Composes the Host header of a bucket context's requests
+static S3Status compose_host_header(const S3BucketContext *bucketContext,
+                                    char *header, size_t headerSize)
+{
+    if (bucketContext->uriStyle == S3UriStyleVirtualHost) {
+        const char *requestHostName = bucketContext->hostName
+                ? bucketContext->hostName : defaultHostNameG;
+
+        size_t len = snprintf(header, headerSize, "Host: %s.%s",
+                              bucketContext->bucketName, requestHostName);
+        if (len >= headerSize) {
+            return S3StatusUriTooLong;
         }
+        while (is_blank(header[len])) {
+            len--;
+        }
+        header[len] = 0;
     }
     else {
-        // TODO: figure out how to manage signed payloads
-        strcpy(values->payloadHash, "UNSIGNED-PAYLOAD");
+        size_t len = snprintf(
+                header,
+                headerSize,
+                "Host: %s",
+                bucketContext->hostName ?
+                    bucketContext->hostName : defaultHostNameG);
+        if (len >= headerSize) {
+            return S3StatusUriTooLong;
+        }
+        while (is_blank(header[len])) {
+            len--;
+        }
+        header[len] = 0;
     }
 
-    append_amz_header(values, 0, "x-amz-content-sha256",
-                      values->payloadHash);
-
     return S3StatusOK;
 }
 
 
+// Allocates a standard header of at most STANDARD_HEADER_SIZE bytes
+static char *alloc_standard_header(RequestComputedValues *values)
+{
+    return (char *) arena_alloc(&(values->arena), STANDARD_HEADER_SIZE);
+}
+
+
+// Gives back what a standard header just allocated did not use, once its
+// length is known
+static void trim_standard_header(RequestComputedValues *values,
+                                 char *header, int len)
+{
+    arena_trim(&(values->arena), header, len + 1);
+}
+
+
 // Composes the other headers
 static S3Status compose_standard_headers(const RequestParams *params,
                                          RequestComputedValues *values)
 {
 
-#define do_put_header(fmt, sourceField, destField, badError, tooLongError)  \
+#define do_header(properties, fmt, sourceField, destField, badError,        \
+                  tooLongError)                                             \
     do {                                                                    \
-        if (params->putProperties &&                                        \
-            params->putProperties-> sourceField &&                          \
-            params->putProperties-> sourceField[0]) {                       \
+        if (properties &&                                                   \
+            properties-> sourceField &&                                     \
+            properties-> sourceField[0]) {                                  \
             /* Skip whitespace at beginning of val */                       \
-            const char *val = params->putProperties-> sourceField;          \
+            const char *val = properties-> sourceField;                     \
             while (*val && is_blank(*val)) {                                \
                 val++;                                                      \
             }                                                               \
@@ -456,83 +903,67 @@ static S3Status compose_standard_headers(const RequestParams *params,
                 return badError;                                            \
             }                                                               \
             /* Compose header, make sure it all fit */                      \
-            int len = snprintf(values-> destField,                          \
-                               sizeof(values-> destField), fmt, val);       \
-            if (len >= (int) sizeof(values-> destField)) {                  \
+            char *header = alloc_standard_header(values);                   \
+            if (!header) {                                                  \
+                return S3StatusOutOfMemory;                                 \
+            }                                                               \
+            int len = snprintf(header, STANDARD_HEADER_SIZE, fmt, val);     \
+            if (len >= STANDARD_HEADER_SIZE) {                              \
                 return tooLongError;                                        \
             }                                                               \
             /* Now remove the whitespace at the end */                      \
-            while (is_blank(values-> destField[len])) {                     \
+            while (is_blank(header[len])) {                                 \
                 len--;                                                      \
             }                                                               \
-            values-> destField[len] = 0;                                    \
+            header[len] = 0;                                                \
+            trim_standard_header(values, header, len);                      \
+            values-> destField = header;                                    \
         }                                                                   \
         else {                                                              \
-            values-> destField[0] = 0;                                      \
+            values-> destField = "";                                        \
         }                                                                   \
     } while (0)
 
+#define do_put_header(fmt, sourceField, destField, badError, tooLongError)  \
+    do_header(params->putProperties, fmt, sourceField, destField,           \
+              badError, tooLongError)
+
 #define do_get_header(fmt, sourceField, destField, badError, tooLongError)  \
+    do_header(params->getConditions, fmt, sourceField, destField,           \
+              badError, tooLongError)
+
+    // Formats a date header, or leaves it empty if the time is negative
+#define do_date_header(fmt, time, destField)                                \
     do {                                                                    \
-        if (params->getConditions &&                                        \
-            params->getConditions-> sourceField &&                          \
-            params->getConditions-> sourceField[0]) {                       \
-            /* Skip whitespace at beginning of val */                       \
-            const char *val = params->getConditions-> sourceField;          \
-            while (*val && is_blank(*val)) {                                \
-                val++;                                                      \
-            }                                                               \
-            if (!*val) {                                                    \
-                return badError;                                            \
-            }                                                               \
-            /* Compose header, make sure it all fit */                      \
-            int len = snprintf(values-> destField,                          \
-                               sizeof(values-> destField), fmt, val);       \
-            if (len >= (int) sizeof(values-> destField)) {                  \
-                return tooLongError;                                        \
+        if ((time) >= 0) {                                                  \
+            time_t t = (time_t) (time);                                     \
+            struct tm gmt;                                                  \
+            char *header = alloc_standard_header(values);                   \
+            if (!header) {                                                  \
+                return S3StatusOutOfMemory;                                 \
             }                                                               \
-            /* Now remove the whitespace at the end */                      \
-            while (is_blank(values-> destField[len])) {                     \
-                len--;                                                      \
-            }                                                               \
-            values-> destField[len] = 0;                                    \
+            int len = strftime(header, STANDARD_HEADER_SIZE, fmt,           \
+                               gmtime_r(&t, &gmt));                         \
+            trim_standard_header(values, header, len);                      \
+            values-> destField = header;                                    \
         }                                                                   \
         else {                                                              \
-            values-> destField[0] = 0;                                      \
+            values-> destField = "";                                        \
         }                                                                   \
     } while (0)
 
     // Host
-    if (params->bucketContext.uriStyle == S3UriStyleVirtualHost) {
-        const char *requestHostName = params->bucketContext.hostName
-                ? params->bucketContext.hostName : defaultHostNameG;
-
-        size_t len = snprintf(values->hostHeader, sizeof(values->hostHeader),
-                              "Host: %s.%s", params->bucketContext.bucketName,
-                              requestHostName);
-        if (len >= sizeof(values->hostHeader)) {
-            return S3StatusUriTooLong;
-        }
-        while (is_blank(values->hostHeader[len])) {
-            len--;
-        }
-        values->hostHeader[len] = 0;
+    char *hostHeader = alloc_standard_header(values);
+    if (!hostHeader) {
+        return S3StatusOutOfMemory;
     }
-    else {
-        size_t len = snprintf(
-                values->hostHeader,
-                sizeof(values->hostHeader),
-                "Host: %s",
-                params->bucketContext.hostName ?
-                    params->bucketContext.hostName : defaultHostNameG);
-        if (len >= sizeof(values->hostHeader)) {
-            return S3StatusUriTooLong;
-        }
-        while (is_blank(values->hostHeader[len])) {
-            len--;
-        }
-        values->hostHeader[len] = 0;
+    S3Status status = compose_host_header
+        (&(params->bucketContext), hostHeader, STANDARD_HEADER_SIZE);
+    if (status != S3StatusOK) {
+        return status;
     }
+    trim_standard_header(values, hostHeader, strlen(hostHeader));
+    values->hostHeader = hostHeader;
 
     // Cache-Control
     do_put_header("Cache-Control: %s", cacheControl, cacheControlHeader,
@@ -558,41 +989,21 @@ static S3Status compose_standard_headers(const RequestParams *params,
                   S3StatusContentEncodingTooLong);
 
     // Expires
-    if (params->putProperties && (params->putProperties->expires >= 0)) {
-        time_t t = (time_t) params->putProperties->expires;
-        struct tm gmt;
-        strftime(values->expiresHeader, sizeof(values->expiresHeader),
-                 "Expires: %a, %d %b %Y %H:%M:%S UTC", gmtime_r(&t, &gmt));
-    }
-    else {
-        values->expiresHeader[0] = 0;
-    }
+    do_date_header("Expires: %a, %d %b %Y %H:%M:%S UTC",
+                   params->putProperties ?
+                   params->putProperties->expires : -1, expiresHeader);
 
     // If-Modified-Since
-    if (params->getConditions &&
-        (params->getConditions->ifModifiedSince >= 0)) {
-        time_t t = (time_t) params->getConditions->ifModifiedSince;
-        struct tm gmt;
-        strftime(values->ifModifiedSinceHeader,
-                 sizeof(values->ifModifiedSinceHeader),
-                 "If-Modified-Since: %a, %d %b %Y %H:%M:%S UTC", gmtime_r(&t, &gmt));
-    }
-    else {
-        values->ifModifiedSinceHeader[0] = 0;
-    }
+    do_date_header("If-Modified-Since: %a, %d %b %Y %H:%M:%S UTC",
+                   params->getConditions ?
+                   params->getConditions->ifModifiedSince : -1,
+                   ifModifiedSinceHeader);
 
     // If-Unmodified-Since header
-    if (params->getConditions &&
-        (params->getConditions->ifNotModifiedSince >= 0)) {
-        time_t t = (time_t) params->getConditions->ifNotModifiedSince;
-        struct tm gmt;
-        strftime(values->ifUnmodifiedSinceHeader,
-                 sizeof(values->ifUnmodifiedSinceHeader),
-                 "If-Unmodified-Since: %a, %d %b %Y %H:%M:%S UTC", gmtime_r(&t, &gmt));
-    }
-    else {
-        values->ifUnmodifiedSinceHeader[0] = 0;
-    }
+    do_date_header("If-Unmodified-Since: %a, %d %b %Y %H:%M:%S UTC",
+                   params->getConditions ?
+                   params->getConditions->ifNotModifiedSince : -1,
+                   ifUnmodifiedSinceHeader);
 
     // If-Match header
     do_get_header("If-Match: %s", ifMatchETag, ifMatchHeader,
@@ -605,33 +1016,58 @@ static S3Status compose_standard_headers(const RequestParams *params,
 
     // Range header
     if (params->startByte || params->byteCount) {
+        char *header = alloc_standard_header(values);
+        if (!header) {
+            return S3StatusOutOfMemory;
+        }
+        int len;
         if (params->byteCount) {
-            snprintf(values->rangeHeader, sizeof(values->rangeHeader),
-                     "Range: bytes=%llu-%llu",
-                     (unsigned long long) params->startByte,
-                     (unsigned long long) (params->startByte +
-                                           params->byteCount - 1));
+            len = snprintf(header, STANDARD_HEADER_SIZE,
+                           "Range: bytes=%llu-%llu",
+                           (unsigned long long) params->startByte,
+                           (unsigned long long) (params->startByte +
+                                                 params->byteCount - 1));
         }
         else {
-            snprintf(values->rangeHeader, sizeof(values->rangeHeader),
-                     "Range: bytes=%llu-",
-                     (unsigned long long) params->startByte);
+            len = snprintf(header, STANDARD_HEADER_SIZE,
+                           "Range: bytes=%llu-",
+                           (unsigned long long) params->startByte);
         }
+        trim_standard_header(values, header, len);
+        values->rangeHeader = header;
     }
     else {
-        values->rangeHeader[0] = 0;
+        values->rangeHeader = "";
     }
 
     return S3StatusOK;
+
+#undef do_date_header
+#undef do_get_header
+#undef do_put_header
+#undef do_header
 }
 
 
-// URL encodes the params->key value into params->urlEncodedKey
+// URL encodes the params->key value into values->urlEncodedKey
 static S3Status encode_key(const RequestParams *params,
                            RequestComputedValues *values)
 {
-    return (urlEncode(values->urlEncodedKey, params->key, S3_MAX_KEY_SIZE, 0) ?
-            S3StatusOK : S3StatusUriTooLong);
+    int len = params->key ? strlen(params->key) : 0;
+
+    if (len > S3_MAX_KEY_SIZE) {
+        return S3StatusUriTooLong;
+    }
+
+    if (!(values->urlEncodedKey = (char *) arena_alloc
+          (&(values->arena), (3 * len) + 1))) {
+        return S3StatusOutOfMemory;
+    }
+    urlEncode(values->urlEncodedKey, params->key, S3_MAX_KEY_SIZE, 0);
+    arena_trim(&(values->arena), values->urlEncodedKey,
+               strlen(values->urlEncodedKey) + 1);
+
+    return S3StatusOK;
 }
 
 
@@ -684,17 +1120,20 @@ static void kv_gnome_sort(const char **values, int size, char delim)
 }
 
 
-// Canonicalizes the signature headers into the canonicalizedSignatureHeaders buffer
-static void canonicalize_signature_headers(RequestComputedValues *values)
+// Canonicalizes the signature headers into the canonicalizedSignatureHeaders
+// buffer
+static S3Status canonicalize_signature_headers(RequestComputedValues *values)
 {
     // Make a copy of the headers that will be sorted
-    const char *sortedHeaders[S3_MAX_METADATA_COUNT + 3];
+    const char *sortedHeaders[values->amzHeadersCount + 4];
 
-    memcpy(sortedHeaders, values->amzHeaders,
-           (values->amzHeadersCount * sizeof(sortedHeaders[0])));
-
-    // add the content-type header and host header
-    int headerCount = values->amzHeadersCount;
+    // The Content-MD5, Content-Type, Host and Range headers, in that order,
+    // come before the x-amz- headers, which are in order already but for
+    // any metadata out of order
+    int headerCount = 0;
+    if (values->md5Header[0]) {
+        sortedHeaders[headerCount++] = values->md5Header;
+    }
     if (values->contentTypeHeader[0]) {
         sortedHeaders[headerCount++] = values->contentTypeHeader;
     }
@@ -704,11 +1143,26 @@ static void canonicalize_signature_headers(RequestComputedValues *values)
     if (values->rangeHeader[0]) {
         sortedHeaders[headerCount++] = values->rangeHeader;
     }
-    if (values->md5Header[0]) {
-        sortedHeaders[headerCount++] = values->md5Header;
-    }
+    memcpy(&(sortedHeaders[headerCount]), values->amzHeaders,
+           (values->amzHeadersCount * sizeof(sortedHeaders[0])));
+    headerCount += values->amzHeadersCount;
+
+    // Neither the canonicalized headers nor their names can be longer than
+    // the headers, each with its newline
+    size_t size = 1;
+    int i;
+    for (i = 0; i < headerCount; i++) {
+        size += strlen(sortedHeaders[i]) + 1;
+    }
+    if (!(values->canonicalizedSignatureHeaders =
+          (char *) arena_alloc(&(values->arena), size)) ||
+        !(values->signedHeaders =
+          (char *) arena_alloc(&(values->arena), size))) {
+        return S3StatusOutOfMemory;
+    }
 
-    // Now sort these
+    // Now sort these; in order, as they mostly are, that is just comparing
+    // each with the one before
     kv_gnome_sort(sortedHeaders, headerCount, ':');
 
     // Now copy this sorted list into the buffer, all the while:
@@ -718,8 +1172,7 @@ static void canonicalize_signature_headers(RequestComputedValues *values)
     int lastHeaderLen = 0;
     char *buffer = values->canonicalizedSignatureHeaders;
     char *hbuf = values->signedHeaders;
-    int i = 0;
-    for (; i < headerCount; i++) {
+    for (i = 0; i < headerCount; i++) {
         const char *header = sortedHeaders[i];
         const char *c = header;
         char v;
@@ -729,22 +1182,30 @@ static void canonicalize_signature_headers(RequestComputedValues *values)
             // Replacing the previous newline with a comma
             *(buffer - 1) = ',';
             // Skip the header name and space
-            c += (lastHeaderLen + 1);
+            c += lastHeaderLen;
+            if (*c == ' ') {
+                c++;
+            }
         }
         // Else this is a new header
         else {
-            // Copy in everything up to the space in the ": "
-            while (*c != ' ') {
+            // Copy in the name, up to the colon
+            while (*c && (*c != ':')) {
                 v = tolower(*c++);
                 *buffer++ = v;
                 *hbuf++ = v;
             }
-            // replace the ":" with a ";"
-            *(hbuf - 1) = ';';
-            // Save the header len since it's a new header
-            lastHeaderLen = c - header;
-            // Skip the space
-            c++;
+            *buffer++ = ':';
+            *hbuf++ = ';';
+            // Save the header len, with its colon, since it's a new header
+            lastHeaderLen = (c - header) + 1;
+            // Skip the colon and the space
+            if (*c) {
+                c++;
+            }
+            if (*c == ' ') {
+                c++;
+            }
         }
         // Now copy in the value, folding the lines
         while (*c) {
@@ -775,6 +1236,11 @@ static void canonicalize_signature_headers(RequestComputedValues *values)
 
     // Terminate the buffer
     *buffer = 0;
+
+    arena_trim(&(values->arena), values->signedHeaders,
+               (hbuf - values->signedHeaders));
+
+    return S3StatusOK;
 }
 
 
@@ -806,12 +1272,64 @@ static void canonicalize_resource(const S3BucketContext *context,
 }
 
 
+// Returns nonzero if the key of the query parameter p comes strictly before
+// that of q, as headerle compares them once the query string has been split
+// into parameters: '=' ends a key and comes before anything else, and a
+// parameter with no value ends where the next begins, coming before any
+// character.  Returns zero for keys which are the same, whose order the sort
+// would decide.
+static int query_param_before(const char *p, const char *q)
+{
+    while (1) {
+        char a = ((*p == '&') ? 0 : *p), b = ((*q == '&') ? 0 : *q);
+        if (a == '=') {
+            return (b != '=');
+        }
+        else if (b == '=') {
+            return 0;
+        }
+        else if (b != a) {
+            return (b > a);
+        }
+        else if (!a) {
+            return 0;
+        }
+        p++, q++;
+    }
+}
+
+
+// Returns nonzero if the query string is in order, as it mostly is, so that
+// sorting it would leave it as it is: no parameter is empty, and each comes
+// strictly before the next
+static int query_string_ordered(const char *queryString)
+{
+    const char *param = queryString, *next;
+
+    while ((next = strchr(param, '&'))) {
+        next++;
+        if ((next == (param + 1)) || !*next ||
+            !query_param_before(param, next)) {
+            return 0;
+        }
+        param = next;
+    }
+
+    return (*param != 0);
+}
+
+
 static void sort_query_string(const char *queryString, char *result)
 {
 #ifdef SIGNATURE_DEBUG
     printf("\n--\nsort_and_urlencode\nqueryString: %s\n", queryString);
 #endif
 
+    if (query_string_ordered(queryString)) {
+        strcpy(result, queryString);
+        return;
+    }
+
     unsigned int numParams = 1;
     const char *tmp = queryString;
     while ((tmp = strchr(tmp, '&')) != NULL) {
@@ -852,9 +1370,8 @@ static void sort_query_string(const char *queryString, char *result)
 }
 
 
-// Canonicalize the query string part of the request into a buffer
-static void canonicalize_query_string(const char *queryParams,
-                                      const char *subResource, char *buffer)
+void request_canonicalize_query_string(const char *queryParams,
+                                       const char *subResource, char *buffer)
 {
     int len = 0;
 
@@ -929,60 +1446,160 @@ static const char *http_request_type_to_verb(HttpRequestType requestType)
 }
 
 
+// Wipes the signing keys which the calling thread keeps
+static void wipe_signing_keys()
+{
+    // Through a volatile pointer, so that the stores are not optimized away
+    volatile unsigned char *c = (volatile unsigned char *) signingKeysG;
+    size_t i;
+
+    for (i = 0; i < sizeof(signingKeysG); i++) {
+        c[i] = 0;
+    }
+    nextSigningKeyG = 0;
+    threadSigningKeysGenerationG = signingKeysGenerationG;
+}
+
+
+// Sets signingKey to the SigV4 signing key for the secret access key, date
+// (as YYYYMMDD) and region: the HMAC chain of the date, region, service and
+// "aws4_request".  The key is the same for every request of the day, so each
+// thread keeps the keys it has derived most recently, found by the length and
+// the 64-bit FNV-1a hash of the secret, rather than deriving the key afresh
+// for every request.  A SHA-256 of the secret would take about an eighth of
+// the time of signing a request.
+static void signing_key(const char *secretAccessKey, const char *date,
+                        const char *region, unsigned char *signingKey)
+{
+    size_t secretLen = strlen(secretAccessKey);
+    uint64_t secretHash = 0xcbf29ce484222325ULL;
+    SigningKey *cached = 0;
+    size_t j;
+    int i;
+
+    if (threadSigningKeysGenerationG != signingKeysGenerationG) {
+        wipe_signing_keys();
+    }
+
+    for (j = 0; j < secretLen; j++) {
+        secretHash ^= (unsigned char) secretAccessKey[j];
+        secretHash *= 0x100000001b3ULL;
+    }
+
+    for (i = 0; i < SIGNING_KEY_CACHE_SIZE; i++) {
+        SigningKey *entry = &(signingKeysG[i]);
+        if ((entry->secretHash == secretHash) &&
+            (entry->secretLen == secretLen) &&
+            !memcmp(entry->date, date, 8) &&
+            !strcmp(entry->region, region) && entry->region[0]) {
+            memcpy(signingKey, entry->key, S3_SHA256_DIGEST_LENGTH);
+            return;
+        }
+    }
+
+    char accessKey[secretLen + 5];
+    snprintf(accessKey, sizeof(accessKey), "AWS4%s", secretAccessKey);
+
+#ifdef __APPLE__
+    unsigned char dateKey[S3_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, accessKey, strlen(accessKey), date, 8, dateKey);
+    unsigned char dateRegionKey[S3_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, dateKey, S3_SHA256_DIGEST_LENGTH, region,
+           strlen(region), dateRegionKey);
+    unsigned char dateRegionServiceKey[S3_SHA256_DIGEST_LENGTH];
+    CCHmac(kCCHmacAlgSHA256, dateRegionKey, S3_SHA256_DIGEST_LENGTH, "s3", 2,
+           dateRegionServiceKey);
+    CCHmac(kCCHmacAlgSHA256, dateRegionServiceKey, S3_SHA256_DIGEST_LENGTH,
+           "aws4_request", strlen("aws4_request"), signingKey);
+#else
+    const EVP_MD *sha256evp = EVP_sha256();
+    unsigned char dateKey[S3_SHA256_DIGEST_LENGTH];
+    HMAC(sha256evp, accessKey, strlen(accessKey),
+         (const unsigned char*) date, 8, dateKey, NULL);
+    unsigned char dateRegionKey[S3_SHA256_DIGEST_LENGTH];
+    HMAC(sha256evp, dateKey, S3_SHA256_DIGEST_LENGTH,
+         (const unsigned char*) region, strlen(region), dateRegionKey,
+         NULL);
+    unsigned char dateRegionServiceKey[S3_SHA256_DIGEST_LENGTH];
+    HMAC(sha256evp, dateRegionKey, S3_SHA256_DIGEST_LENGTH,
+         (const unsigned char*) "s3", 2, dateRegionServiceKey, NULL);
+    HMAC(sha256evp, dateRegionServiceKey, S3_SHA256_DIGEST_LENGTH,
+         (const unsigned char*) "aws4_request", strlen("aws4_request"),
+         signingKey, NULL);
+#endif
+
+    // Regions too long for the cache are just not kept
+    if (region[0] && (strlen(region) < sizeof(cached->region))) {
+        cached = &(signingKeysG[nextSigningKeyG]);
+        nextSigningKeyG = (nextSigningKeyG + 1) % SIGNING_KEY_CACHE_SIZE;
+        cached->secretLen = secretLen;
+        cached->secretHash = secretHash;
+        memcpy(cached->date, date, 8);
+        strcpy(cached->region, region);
+        memcpy(cached->key, signingKey, S3_SHA256_DIGEST_LENGTH);
+    }
+}
+
+
 // Composes the Authorization header for the request
 static S3Status compose_auth_header(const RequestParams *params,
                                     RequestComputedValues *values)
 {
     const char *httpMethod = http_request_type_to_verb(params->httpRequestType);
-    int canonicalRequestLen = strlen(httpMethod) + 1 +
-    strlen(values->canonicalURI) + 1 +
-    strlen(values->canonicalQueryString) + 1 +
-    strlen(values->canonicalizedSignatureHeaders) + 1 +
-    strlen(values->signedHeaders) + 1 +
-    2 * S3_SHA256_DIGEST_LENGTH + 1; // 2 hex digits for each byte
-
-    int len = 0;
-
-    char canonicalRequest[canonicalRequestLen];
+    const char *parts[] =
+    {
+        httpMethod, values->canonicalURI, values->canonicalQueryString,
+        values->canonicalizedSignatureHeaders, values->signedHeaders,
+        values->payloadHash
+    };
+    int partCount = sizeof(parts) / sizeof(parts[0]);
+    size_t partLens[sizeof(parts) / sizeof(parts[0])];
+    size_t canonicalRequestLen = 0;
+    int i;
 
-#define buf_append(buf, format, ...)                    \
-    len += snprintf(&(buf[len]), sizeof(buf) - len,     \
-                    format, __VA_ARGS__)
+    for (i = 0; i < partCount; i++) {
+        partLens[i] = strlen(parts[i]);
+        canonicalRequestLen += partLens[i] + 1;
+    }
 
-    canonicalRequest[0] = '\0';
-    buf_append(canonicalRequest, "%s\n", httpMethod);
-    buf_append(canonicalRequest, "%s\n", values->canonicalURI);
-    buf_append(canonicalRequest, "%s\n", values->canonicalQueryString);
-    buf_append(canonicalRequest, "%s\n", values->canonicalizedSignatureHeaders);
-    buf_append(canonicalRequest, "%s\n", values->signedHeaders);
+    // The canonical request is only needed until it is hashed
+    char *canonicalRequest =
+        (char *) arena_alloc(&(values->arena), canonicalRequestLen);
+    if (!canonicalRequest) {
+        return S3StatusOutOfMemory;
+    }
 
-    buf_append(canonicalRequest, "%s", values->payloadHash);
+    // Each part on a line of its own, but for the last
+    size_t len = 0;
+    for (i = 0; i < partCount; i++) {
+        memcpy(&(canonicalRequest[len]), parts[i], partLens[i]);
+        len += partLens[i];
+        canonicalRequest[len++] = '\n';
+    }
+    canonicalRequest[--len] = 0;
 
 #ifdef SIGNATURE_DEBUG
     printf("--\nCanonical Request:\n%s\n", canonicalRequest);
 #endif
 
-    len = 0;
     unsigned char canonicalRequestHash[S3_SHA256_DIGEST_LENGTH];
 #ifdef __APPLE__
-    CC_SHA256(canonicalRequest, strlen(canonicalRequest), canonicalRequestHash);
+    CC_SHA256(canonicalRequest, len, canonicalRequestHash);
 #else
     const unsigned char *rqstData = (const unsigned char*) canonicalRequest;
-    SHA256(rqstData, strlen(canonicalRequest), canonicalRequestHash);
+    SHA256(rqstData, len, canonicalRequestHash);
 #endif
+    arena_trim(&(values->arena), canonicalRequest, 0);
     char canonicalRequestHashHex[2 * S3_SHA256_DIGEST_LENGTH + 1];
-    canonicalRequestHashHex[0] = '\0';
-    int i = 0;
-    for (; i < S3_SHA256_DIGEST_LENGTH; i++) {
-        buf_append(canonicalRequestHashHex, "%02x", canonicalRequestHash[i]);
-    }
+    hex_encode(canonicalRequestHash, S3_SHA256_DIGEST_LENGTH,
+               canonicalRequestHashHex);
 
     const char *awsRegion = S3_DEFAULT_REGION;
     if (params->bucketContext.authRegion) {
         awsRegion = params->bucketContext.authRegion;
     }
-    char scope[SIGNATURE_SCOPE_SIZE + 1];
-    snprintf(scope, sizeof(scope), "%.8s/%s/s3/aws4_request",
+    char *scope = values->signatureScope;
+    snprintf(scope, sizeof(values->signatureScope), "%.8s/%s/s3/aws4_request",
              values->requestDateISO8601, awsRegion);
 
     char stringToSign[17 + 17 + SIGNATURE_SCOPE_SIZE + 1
@@ -994,77 +1611,48 @@ static S3Status compose_auth_header(const RequestParams *params,
     printf("--\nString to Sign:\n%s\n", stringToSign);
 #endif
 
-    const char *secretAccessKey = params->bucketContext.secretAccessKey;
-    char accessKey[strlen(secretAccessKey) + 5];
-    snprintf(accessKey, sizeof(accessKey), "AWS4%s", secretAccessKey);
-
-#ifdef __APPLE__
-    unsigned char dateKey[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, accessKey, strlen(accessKey),
-           values->requestDateISO8601, 8, dateKey);
-    unsigned char dateRegionKey[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, dateKey, S3_SHA256_DIGEST_LENGTH, awsRegion,
-           strlen(awsRegion), dateRegionKey);
-    unsigned char dateRegionServiceKey[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, dateRegionKey, S3_SHA256_DIGEST_LENGTH, "s3", 2,
-           dateRegionServiceKey);
-    unsigned char signingKey[S3_SHA256_DIGEST_LENGTH];
-    CCHmac(kCCHmacAlgSHA256, dateRegionServiceKey, S3_SHA256_DIGEST_LENGTH,
-           "aws4_request", strlen("aws4_request"), signingKey);
+    unsigned char *signingKey = values->signingKey;
+    signing_key(params->bucketContext.secretAccessKey,
+                values->requestDateISO8601, awsRegion, signingKey);
 
     unsigned char finalSignature[S3_SHA256_DIGEST_LENGTH];
+#ifdef __APPLE__
     CCHmac(kCCHmacAlgSHA256, signingKey, S3_SHA256_DIGEST_LENGTH, stringToSign,
             strlen(stringToSign), finalSignature);
 #else
-    const EVP_MD *sha256evp = EVP_sha256();
-    unsigned char dateKey[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, accessKey, strlen(accessKey),
-         (const unsigned char*) values->requestDateISO8601, 8, dateKey,
-         NULL);
-    unsigned char dateRegionKey[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, dateKey, S3_SHA256_DIGEST_LENGTH,
-         (const unsigned char*) awsRegion, strlen(awsRegion), dateRegionKey,
-         NULL);
-    unsigned char dateRegionServiceKey[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, dateRegionKey, S3_SHA256_DIGEST_LENGTH,
-         (const unsigned char*) "s3", 2, dateRegionServiceKey, NULL);
-    unsigned char signingKey[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, dateRegionServiceKey, S3_SHA256_DIGEST_LENGTH,
-         (const unsigned char*) "aws4_request", strlen("aws4_request"),
-         signingKey,
-         NULL);
-
-    unsigned char finalSignature[S3_SHA256_DIGEST_LENGTH];
-    HMAC(sha256evp, signingKey, S3_SHA256_DIGEST_LENGTH,
+    HMAC(EVP_sha256(), signingKey, S3_SHA256_DIGEST_LENGTH,
          (const unsigned char*) stringToSign, strlen(stringToSign),
          finalSignature, NULL);
 #endif
 
-    len = 0;
-    values->requestSignatureHex[0] = '\0';
-    for (i = 0; i < S3_SHA256_DIGEST_LENGTH; i++) {
-        buf_append(values->requestSignatureHex, "%02x", finalSignature[i]);
-    }
+    hex_encode(finalSignature, S3_SHA256_DIGEST_LENGTH,
+               values->requestSignatureHex);
 
     snprintf(values->authCredential, sizeof(values->authCredential),
-             "%s/%.8s/%s/s3/aws4_request", params->bucketContext.accessKeyId,
-             values->requestDateISO8601, awsRegion);
+             "%s/%s", params->bucketContext.accessKeyId, scope);
+
+#define AUTHORIZATION_FORMAT \
+    "Authorization: AWS4-HMAC-SHA256 Credential=%s,SignedHeaders=%s," \
+    "Signature=%s"
+
+    size_t authorizationHeaderSize = sizeof(AUTHORIZATION_FORMAT) +
+        strlen(values->authCredential) + strlen(values->signedHeaders) +
+        sizeof(values->requestSignatureHex);
+    if (!(values->authorizationHeader = (char *) arena_alloc
+          (&(values->arena), authorizationHeaderSize))) {
+        return S3StatusOutOfMemory;
+    }
+    snprintf(values->authorizationHeader, authorizationHeaderSize,
+             AUTHORIZATION_FORMAT, values->authCredential,
+             values->signedHeaders, values->requestSignatureHex);
 
-    snprintf(
-            values->authorizationHeader,
-            sizeof(values->authorizationHeader),
-            "Authorization: AWS4-HMAC-SHA256 Credential=%s,SignedHeaders=%s,Signature=%s",
-            values->authCredential, values->signedHeaders,
-            values->requestSignatureHex);
+#undef AUTHORIZATION_FORMAT
 
 #ifdef SIGNATURE_DEBUG
     printf("--\nAuthorization Header:\n%s\n", values->authorizationHeader);
 #endif
 
     return S3StatusOK;
-
-#undef buf_append
-
 }
 
 
@@ -1127,10 +1715,11 @@ static S3Status compose_uri(char *buffer, int bufferSize,
     return S3StatusOK;
 }
 
-// Sets up the curl handle given the completely computed RequestParams
-static S3Status setup_curl(Request *request,
-                           const RequestParams *params,
-                           const RequestComputedValues *values)
+// Sets up the options of a newly created curl handle which do not vary from
+// request to request.  These are applied only once, when the handle is
+// created, and survive for as long as the handle lives in the request stack,
+// so that re-using the handle does not discard its live connections.
+static S3Status setup_curl_handle(Request *request)
 {
     CURLcode status;
 
@@ -1183,10 +1772,6 @@ static S3Status setup_curl(Request *request,
     // Don't use Curl's 'netrc' feature
     curl_easy_setopt_safe(CURLOPT_NETRC, CURL_NETRC_IGNORED);
 
-    // Don't verify S3's certificate unless S3_INIT_VERIFY_PEER is set.
-    // The request_context may be set to override this
-    curl_easy_setopt_safe(CURLOPT_SSL_VERIFYPEER, verifyPeer);
-
     // Follow any redirection directives that S3 sends
     curl_easy_setopt_safe(CURLOPT_FOLLOWLOCATION, 1);
 
@@ -1196,39 +1781,99 @@ static S3Status setup_curl(Request *request,
     // Set the User-Agent; maybe Amazon will track these?
     curl_easy_setopt_safe(CURLOPT_USERAGENT, userAgentG);
 
+    // Use the library-wide caches, if they are enabled
+    if (curlShareG) {
+        curl_easy_setopt_safe(CURLOPT_SHARE, curlShareG);
+    }
+
+    return S3StatusOK;
+}
+
+
+// Adds a header to the request's headers, copying it into the request's own
+// storage; returns zero if there is no more room, which for the headers that
+// setup_curl adds cannot happen
+static int add_header(Request *request, const char *header)
+{
+    size_t len = strlen(header) + 1;
+
+    if ((request->headersCount == REQUEST_MAX_HEADERS) ||
+        (len > (sizeof(request->headersRaw) - request->headersRawLength))) {
+        return 0;
+    }
+
+    struct curl_slist *node = &(request->headers[request->headersCount++]);
+    node->data = &(request->headersRaw[request->headersRawLength]);
+    node->next = 0;
+    memcpy(node->data, header, len);
+    request->headersRawLength += len;
+    if (node != request->headers) {
+        node[-1].next = node;
+    }
+
+    return 1;
+}
+
+
+// Sets up the per-request options of the curl handle given the completely
+// computed RequestParams.  Every option set here must be set (or cleared) on
+// every request, since the handle may still carry the values of whatever
+// request it was last used for.
+static S3Status setup_curl(Request *request,
+                           const RequestParams *params,
+                           const RequestComputedValues *values)
+{
+    CURLcode status;
+
+    // Don't verify S3's certificate unless S3_INIT_VERIFY_PEER is set.
+    // The request_context may be set to override this
+    curl_easy_setopt_safe(CURLOPT_SSL_VERIFYPEER, verifyPeer);
+
+    // A timeout of 0 disables any timeout left over from a previous request,
+    // and a connect timeout of 0 restores libcurl's default
+    curl_easy_setopt_safe(CURLOPT_TIMEOUT_MS,
+                          (params->timeoutMs > 0) ? params->timeoutMs : 0);
+    curl_easy_setopt_safe(CURLOPT_CONNECTTIMEOUT_MS, 0);
+
     // Set the low speed limit and time; we abort transfers that stay at
-    // less than 1K per second for more than 15 seconds.
-    // xxx todo - make these configurable
+    // less than 1K per second for more than 15 seconds, unless the request
+    // context sets a stall timeout of its own.
     // xxx todo - allow configurable max send and receive speed
     curl_easy_setopt_safe(CURLOPT_LOW_SPEED_LIMIT, 1024);
     curl_easy_setopt_safe(CURLOPT_LOW_SPEED_TIME, 15);
 
+    // Requests connect wherever their URIs say, unless endpoint balancing
+    // gives them an address
+    curl_easy_setopt_safe(CURLOPT_CONNECT_TO, NULL);
 
-    if (params->timeoutMs > 0) {
-        curl_easy_setopt_safe(CURLOPT_TIMEOUT_MS, params->timeoutMs);
+#define add_header_safe(header)                                         \
+    if (!add_header(request, header)) {                                 \
+        return S3StatusFailedToInitializeRequest;                       \
     }
 
-
     // Append standard headers
 #define append_standard_header(fieldName)                               \
     if (values-> fieldName [0]) {                                       \
-        request->headers = curl_slist_append(request->headers,          \
-                                             values-> fieldName);       \
+        add_header_safe(values-> fieldName);                            \
     }
 
+    request->headersCount = 0;
+    request->headersRawLength = 0;
+
     // Would use CURLOPT_INFILESIZE_LARGE, but it is buggy in libcurl
     if ((params->httpRequestType == HttpRequestTypePUT) ||
         (params->httpRequestType == HttpRequestTypePOST)) {
         char header[256];
         snprintf(header, sizeof(header), "Content-Length: %llu",
-                 (unsigned long long) params->toS3CallbackTotalSize);
-        request->headers = curl_slist_append(request->headers, header);
-        request->headers = curl_slist_append(request->headers,
-                                             "Transfer-Encoding:");
+                 (unsigned long long) (values->chunkedPayload ?
+                                       chunk_signer_encoded_length
+                                       (params->toS3CallbackTotalSize) :
+                                       params->toS3CallbackTotalSize));
+        add_header_safe(header);
+        add_header_safe("Transfer-Encoding:");
     }
     else if (params->httpRequestType == HttpRequestTypeCOPY) {
-        request->headers = curl_slist_append(request->headers,
-                                             "Transfer-Encoding:");
+        add_header_safe("Transfer-Encoding:");
     }
 
     append_standard_header(hostHeader);
@@ -1245,20 +1890,38 @@ static S3Status setup_curl(Request *request,
     append_standard_header(rangeHeader);
     append_standard_header(authorizationHeader);
 
-    // Append x-amz- headers
+    // Append x-amz- headers; curl leaves out a header with nothing after
+    // its colon, so one whose value is empty (and so which alone ends with
+    // the space of its ": ") is given as "name;" to be sent empty
     int i;
     for (i = 0; i < values->amzHeadersCount; i++) {
-        request->headers =
-            curl_slist_append(request->headers, values->amzHeaders[i]);
+        const char *header = values->amzHeaders[i];
+        size_t len = strlen(header);
+        if (header[len - 1] == ' ') {
+            char empty[len];
+            memcpy(empty, header, len - 2);
+            empty[len - 2] = ';';
+            empty[len - 1] = 0;
+            add_header_safe(empty);
+        }
+        else {
+            add_header_safe(header);
+        }
     }
 
     // Set the HTTP headers
-    curl_easy_setopt_safe(CURLOPT_HTTPHEADER, request->headers);
+    curl_easy_setopt_safe(CURLOPT_HTTPHEADER,
+                          request->headersCount ? request->headers : 0);
 
     // Set URI
     curl_easy_setopt_safe(CURLOPT_URL, request->uri);
 
-    // Set request type.
+    // Set request type.  First put the handle back to a plain GET, which
+    // also clears CURLOPT_NOBODY and CURLOPT_UPLOAD, and drop any custom
+    // verb, in case the handle was last used for some other request type.
+    curl_easy_setopt_safe(CURLOPT_HTTPGET, 1);
+    curl_easy_setopt_safe(CURLOPT_CUSTOMREQUEST, NULL);
+
     switch (params->httpRequestType) {
     case HttpRequestTypeHEAD:
         curl_easy_setopt_safe(CURLOPT_NOBODY, 1);
@@ -1285,17 +1948,20 @@ static S3Status setup_curl(Request *request,
 
 static void request_deinitialize(Request *request)
 {
-    if (request->headers) {
-        curl_slist_free_all(request->headers);
+    if (request->connectTo) {
+        curl_slist_free_all(request->connectTo);
+    }
+
+    if (request->chunkSigner) {
+        chunk_signer_destroy(request->chunkSigner);
     }
 
     error_parser_deinitialize(&(request->errorParser));
 
-    // curl_easy_reset prevents connections from being re-used for some
-    // reason.  This makes HTTP Keep-Alive meaningless and is very bad for
-    // performance.  But it is necessary to allow curl to work properly.
-    // xxx todo figure out why
-    curl_easy_reset(request->curl);
+    // The curl handle is deliberately not reset here: curl_easy_reset would
+    // throw away the handle's live connections, making HTTP Keep-Alive
+    // meaningless.  Instead setup_curl re-applies every per-request option
+    // when the handle is next used.
 }
 
 
@@ -1305,21 +1971,14 @@ static S3Status request_get(const RequestParams *params,
 {
     Request *request = 0;
 
-    // Try to get one from the request stack.  We hold the lock for the
-    // shortest time possible here.
-    pthread_mutex_lock(&requestStackMutexG);
-
-    if (requestStackCountG) {
-        request = requestStackG[--requestStackCountG];
-    }
-
-    pthread_mutex_unlock(&requestStackMutexG);
+    // Try to get one from the request pool
+    request = request_pool_get();
 
     // If we got one, deinitialize it for re-use
     if (request) {
         request_deinitialize(request);
     }
-    // Else there wasn't one available in the request stack, so create one
+    // Else there wasn't one available in the request pool, so create one
     else {
         if (!(request = (Request *) malloc(sizeof(Request)))) {
             return S3StatusOutOfMemory;
@@ -1328,21 +1987,55 @@ static S3Status request_get(const RequestParams *params,
             free(request);
             return S3StatusFailedToInitializeRequest;
         }
+        if (setup_curl_handle(request) != S3StatusOK) {
+            curl_easy_cleanup(request->curl);
+            free(request);
+            return S3StatusFailedToInitializeRequest;
+        }
     }
 
     // Initialize the request
     request->prev = 0;
     request->next = 0;
+    request->context = 0;
+    request->startMs = 0;
+    request->responseStarted = 0;
+    request->hedgeParams = 0;
+    request->hedgePrev = 0;
+    request->hedgeNext = 0;
+    request->hedgePartner = 0;
+    request->isHedge = 0;
+    request->hedgeLost = 0;
+    request->handle = 0;
+    request->cancelled = 0;
+    request->cancelNext = 0;
+    request->retryParams = 0;
+    request->retries = 0;
+    request->retryDelayMs = 0;
+    request->resumeParams = 0;
+    request->bytesReceived = 0;
+    request->resumes = 0;
+    request->resumeFrom = 0;
+    request->rateLimit = 0;
+    request->endpoint = 0;
+    request->endpointAddress = 0;
+    request->connectTo = 0;
+    request->bandwidth = 0;
+    request->chunkSigner = 0;
+    request->pausedDirections = 0;
+    request->pausedNext = 0;
+    request->deadlineMs = 0;
+    request->firstByteDueMs = 0;
+    request->firstBytePrev = 0;
+    request->firstByteNext = 0;
 
     // Request status is initialized to no error, will be updated whenever
     // an error occurs
     request->status = S3StatusOK;
+    request->httpResponseCode = 0;
 
     S3Status status;
 
-    // Start out with no headers
-    request->headers = 0;
-
     // Compute the URL
     if ((status = compose_uri
          (request->uri, sizeof(request->uri),
@@ -1372,6 +2065,15 @@ static S3Status request_get(const RequestParams *params,
 
     request->callbackData = params->callbackData;
 
+    if (values->chunkedPayload &&
+        !(request->chunkSigner = chunk_signer_create
+          (values->signingKey, values->requestDateISO8601,
+           values->signatureScope, values->requestSignatureHex))) {
+        curl_easy_cleanup(request->curl);
+        free(request);
+        return S3StatusOutOfMemory;
+    }
+
     response_headers_handler_initialize(&(request->responseHeadersHandler));
 
     request->propertiesCallbackMade = 0;
@@ -1394,20 +2096,109 @@ static void request_destroy(Request *request)
 
 static void request_release(Request *request)
 {
-    pthread_mutex_lock(&requestStackMutexG);
+    if (request->hedgeParams) {
+        hedge_candidate_remove(request);
+    }
+    if (request->firstByteDueMs) {
+        first_byte_remove(request);
+    }
+
+    free(request->retryParams);
+    free(request->resumeParams);
+
+    // The chunk buffer is not worth keeping in the pool
+    if (request->chunkSigner) {
+        chunk_signer_destroy(request->chunkSigner);
+        request->chunkSigner = 0;
+    }
+
+    if (request->rateLimit) {
+        request->rateLimit->inFlight--;
+    }
+
+    endpoint_release(request, request->status);
 
-    // If the request stack is full, destroy this one
-    if (requestStackCountG == REQUEST_STACK_SIZE) {
-        pthread_mutex_unlock(&requestStackMutexG);
+    // A handle left paused is not fit to be used again
+    if (request->pausedDirections) {
+        bandwidth_paused_remove(request);
         request_destroy(request);
+        return;
     }
-    // Else put this one at the front of the request stack; we do this because
-    // we want the most-recently-used curl handle to be re-used on the next
-    // request, to maximize our chances of re-using a TCP connection before it
-    // times out
-    else {
-        requestStackG[requestStackCountG++] = request;
-        pthread_mutex_unlock(&requestStackMutexG);
+
+    // The pool hands out the most-recently-used curl handle first, to
+    // maximize our chances of re-using a TCP connection before it times out;
+    // if the pool is full, it destroys this one
+    request_pool_put(request);
+}
+
+
+static void curl_share_lock_func(CURL *handle, curl_lock_data data,
+                                 curl_lock_access access, void *userptr)
+{
+    (void) handle;
+    (void) access;
+    (void) userptr;
+
+    pthread_mutex_lock(&(curlShareMutexesG[data]));
+}
+
+
+static void curl_share_unlock_func(CURL *handle, curl_lock_data data,
+                                   void *userptr)
+{
+    (void) handle;
+    (void) userptr;
+
+    pthread_mutex_unlock(&(curlShareMutexesG[data]));
+}
+
+
+// Creates curlShareG
+static S3Status curl_share_initialize()
+{
+    if (!(curlShareG = curl_share_init())) {
+        return S3StatusOutOfMemory;
+    }
+
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&(curlShareMutexesG[i]), 0);
+    }
+
+    if ((curl_share_setopt(curlShareG, CURLSHOPT_LOCKFUNC,
+                           &curl_share_lock_func) != CURLSHE_OK) ||
+        (curl_share_setopt(curlShareG, CURLSHOPT_UNLOCKFUNC,
+                           &curl_share_unlock_func) != CURLSHE_OK) ||
+        (curl_share_setopt(curlShareG, CURLSHOPT_SHARE,
+                           CURL_LOCK_DATA_DNS) != CURLSHE_OK) ||
+        (curl_share_setopt(curlShareG, CURLSHOPT_SHARE,
+                           CURL_LOCK_DATA_SSL_SESSION) != CURLSHE_OK)
+#if LIBCURL_VERSION_NUM >= 0x073900 /* 7.57.0 */
+        || (curl_share_setopt(curlShareG, CURLSHOPT_SHARE,
+                              CURL_LOCK_DATA_CONNECT) != CURLSHE_OK)
+#endif
+        ) {
+        curl_share_cleanup(curlShareG);
+        curlShareG = 0;
+        for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+            pthread_mutex_destroy(&(curlShareMutexesG[i]));
+        }
+        return S3StatusInternalError;
+    }
+
+    return S3StatusOK;
+}
+
+
+// Destroys curlShareG; no curl handle may still be using it
+static void curl_share_deinitialize()
+{
+    curl_share_cleanup(curlShareG);
+    curlShareG = 0;
+
+    int i;
+    for (i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_destroy(&(curlShareMutexesG[i]));
     }
 }
 
@@ -1421,6 +2212,7 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
         return S3StatusInternalError;
     }
     verifyPeer = (flags & S3_INIT_VERIFY_PEER) != 0;
+    signPayloadsG = (flags & S3_INIT_SIGN_PAYLOADS) != 0;
 
     if (!defaultHostName) {
         defaultHostName = S3_DEFAULT_HOSTNAME;
@@ -1431,9 +2223,20 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
         return S3StatusUriTooLong;
     }
 
-    pthread_mutex_init(&requestStackMutexG, 0);
+    S3Status status;
+
+    curlShareG = 0;
+    if ((flags & S3_INIT_SHARE_CACHES) &&
+        ((status = curl_share_initialize()) != S3StatusOK)) {
+        return status;
+    }
 
-    requestStackCountG = 0;
+    if ((status = request_pool_initialize(&request_destroy)) != S3StatusOK) {
+        if (curlShareG) {
+            curl_share_deinitialize();
+        }
+        return status;
+    }
 
     if (!userAgentInfo || !*userAgentInfo) {
         userAgentInfo = "Unknown";
@@ -1460,17 +2263,24 @@ S3Status request_api_initialize(const char *userAgentInfo, int flags,
 
 void request_api_deinitialize()
 {
-    pthread_mutex_destroy(&requestStackMutexG);
+    request_pool_deinitialize();
 
-    xmlCleanupParser();
-    while (requestStackCountG--) {
-        request_destroy(requestStackG[requestStackCountG]);
+    // Only now that every curl handle has been destroyed can the share go
+    if (curlShareG) {
+        curl_share_deinitialize();
     }
+
+    // Other threads wipe their signing keys when they next sign
+    __sync_fetch_and_add(&signingKeysGenerationG, 1);
+    wipe_signing_keys();
+
+    xmlCleanupParser();
 }
 
-static S3Status setup_request(const RequestParams *params,
-                              RequestComputedValues *computed,
-                              int forceUnsignedPayload)
+static S3Status compute_request_values(const RequestParams *params,
+                                       RequestComputedValues *computed,
+                                       int forceUnsignedPayload,
+                                       int signPayload)
 {
     S3Status status;
 
@@ -1482,14 +2292,19 @@ static S3Status setup_request(const RequestParams *params,
         return status;
     }
 
+    // The date only needs formatting once a second
     time_t now = time(NULL);
-    struct tm gmt;
-    gmtime_r(&now, &gmt);
-    strftime(computed->requestDateISO8601, sizeof(computed->requestDateISO8601),
-             "%Y%m%dT%H%M%SZ", &gmt);
+    if (now != requestDateTimeG) {
+        struct tm gmt;
+        gmtime_r(&now, &gmt);
+        strftime(requestDateG, sizeof(requestDateG), "%Y%m%dT%H%M%SZ", &gmt);
+        requestDateTimeG = now;
+    }
+    memcpy(computed->requestDateISO8601, requestDateG, sizeof(requestDateG));
 
     // Compose the amz headers
-    if ((status = compose_amz_headers(params, forceUnsignedPayload, computed))
+    if ((status = compose_amz_headers(params, forceUnsignedPayload,
+                                      signPayload, computed))
         != S3StatusOK) {
         return status;
     }
@@ -1499,19 +2314,61 @@ static S3Status setup_request(const RequestParams *params,
         return status;
     }
 
+    // A chunk-signed payload is aws-chunked before any other content coding
+    if (computed->chunkedPayload) {
+        const char *encoding = computed->contentEncodingHeader[0] ?
+            &(computed->contentEncodingHeader
+              [sizeof("Content-Encoding: ") - 1]) : 0;
+        char *header = alloc_standard_header(computed);
+        if (!header) {
+            return S3StatusOutOfMemory;
+        }
+        int len = snprintf(header, STANDARD_HEADER_SIZE,
+                           "Content-Encoding: aws-chunked%s%s",
+                           encoding ? "," : "", encoding ? encoding : "");
+        if (len >= STANDARD_HEADER_SIZE) {
+            return S3StatusContentEncodingTooLong;
+        }
+        trim_standard_header(computed, header, len);
+        computed->contentEncodingHeader = header;
+    }
+
     // URL encode the key
     if ((status = encode_key(params, computed)) != S3StatusOK) {
         return status;
     }
 
     // Compute the canonicalized amz headers
-    canonicalize_signature_headers(computed);
+    if ((status = canonicalize_signature_headers(computed)) != S3StatusOK) {
+        return status;
+    }
 
-    // Compute the canonicalized resource
+    // Compute the canonicalized resource, which is at most the bucket name
+    // and the key, with their slashes
+    size_t size = ((params->bucketContext.bucketName ?
+                    strlen(params->bucketContext.bucketName) : 0) +
+                   strlen(computed->urlEncodedKey) + 3);
+    if (!(computed->canonicalURI =
+          (char *) arena_alloc(&(computed->arena), size))) {
+        return S3StatusOutOfMemory;
+    }
     canonicalize_resource(&params->bucketContext, computed->urlEncodedKey,
                           computed->canonicalURI);
-    canonicalize_query_string(params->queryParams, params->subResource,
-                              computed->canonicalQueryString);
+    arena_trim(&(computed->arena), computed->canonicalURI,
+               strlen(computed->canonicalURI) + 1);
+
+    // And the query string, which gains at most a separator and an "="
+    size = ((params->queryParams ? strlen(params->queryParams) : 0) +
+            (params->subResource ? strlen(params->subResource) : 0) + 3);
+    if (!(computed->canonicalQueryString =
+          (char *) arena_alloc(&(computed->arena), size))) {
+        return S3StatusOutOfMemory;
+    }
+    request_canonicalize_query_string(params->queryParams,
+                                      params->subResource,
+                                      computed->canonicalQueryString);
+    arena_trim(&(computed->arena), computed->canonicalQueryString,
+               strlen(computed->canonicalQueryString) + 1);
 
     // Compose Authorization header
     if ((status = compose_auth_header(params, computed)) != S3StatusOK) {
@@ -1529,28 +2386,85 @@ static S3Status setup_request(const RequestParams *params,
     return status;
 }
 
-void request_perform(const RequestParams *params, S3RequestContext *context)
+// Computes the values of a request into computed, whose arena then holds
+// whatever they need beyond computed itself until the caller deinitializes
+// it; unless the request cannot be set up, when nothing is kept
+static S3Status setup_request(const RequestParams *params,
+                              RequestComputedValues *computed,
+                              int forceUnsignedPayload, int signPayload)
 {
-    Request *request;
     S3Status status;
-    int verifyPeerRequest = verifyPeer;
-    CURLcode curlstatus;
 
+    arena_initialize(&(computed->arena));
+
+    if ((status = compute_request_values(params, computed,
+                                         forceUnsignedPayload,
+                                         signPayload)) != S3StatusOK) {
+        arena_deinitialize(&(computed->arena));
+    }
+
+    return status;
+}
+
+
+int request_shares_caches()
+{
+    return (curlShareG != 0);
+}
+
+
+// Performs a request; deadlineMs, if nonzero, is the monotonic time by which
+// it must complete, and hedgeOf, if nonzero, is the request which this is a
+// hedge of
+// Returns the request if it has been added to context, or 0 if it has
+// already completed (or, for a hedge, been abandoned)
+static Request *perform_request(const RequestParams *params,
+                                S3RequestContext *context,
+                                S3RequestHandle handle, int64_t deadlineMs,
+                                Request *hedgeOf)
+{
+    Request *request;
+    S3Status status;
+    int verifyPeerRequest = verifyPeer;
+    CURLcode curlstatus;
+
+    // A hedge which cannot be made just leaves the original to complete
 #define return_status(status)                                           \
-    (*(params->completeCallback))(status, 0, params->callbackData);     \
-    return
+    if (!hedgeOf) {                                                     \
+        request_complete(context, params->completeCallback,             \
+                         params->callbackData, status, 0, 0);           \
+    }                                                                   \
+    return 0
+
+    // A request whose deadline passed while it waited to start is not tried
+    if (deadlineMs && (monotonic_ms() >= deadlineMs)) {
+        return_status(S3StatusErrorRequestTimeout);
+    }
 
     // These will hold the computed values
     RequestComputedValues computed;
 
-    if ((status = setup_request(params, &computed, 0)) != S3StatusOK) {
+    int signPayload = signPayloadsG;
+    if (context && (context->signPayloads >= 0)) {
+        signPayload = context->signPayloads;
+    }
+
+    if ((status = setup_request(params, &computed, 0, signPayload)) !=
+        S3StatusOK) {
         return_status(status);
     }
 
-    // Get an initialized Request structure now
+    // Get an initialized Request structure now, which keeps what it needs
+    // of the computed values
     if ((status = request_get(params, &computed, &request)) != S3StatusOK) {
+        arena_deinitialize(&(computed.arena));
         return_status(status);
     }
+    arena_deinitialize(&(computed.arena));
+
+    request->context = context;
+    request->handle = handle;
+
     if (context && context->verifyPeerSet) {
         verifyPeerRequest = context->verifyPeerSet;
     }
@@ -1564,10 +2478,131 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
         }
     }
 
+#if LIBCURL_VERSION_NUM >= 0x073100 /* 7.49.0 */
+    // HTTP/2 is only used by contexts which ask for it; since the handle may
+    // have been used by such a context before, always set these
+    long httpVersion = CURL_HTTP_VERSION_NONE;
+    if (context && context->http2) {
+        // Over TLS, HTTP/2 is negotiated (falling back to HTTP/1.1); in the
+        // clear, the server must be known to speak it
+        httpVersion = (params->bucketContext.protocol == S3ProtocolHTTPS) ?
+            CURL_HTTP_VERSION_2TLS : CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE;
+    }
+    // With PIPEWAIT, a request waits for a connection being set up to say
+    // whether it can multiplex, rather than opening another connection
+    if ((curl_easy_setopt(request->curl, CURLOPT_HTTP_VERSION, httpVersion)
+         != CURLE_OK) ||
+        (curl_easy_setopt(request->curl, CURLOPT_PIPEWAIT,
+                          (long) (context && context->http2)) != CURLE_OK)) {
+        if (hedgeOf) {
+            request_release(request);
+            return 0;
+        }
+        request->status = S3StatusFailedToInitializeRequest;
+        request_finish(request);
+        return 0;
+    }
+#endif
+
+    // The context's connect timeout applies to each attempt, and whatever is
+    // left before the deadline to the attempt as a whole
+    if (context) {
+        CURLcode code = CURLE_OK;
+        if (context->timeouts.connectTimeoutMs) {
+            code = curl_easy_setopt(request->curl, CURLOPT_CONNECTTIMEOUT_MS,
+                                    (long) context->timeouts.connectTimeoutMs);
+        }
+        if (context->timeouts.stallTimeoutMs && (code == CURLE_OK)) {
+            code = curl_easy_setopt
+                (request->curl, CURLOPT_LOW_SPEED_TIME,
+                 (long) ((context->timeouts.stallTimeoutMs + 999) / 1000));
+        }
+        if ((request->deadlineMs = deadlineMs) && (code == CURLE_OK)) {
+            int64_t remainingMs = deadlineMs - monotonic_ms();
+            if (remainingMs < 1) {
+                remainingMs = 1;
+            }
+            if ((params->timeoutMs <= 0) || (remainingMs < params->timeoutMs)) {
+                code = curl_easy_setopt(request->curl, CURLOPT_TIMEOUT_MS,
+                                        (long) remainingMs);
+            }
+        }
+        if (code != CURLE_OK) {
+            if (hedgeOf) {
+                request_release(request);
+                return 0;
+            }
+            request->status = S3StatusFailedToInitializeRequest;
+            request_finish(request);
+            return 0;
+        }
+    }
+
+    // Endpoint balancing decides which address the request connects to
+    if (context && (endpoint_assign(request) != S3StatusOK)) {
+        if (hedgeOf) {
+            request_release(request);
+            return 0;
+        }
+        request->status = S3StatusFailedToInitializeRequest;
+        request_finish(request);
+        return 0;
+    }
+
+    // A hedge races the request it duplicates; the GETs and HEADs of a
+    // hedging context are candidates to be hedged
+    if (hedgeOf) {
+        request->startMs = monotonic_ms();
+        request->isHedge = 1;
+        request->hedgePartner = hedgeOf;
+        hedgeOf->hedgePartner = request;
+    }
+    else if (context &&
+             (context->hedgeThresholdMs || context->hedgePercentile) &&
+             ((params->httpRequestType == HttpRequestTypeGET) ||
+              (params->httpRequestType == HttpRequestTypeHEAD))) {
+        request->startMs = monotonic_ms();
+        context->hedgeStats.hedgeableCount++;
+        // Without the memory for a copy of the parameters, the request just
+        // goes unhedged
+        if ((request->hedgeParams = queued_request_create(params))) {
+            request->hedgePrev = context->hedgeCandidatesTail;
+            if (context->hedgeCandidatesTail) {
+                context->hedgeCandidatesTail->hedgeNext = request;
+            }
+            else {
+                context->hedgeCandidatesHead = request;
+            }
+            context->hedgeCandidatesTail = request;
+        }
+    }
+
+    // Likewise, without a copy of the parameters the request is not retried,
+    // or for a GET of an object, resumed
+    if (context && context->retryPolicy.maxRetries) {
+        request->retryParams = queued_request_create(params);
+    }
+    if (context && context->maxResumes &&
+        (params->httpRequestType == HttpRequestTypeGET) && params->key &&
+        !params->subResource && params->fromS3Callback) {
+        request->resumeParams = queued_request_create(params);
+    }
+
+    if (context && context->bandwidth) {
+        request->bandwidth = bandwidth_limit_get
+            (context, params->bucketContext.bucketName, 0);
+    }
+
+    // The request's rate limit group is kept while it is in flight
+    if ((request->rateLimit = rate_limit_get(context, params))) {
+        request->rateLimit->inFlight++;
+    }
+
     // If a RequestContext was provided, add the request to the curl multi
     if (context) {
         CURLMcode code = curl_multi_add_handle(context->curlm, request->curl);
         if (code == CURLM_OK) {
+            context->inFlightCount++;
             if (context->requests) {
                 request->prev = context->requests->prev;
                 request->next = context->requests;
@@ -1577,14 +2612,27 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
             else {
                 context->requests = request->next = request->prev = request;
             }
-        }
-        else {
-            if (request->status == S3StatusOK) {
-                request->status = (code == CURLM_OUT_OF_MEMORY) ?
-                    S3StatusOutOfMemory : S3StatusInternalError;
+            // Attempts start in order and have the same limit, so the list
+            // stays in the order in which they fall due
+            if (context->timeouts.firstByteTimeoutMs) {
+                request->firstByteDueMs =
+                    monotonic_ms() + context->timeouts.firstByteTimeoutMs;
+                request->firstBytePrev = context->firstByteTail;
+                if (context->firstByteTail) {
+                    context->firstByteTail->firstByteNext = request;
+                }
+                else {
+                    context->firstByteHead = request;
+                }
+                context->firstByteTail = request;
             }
-            request_finish(request);
+            return request;
+        }
+        if (request->status == S3StatusOK) {
+            request->status = (code == CURLM_OUT_OF_MEMORY) ?
+                S3StatusOutOfMemory : S3StatusInternalError;
         }
+        request_finish(request);
     }
     // Else, perform the request immediately
     else {
@@ -1597,11 +2645,612 @@ void request_perform(const RequestParams *params, S3RequestContext *context)
         // also releases the request
         request_finish(request);
     }
+
+    return 0;
+}
+
+
+S3RequestHandle request_perform(const RequestParams *params,
+                                S3RequestContext *context)
+{
+    S3RequestHandle handle = 0;
+
+    // Handles are unique across all contexts, so that one which has been
+    // finished with can never be mistaken for a later request
+    if (context) {
+        handle = __sync_add_and_fetch(&nextRequestHandleG, 1);
+    }
+    lastRequestHandleG = handle;
+
+    // The deadline runs from now, however long the request then waits
+    int64_t deadlineMs = 0;
+    if (context && context->timeouts.deadlineMs) {
+        deadlineMs = monotonic_ms() + context->timeouts.deadlineMs;
+    }
+
+    request_start(params, context, handle, deadlineMs);
+
+    return handle;
+}
+
+
+// Adds a request to the context's list of delayed requests; delays differ, so
+// the list is kept in order of when they fall due
+static void delayed_insert(S3RequestContext *context, QueuedRequest *queued)
+{
+    QueuedRequest **link = &(context->delayedHead);
+    while (*link && ((*link)->dueMs <= queued->dueMs)) {
+        link = &((*link)->next);
+    }
+    queued->next = *link;
+    *link = queued;
+    context->delayedCount++;
+}
+
+
+void request_start(const RequestParams *params, S3RequestContext *context,
+                   S3RequestHandle handle, int64_t deadlineMs)
+{
+    // A threaded context's workers perform its requests
+    if (context && (context->engine == S3RequestContextEngineThreaded)) {
+        request_workers_submit(context, params, handle, deadlineMs);
+        return;
+    }
+
+    // A request whose rate limit group has used up its rate waits until its
+    // turn comes, and then joins the queue if need be
+    RateLimit *limit = rate_limit_get(context, params);
+    if (limit) {
+        int64_t now = monotonic_ms();
+        int64_t startMs = rate_limit_schedule(limit, now);
+        if (startMs > now) {
+            QueuedRequest *delayed = queued_request_create(params);
+            if (!delayed) {
+                request_complete(context, params->completeCallback,
+                                 params->callbackData, S3StatusOutOfMemory,
+                                 0, 0);
+                return;
+            }
+            delayed->handle = handle;
+            // One which would start too late times out when its deadline
+            // passes instead
+            delayed->dueMs = (deadlineMs && (startMs > deadlineMs)) ?
+                deadlineMs : startMs;
+            delayed->deadlineMs = deadlineMs;
+            delayed_insert(context, delayed);
+            // Nothing else would have an external event loop call back in
+            // time to start it
+            if (context->engine == S3RequestContextEngineExternal) {
+                request_context_update_timer(context);
+            }
+            return;
+        }
+    }
+
+    // Requests which the context has no room for yet, or which would
+    // otherwise overtake requests already waiting, join the queue
+    if (context && (context->queueHead ||
+                    (context->maxInFlight &&
+                     (context->inFlightCount >= context->maxInFlight)))) {
+        S3Status status = request_queue_push(context, params, handle,
+                                             deadlineMs);
+        if (status != S3StatusOK) {
+            request_complete(context, params->completeCallback,
+                             params->callbackData, status, 0, 0);
+        }
+        return;
+    }
+
+    perform_request(params, context, handle, deadlineMs, 0);
+}
+
+
+// Performs a queued request, which may be a retry, and frees it
+static void perform_queued(S3RequestContext *context, QueuedRequest *queued)
+{
+    Request *request = perform_request(&(queued->params), context,
+                                       queued->handle, queued->deadlineMs, 0);
+    if (request) {
+        request->retries = queued->retries;
+        request->retryDelayMs = queued->retryDelayMs;
+        request->resumes = queued->resumes;
+        request->resumeFrom = queued->params.startByte;
+    }
+    free(queued);
+}
+
+
+void request_admit_queued(S3RequestContext *context)
+{
+    while (context->queueHead &&
+           (!context->maxInFlight ||
+            (context->inFlightCount < context->maxInFlight))) {
+        perform_queued(context, request_queue_pop(context));
+    }
+}
+
+
+void request_unlink(S3RequestContext *context, Request *request)
+{
+    if (request->next == request) {
+        // It was the only one on the list
+        context->requests = 0;
+    }
+    else {
+        // It doesn't matter what the order of them are, so just in case
+        // request was at the head of the list, put the one after request to
+        // the head of the list
+        context->requests = request->next;
+        request->prev->next = request->next;
+        request->next->prev = request->prev;
+    }
+    context->inFlightCount--;
+}
+
+
+// Returns the number of milliseconds a GET or HEAD may wait for a response
+// before it is hedged, or -1 if it is never hedged
+static int hedge_threshold(S3RequestContext *context)
+{
+    if (context->hedgePercentile &&
+        (context->hedgeSampleCount >= HEDGE_MIN_SAMPLES)) {
+        // Always allow for a little scheduling noise
+        return (context->hedgePercentileMs > 0) ?
+            context->hedgePercentileMs : 1;
+    }
+
+    return context->hedgeThresholdMs ? context->hedgeThresholdMs : -1;
+}
+
+
+int request_hedge(S3RequestContext *context)
+{
+    int hedged = 0;
+
+    while (context->hedgeLosers) {
+        Request *loser = context->hedgeLosers;
+        context->hedgeLosers = loser->hedgeNext;
+        loser->hedgeNext = 0;
+        curl_multi_remove_handle(context->curlm, loser->curl);
+        request_unlink(context, loser);
+        request_release(loser);
+    }
+
+    int threshold = hedge_threshold(context);
+    if (threshold < 0) {
+        return 0;
+    }
+
+    int64_t now = monotonic_ms();
+
+    // Candidates all have the same threshold, so they fall due in order
+    Request *request;
+    while ((request = context->hedgeCandidatesHead) &&
+           ((now - request->startMs) >= threshold)) {
+        // The parameters must outlive the request's place on the list
+        QueuedRequest *params = request->hedgeParams;
+        request->hedgeParams = 0;
+        hedge_candidate_remove(request);
+        context->hedgeStats.hedgeCount++;
+        hedged = 1;
+        Request *hedge = perform_request(&(params->params), context,
+                                         request->handle, request->deadlineMs,
+                                         request);
+        if (hedge) {
+            hedge->retries = request->retries;
+            hedge->retryDelayMs = request->retryDelayMs;
+            hedge->resumes = request->resumes;
+            hedge->resumeFrom = request->resumeFrom;
+        }
+        free(params);
+    }
+
+    return hedged;
+}
+
+
+// Removes a cancelled request from the context and completes it; the one of a
+// hedged pair which goes first is released silently by request_finish
+static void cancel_request(S3RequestContext *context, Request *request)
+{
+    curl_multi_remove_handle(context->curlm, request->curl);
+    request_unlink(context, request);
+    request->status = S3StatusInterrupted;
+    request_finish(request);
+}
+
+
+int request_cancel(S3RequestContext *context, S3RequestHandle handle)
+{
+    Request *found[2];
+    int count = 0, i;
+
+    // It may be waiting to start, or to be retried
+    QueuedRequest *queued = request_queue_remove(context, handle);
+    if (!queued) {
+        QueuedRequest **link = &(context->delayedHead);
+        while (*link && ((*link)->handle != handle)) {
+            link = &((*link)->next);
+        }
+        if ((queued = *link)) {
+            *link = queued->next;
+            context->delayedCount--;
+        }
+    }
+    if (queued) {
+        request_complete(context, queued->params.completeCallback,
+                         queued->params.callbackData, S3StatusInterrupted,
+                         0, 0);
+        free(queued);
+        return 1;
+    }
+
+    // At most a request and its hedge have the handle; one which has lost
+    // to its hedge is already on its way out, and is left alone
+    Request *request = context->requests;
+    if (request) do {
+        if ((request->handle == handle) && !request->hedgeLost &&
+            !request->cancelled) {
+            found[count++] = request;
+        }
+        request = request->next;
+    } while ((count < 2) && (request != context->requests));
+
+    if (!count) {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        request = found[i];
+        if (request->hedgeParams) {
+            hedge_candidate_remove(request);
+        }
+        // From within a request callback, the request just stops making
+        // callbacks until it can be removed
+        if (context->performing) {
+            request->cancelled = 1;
+            request->status = S3StatusInterrupted;
+            request->cancelNext = context->cancelledRequests;
+            context->cancelledRequests = request;
+            continue;
+        }
+        cancel_request(context, request);
+    }
+
+    // Which may leave room for queued requests; any cancelled from within
+    // callbacks make room once they have been removed
+    if (!context->performing) {
+        request_admit_queued(context);
+    }
+
+    return 1;
+}
+
+
+int request_cancel_deferred(S3RequestContext *context)
+{
+    int finished = 0;
+
+    while (context->cancelledRequests) {
+        Request *request = context->cancelledRequests;
+        context->cancelledRequests = request->cancelNext;
+        request->cancelNext = 0;
+        cancel_request(context, request);
+        finished = 1;
+    }
+
+    if (finished) {
+        request_admit_queued(context);
+    }
+
+    return finished;
+}
+
+
+// Returns a random number in [low, high], from the context's generator
+// (xorshift64*, which is plenty for spreading out retries)
+static int retry_random(S3RequestContext *context, int low, int high)
+{
+    uint64_t x = context->retryRandom;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    context->retryRandom = x;
+
+    return low + (int) (((x * 0x2545F4914F6CDD1DULL) >> 33) %
+                        (uint64_t) (high - low + 1));
+}
+
+
+// If the request failed in a way which may succeed if tried again, and the
+// context's retry policy allows, queues the request's parameters to be tried
+// again after a delay, and returns nonzero
+static int retry_schedule(Request *request)
+{
+    S3RequestContext *context = request->context;
+    const S3RetryPolicy *policy = &(context->retryPolicy);
+    QueuedRequest *retry = request->retryParams;
+
+    if (!S3_status_is_retryable(request->status) &&
+        (request->status != S3StatusErrorSlowDown)) {
+        return 0;
+    }
+
+    // Once the application has been given a successful response, it is too
+    // late; an error response only ever went to the error parser
+    if ((request->retries >= policy->maxRetries) ||
+        ((request->httpResponseCode >= 200) &&
+         (request->httpResponseCode <= 299))) {
+        return 0;
+    }
+
+    if (policy->budgetTokens && (context->retryTokens < policy->retryCost)) {
+        return 0;
+    }
+
+    // Decorrelated jitter: somewhere between the base delay and three times
+    // the previous delay
+    int previous = request->retries ?
+        request->retryDelayMs : policy->baseDelayMs;
+    int high = (previous > (policy->maxDelayMs / 3)) ?
+        policy->maxDelayMs : (previous * 3);
+    int delayMs = retry_random(context, policy->baseDelayMs, high);
+    int64_t dueMs = monotonic_ms() + delayMs;
+
+    // A retry which could not start before the deadline would only time out
+    if (request->deadlineMs && (dueMs >= request->deadlineMs)) {
+        return 0;
+    }
+
+    // Data can only be sent again if the application can supply it again
+    if (retry->params.toS3Callback &&
+        (!retry->params.toS3CallbackRewindable || !policy->rewindCallback ||
+         (*(policy->rewindCallback))(request->callbackData))) {
+        return 0;
+    }
+
+    if (policy->budgetTokens) {
+        context->retryTokens -= policy->retryCost;
+    }
+
+    retry->retryDelayMs = delayMs;
+    retry->retries = request->retries + 1;
+    retry->resumes = request->resumes;
+    retry->dueMs = dueMs;
+    retry->handle = request->handle;
+    retry->deadlineMs = request->deadlineMs;
+    request->retryParams = 0;
+
+    // The retry takes its place in its rate limit group's schedule too
+    if (request->rateLimit) {
+        retry->dueMs = rate_limit_schedule(request->rateLimit, retry->dueMs);
+        if (retry->deadlineMs && (retry->dueMs > retry->deadlineMs)) {
+            retry->dueMs = retry->deadlineMs;
+        }
+    }
+
+    delayed_insert(context, retry);
+
+    return 1;
+}
+
+
+// If the request is a GET which stopped partway through its response, and
+// the context allows it to be resumed again, queues it to be made again for
+// the rest of the object, pinned to the same version of it by its ETag; and
+// returns nonzero
+static int resume_schedule(Request *request)
+{
+    S3RequestContext *context = request->context;
+    const S3ResponseProperties *properties =
+        &(request->responseHeadersHandler.responseProperties);
+
+    if ((request->httpResponseCode < 200) ||
+        (request->httpResponseCode > 299)) {
+        return 0;
+    }
+
+    switch (request->status) {
+    case S3StatusOK:
+        // libcurl lets a response which ends early because the connection
+        // closed pass as complete; for a GET which could be resumed, that is
+        // a failure unless it is
+        if (request->bytesReceived >= properties->contentLength) {
+            return 0;
+        }
+        request->status = S3StatusConnectionFailed;
+        break;
+    case S3StatusErrorRequestTimeout:
+    case S3StatusConnectionFailed:
+        break;
+    default:
+        // Not InternalError, which is as likely to be the library's own
+        // failure, or a callback's abort, as the transfer's
+        return 0;
+    }
+
+    if ((request->resumes >= context->maxResumes) || !properties->eTag ||
+        (request->deadlineMs && (monotonic_ms() >= request->deadlineMs))) {
+        return 0;
+    }
+
+    RequestParams params = request->resumeParams->params;
+    if (params.byteCount) {
+        if (params.byteCount <= request->bytesReceived) {
+            return 0;
+        }
+        params.byteCount -= request->bytesReceived;
+    }
+    params.startByte += request->bytesReceived;
+
+    S3GetConditions conditions;
+    if (params.getConditions) {
+        conditions = *(params.getConditions);
+    }
+    else {
+        conditions.ifModifiedSince = -1;
+        conditions.ifNotModifiedSince = -1;
+        conditions.ifNotMatchETag = 0;
+    }
+    conditions.ifMatchETag = properties->eTag;
+    params.getConditions = &conditions;
+
+    QueuedRequest *resume = queued_request_create(&params);
+    if (!resume) {
+        return 0;
+    }
+
+    // Made again as soon as the context next runs, as a retry with no delay
+    resume->handle = request->handle;
+    resume->deadlineMs = request->deadlineMs;
+    resume->retries = request->retries;
+    resume->retryDelayMs = request->retryDelayMs;
+    resume->resumes = request->resumes + 1;
+    resume->dueMs = monotonic_ms();
+    delayed_insert(context, resume);
+
+    return 1;
+}
+
+
+// Returns tokens to the context's retry budget for a request which has
+// completed without needing to be retried again
+static void retry_budget_refill(Request *request)
+{
+    S3RequestContext *context = request->context;
+    const S3RetryPolicy *policy = &(context->retryPolicy);
+
+    if (policy->budgetTokens && (request->status == S3StatusOK)) {
+        context->retryTokens += request->retries ? policy->retryCost : 1;
+        if (context->retryTokens > policy->budgetTokens) {
+            context->retryTokens = policy->budgetTokens;
+        }
+    }
+}
+
+
+int request_start_delayed(S3RequestContext *context)
+{
+    int retried = 0;
+    int64_t now = monotonic_ms();
+
+    while (context->delayedHead && (context->delayedHead->dueMs <= now)) {
+        QueuedRequest *retry = context->delayedHead;
+        context->delayedHead = retry->next;
+        context->delayedCount--;
+        retried = 1;
+        // A retry waits its turn behind the in-flight limit like any other
+        // request
+        if (context->queueHead ||
+            (context->maxInFlight &&
+             (context->inFlightCount >= context->maxInFlight))) {
+            request_queue_append(context, retry);
+        }
+        else {
+            perform_queued(context, retry);
+        }
+    }
+
+    return retried;
+}
+
+
+// Returns the number of milliseconds until request_hedge next needs to be
+// called, or -1 if there is no need
+static int64_t hedge_timeout(S3RequestContext *context)
+{
+    Request *request = context->hedgeCandidatesHead;
+    int threshold = hedge_threshold(context);
+
+    if (!request || (threshold < 0)) {
+        return -1;
+    }
+
+    int64_t untilDue = (request->startMs + threshold) - monotonic_ms();
+
+    return (untilDue < 0) ? 0 : untilDue;
+}
+
+
+int request_expire(S3RequestContext *context)
+{
+    int expired = 0;
+    int64_t now = monotonic_ms();
+
+    Request *request;
+    while ((request = context->firstByteHead) &&
+           (request->firstByteDueMs <= now)) {
+        first_byte_remove(request);
+        // One already on its way out is left to go
+        if (request->hedgeLost || request->cancelled) {
+            continue;
+        }
+        if (request->hedgeParams) {
+            hedge_candidate_remove(request);
+        }
+        curl_multi_remove_handle(context->curlm, request->curl);
+        request_unlink(context, request);
+        request->status = S3StatusErrorRequestTimeout;
+        request_finish(request);
+        expired = 1;
+    }
+
+    if (expired) {
+        request_admit_queued(context);
+    }
+
+    return expired;
+}
+
+
+int64_t request_timeout(S3RequestContext *context)
+{
+    // Requests which have lost to their hedges, or were cancelled from
+    // within curl callbacks, are to be removed straight away
+    if (context->hedgeLosers || context->cancelledRequests) {
+        return 0;
+    }
+
+    int64_t timeout = hedge_timeout(context), now = monotonic_ms();
+    int64_t untilResume = bandwidth_timeout(context);
+    int64_t dueMs[3] = {
+        context->delayedHead ? context->delayedHead->dueMs : -1,
+        context->firstByteHead ? context->firstByteHead->firstByteDueMs : -1,
+        (untilResume < 0) ? -1 : (now + untilResume)
+    };
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        if (dueMs[i] < 0) {
+            continue;
+        }
+        int64_t untilDue = (dueMs[i] < now) ? 0 : (dueMs[i] - now);
+        if ((timeout < 0) || (untilDue < timeout)) {
+            timeout = untilDue;
+        }
+    }
+
+    return timeout;
 }
 
 
 void request_finish(Request *request)
 {
+    // A request which has lost to its hedge has nothing left to report
+    if (request->hedgeLost) {
+        request_release(request);
+        return;
+    }
+
+    // Nor has one which failed to get a response while its partner may yet
+    // get one; the partner completes the request instead
+    if (request->hedgePartner) {
+        request->hedgePartner->hedgePartner = 0;
+        request->hedgePartner = 0;
+        request_release(request);
+        return;
+    }
+
     // If we haven't detected this already, we now know that the headers are
     // definitely done being read in
     request_headers_done(request);
@@ -1672,9 +3321,38 @@ void request_finish(Request *request)
         }
     }
 
-    (*(request->completeCallback))
-        (request->status, &(request->errorParser.s3ErrorDetails),
-         request->callbackData);
+    // A GET which stopped partway is resumed rather than completing
+    if (request->resumeParams && resume_schedule(request)) {
+        request_release(request);
+        return;
+    }
+
+    // SlowDown lowers the rate of the request's group, success raises it
+    if (request->rateLimit) {
+        rate_limit_update(request->context, request->rateLimit,
+                          request->status);
+    }
+
+    // A request which may yet succeed is tried again, if the context's retry
+    // policy allows, instead of completing
+    if (request->retryParams) {
+        if (retry_schedule(request)) {
+            request_release(request);
+            return;
+        }
+        retry_budget_refill(request);
+    }
+
+    // The properties are only those of a response which has actually been
+    // received (a request interrupted before it started may have a response
+    // code left over from a previous use of its handle)
+    request_complete(request->context, request->completeCallback,
+                     request->callbackData, request->status,
+                     &(request->errorParser.s3ErrorDetails),
+                     (request->httpResponseCode &&
+                      (request->status != S3StatusInterrupted)) ?
+                     &(request->responseHeadersHandler.responseProperties) :
+                     0);
 
     request_release(request);
 }
@@ -1690,6 +3368,8 @@ S3Status request_curl_code_to_status(CURLcode code)
         return S3StatusNameLookupError;
     case CURLE_COULDNT_CONNECT:
         return S3StatusFailedToConnect;
+    case CURLE_RECV_ERROR:
+        return S3StatusConnectionFailed;
     case CURLE_WRITE_ERROR:
     case CURLE_OPERATION_TIMEDOUT:
         return S3StatusErrorRequestTimeout;
@@ -1726,10 +3406,10 @@ S3Status S3_generate_authenticated_query_string
     RequestParams params =
     { http_request_method_to_type(httpMethod), *bucketContext, key, NULL,
         resource,
-        NULL, NULL, NULL, 0, 0, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0};
+        NULL, NULL, NULL, 0, 0, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0, 0};
 
     RequestComputedValues computed;
-    S3Status status = setup_request(&params, &computed, 1);
+    S3Status status = setup_request(&params, &computed, 1, 0);
     if (status != S3StatusOK) {
         return status;
     }
@@ -1748,7 +3428,249 @@ S3Status S3_generate_authenticated_query_string
              computed.authCredential, computed.requestDateISO8601, expires,
              computed.signedHeaders, computed.requestSignatureHex);
 
-    return compose_uri(buffer, S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE,
-                       bucketContext, computed.urlEncodedKey, resource,
-                       queryParams);
+    status = compose_uri(buffer, S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE,
+                         bucketContext, computed.urlEncodedKey, resource,
+                         queryParams);
+
+    arena_deinitialize(&(computed.arena));
+
+    return status;
+}
+
+
+// The keys whose URLs S3_generate_authenticated_query_strings signs
+// together, hashing their canonical requests and string to signs side by
+// side (see multihash.h)
+#define PRESIGN_GROUP_SIZE 64
+
+// What S3_generate_authenticated_query_strings keeps of each key of a
+// group while it is signed: where its URL is in the arena, its canonical
+// request, and its string to sign
+typedef struct PresignKey
+{
+    char *url;
+    int urlLen;
+
+    unsigned char *canonicalRequest;
+    uint64_t canonicalRequestLen;
+
+    unsigned char stringToSign[sizeof("AWS4-HMAC-SHA256\n") + 17 +
+                               SIGNATURE_SCOPE_SIZE +
+                               (2 * S3_SHA256_DIGEST_LENGTH)];
+} PresignKey;
+
+
+// Finishes the canonical requests of a group into signatures, and writes
+// them to the end of the URLs.  Each string to sign is stringToSign, up to
+// the hash of the canonical request, then that hash.
+static void presign_group(PresignKey *group, int count,
+                          const unsigned char *innerPad,
+                          const unsigned char *outerPad,
+                          const char *stringToSign, int stringToSignLen)
+{
+    const unsigned char *buffers[PRESIGN_GROUP_SIZE] = { 0 };
+    uint64_t lens[PRESIGN_GROUP_SIZE] = { 0 };
+    unsigned char digests[PRESIGN_GROUP_SIZE][S3_SHA256_DIGEST_LENGTH];
+    int i;
+
+    // The hash of each canonical request completes its string to sign
+    for (i = 0; i < count; i++) {
+        buffers[i] = group[i].canonicalRequest;
+        lens[i] = group[i].canonicalRequestLen;
+    }
+    multihash_sha256(count, buffers, lens, digests);
+
+    // HMAC(key, m) is H((key ^ opad) | H((key ^ ipad) | m)), the padded
+    // keys being a block each
+    for (i = 0; i < count; i++) {
+        memcpy(group[i].stringToSign, stringToSign, stringToSignLen);
+        hex_encode(digests[i], S3_SHA256_DIGEST_LENGTH,
+                   (char *) &(group[i].stringToSign[stringToSignLen]));
+        buffers[i] = group[i].stringToSign;
+        lens[i] = stringToSignLen + (2 * S3_SHA256_DIGEST_LENGTH);
+    }
+    multihash_sha256_prefixed(innerPad, count, buffers, lens, digests);
+
+    for (i = 0; i < count; i++) {
+        buffers[i] = digests[i];
+        lens[i] = S3_SHA256_DIGEST_LENGTH;
+    }
+    multihash_sha256_prefixed(outerPad, count, buffers, lens, digests);
+
+    for (i = 0; i < count; i++) {
+        hex_encode(digests[i], S3_SHA256_DIGEST_LENGTH,
+                   &(group[i].url[group[i].urlLen -
+                                  (2 * S3_SHA256_DIGEST_LENGTH)]));
+    }
+}
+
+
+S3Status S3_generate_authenticated_query_strings
+    (const S3BucketContext *bucketContext, int keyCount,
+     const char *const *keys, int expires, const char *resource,
+     const char *httpMethod, char *arena, int arenaSize, const char **urls,
+     int *urlCountReturn)
+{
+    *urlCountReturn = 0;
+
+    if (keyCount <= 0) {
+        return S3StatusOK;
+    }
+
+    if (expires < 0) {
+        expires = MAX_EXPIRES;
+    }
+    else if (expires > MAX_EXPIRES) {
+        expires = MAX_EXPIRES;
+    }
+
+    // Everything but the key is the same for every URL, so the request is
+    // set up once, for an empty key, and each key put into the result
+    RequestParams params =
+    { http_request_method_to_type(httpMethod), *bucketContext, "", NULL,
+        resource,
+        NULL, NULL, NULL, 0, 0, NULL, NULL, NULL, 0, NULL, NULL, NULL, 0, 0};
+
+    // The URL of a key is the URL for no key, the URL-encoded key, and the
+    // query string up to the signature
+    char urlPrefix[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
+    S3Status status = compose_uri(urlPrefix, sizeof(urlPrefix), bucketContext,
+                                  "", 0, 0);
+    if (status != S3StatusOK) {
+        return status;
+    }
+    int urlPrefixLen = strlen(urlPrefix);
+
+    RequestComputedValues computed;
+    if ((status = setup_request(&params, &computed, 1, 0)) != S3StatusOK) {
+        return status;
+    }
+
+    // The canonical request of a key is the canonical URI for no key, the
+    // URL-encoded key, and the rest
+    char canonicalPrefix[sizeof("DELETE\n") + MAX_CANONICALIZED_RESOURCE_SIZE];
+    int canonicalPrefixLen =
+        snprintf(canonicalPrefix, sizeof(canonicalPrefix), "%s\n%s",
+                 http_request_type_to_verb(params.httpRequestType),
+                 computed.canonicalURI);
+    char canonicalSuffix[strlen(computed.canonicalQueryString) +
+                         strlen(computed.canonicalizedSignatureHeaders) +
+                         strlen(computed.signedHeaders) +
+                         sizeof(computed.payloadHash) + 4];
+    int canonicalSuffixLen =
+        snprintf(canonicalSuffix, sizeof(canonicalSuffix), "\n%s\n%s\n%s\n%s",
+                 computed.canonicalQueryString,
+                 computed.canonicalizedSignatureHeaders,
+                 computed.signedHeaders, computed.payloadHash);
+    char urlSuffix[S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE];
+    int urlSuffixLen =
+        snprintf(urlSuffix, sizeof(urlSuffix),
+                 "%s%s%sX-Amz-Algorithm=AWS4-HMAC-SHA256"
+                 "&X-Amz-Credential=%s&X-Amz-Date=%s&X-Amz-Expires=%d"
+                 "&X-Amz-SignedHeaders=%s&X-Amz-Signature=",
+                 (resource && resource[0]) ? "?" : "",
+                 (resource && resource[0]) ? resource : "",
+                 (resource && resource[0]) ? "&" : "?",
+                 computed.authCredential, computed.requestDateISO8601,
+                 expires, computed.signedHeaders);
+    if (urlSuffixLen >= (int) sizeof(urlSuffix)) {
+        arena_deinitialize(&(computed.arena));
+        return S3StatusUriTooLong;
+    }
+
+    // The key of the HMAC padded, and the string to sign up to the hash of
+    // the canonical request
+    unsigned char innerPad[64], outerPad[64];
+    int i;
+    memset(innerPad, 0x36, 64);
+    memset(outerPad, 0x5c, 64);
+    for (i = 0; i < S3_SHA256_DIGEST_LENGTH; i++) {
+        innerPad[i] ^= computed.signingKey[i];
+        outerPad[i] ^= computed.signingKey[i];
+    }
+    char stringToSign[sizeof(((PresignKey *) 0)->stringToSign)];
+    int stringToSignLen =
+        snprintf(stringToSign, sizeof(stringToSign),
+                 "AWS4-HMAC-SHA256\n%s\n%s\n", computed.requestDateISO8601,
+                 computed.signatureScope);
+
+    // Which is all that is needed of the computed values
+    arena_deinitialize(&(computed.arena));
+
+    // Each key's canonical request is built in its own slot of the scratch
+    int slotSize =
+        canonicalPrefixLen + MAX_URLENCODED_KEY_SIZE + canonicalSuffixLen + 1;
+    int groupSize = (keyCount < PRESIGN_GROUP_SIZE) ?
+        keyCount : PRESIGN_GROUP_SIZE;
+    PresignKey *group = (PresignKey *) malloc
+        ((groupSize * sizeof(PresignKey)) + ((size_t) groupSize * slotSize));
+    if (!group) {
+        return S3StatusOutOfMemory;
+    }
+    unsigned char *slots = (unsigned char *) &(group[groupSize]);
+
+    int arenaUsed = 0, groupCount = 0;
+    for (i = 0; i < keyCount; i++) {
+        PresignKey *entry = &(group[groupCount]);
+        unsigned char *slot = &(slots[(size_t) groupCount * slotSize]);
+        char *encodedKey = (char *) &(slot[canonicalPrefixLen]);
+
+        if (!urlEncode(encodedKey, keys[i], S3_MAX_KEY_SIZE, 0)) {
+            status = S3StatusUriTooLong;
+            break;
+        }
+        int encodedKeyLen = strlen(encodedKey);
+
+        // The same limit as S3_generate_authenticated_query_string's
+        entry->urlLen = urlPrefixLen + encodedKeyLen + urlSuffixLen +
+            (2 * S3_SHA256_DIGEST_LENGTH);
+        if (entry->urlLen >= (int) S3_MAX_AUTHENTICATED_QUERY_STRING_SIZE) {
+            status = S3StatusUriTooLong;
+            break;
+        }
+        if ((arenaSize - arenaUsed) <= entry->urlLen) {
+            status = S3StatusBufferTooSmall;
+            break;
+        }
+
+        entry->url = &(arena[arenaUsed]);
+        memcpy(entry->url, urlPrefix, urlPrefixLen);
+        memcpy(&(entry->url[urlPrefixLen]), encodedKey, encodedKeyLen);
+        memcpy(&(entry->url[urlPrefixLen + encodedKeyLen]), urlSuffix,
+               urlSuffixLen);
+        entry->url[entry->urlLen] = 0;
+        arenaUsed += entry->urlLen + 1;
+        urls[i] = entry->url;
+
+        memcpy(slot, canonicalPrefix, canonicalPrefixLen);
+        memcpy(&(encodedKey[encodedKeyLen]), canonicalSuffix,
+               canonicalSuffixLen);
+        entry->canonicalRequest = slot;
+        entry->canonicalRequestLen =
+            canonicalPrefixLen + encodedKeyLen + canonicalSuffixLen;
+
+        if (++groupCount == groupSize) {
+            presign_group(group, groupCount, innerPad, outerPad,
+                          stringToSign, stringToSignLen);
+            *urlCountReturn += groupCount;
+            groupCount = 0;
+        }
+    }
+
+    // The keys before one which failed are still signed
+    if (groupCount) {
+        presign_group(group, groupCount, innerPad, outerPad, stringToSign,
+                      stringToSignLen);
+        *urlCountReturn += groupCount;
+    }
+
+    free(group);
+
+    return status;
+}
+
+
+S3RequestHandle S3_get_last_request_handle()
+{
+    return lastRequestHandleG;
 }
@@ -25,14 +25,166 @@
  ************************************************************************** **/
 
 #include <curl/curl.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/select.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <unistd.h>
+#endif
+#include "bandwidth.h"
+#include "endpoint.h"
+#include "rate_limit.h"
 #include "request.h"
 #include "request_context.h"
+#include "request_queue.h"
+#include "request_worker.h"
+
+// Maximum number of epoll events dispatched per epoll_wait() call
+#define EPOLL_EVENTS_PER_WAIT 256
+
+
+#ifdef __linux__
+
+
+// CURLMOPT_SOCKETFUNCTION: keeps the epoll instance in step with the set of
+// sockets, and the directions on them, that curl wants to be told about
+static int epoll_socket_func(CURL *easy, curl_socket_t s, int what,
+                             void *userp, void *socketp)
+{
+    S3RequestContext *context = (S3RequestContext *) userp;
+
+    (void) easy;
+
+    if (what == CURL_POLL_REMOVE) {
+        // The socket may already have been closed, in which case epoll has
+        // already forgotten about it, so ignore the result
+        epoll_ctl(context->epollFd, EPOLL_CTL_DEL, s, 0);
+        return 0;
+    }
+
+    struct epoll_event ev;
+    ev.events = (((what & CURL_POLL_IN) ? EPOLLIN : 0) |
+                 ((what & CURL_POLL_OUT) ? EPOLLOUT : 0));
+    ev.data.fd = s;
+
+    // socketp is set (via curl_multi_assign) once the socket is known to be
+    // registered with epoll
+    if (socketp) {
+        if (epoll_ctl(context->epollFd, EPOLL_CTL_MOD, s, &ev)) {
+            return -1;
+        }
+    }
+    else {
+        if (epoll_ctl(context->epollFd, EPOLL_CTL_ADD, s, &ev) &&
+            ((errno != EEXIST) ||
+             epoll_ctl(context->epollFd, EPOLL_CTL_MOD, s, &ev))) {
+            return -1;
+        }
+        curl_multi_assign(context->curlm, s, context);
+    }
+
+    return 0;
+}
+
+
+// CURLMOPT_TIMERFUNCTION: records when curl next wants a timeout action
+static int epoll_timer_func(CURLM *multi, long timeoutMs, void *userp)
+{
+    S3RequestContext *context = (S3RequestContext *) userp;
+
+    (void) multi;
+
+    context->timerDeadline = (timeoutMs < 0) ? -1 : (monotonic_ms() + timeoutMs);
+
+    return 0;
+}
+
+#endif /* __linux__ */
+
+
+// CURLMOPT_SOCKETFUNCTION for contexts driven by an external event loop:
+// passes curl's interest in the socket on to the caller
+static int external_socket_func(CURL *easy, curl_socket_t s, int what,
+                                void *userp, void *socketp)
+{
+    S3RequestContext *context = (S3RequestContext *) userp;
+
+    (void) easy;
+    (void) socketp;
+
+    int events = 0;
+    if ((what == CURL_POLL_IN) || (what == CURL_POLL_INOUT)) {
+        events |= S3_SOCKET_EVENT_READ;
+    }
+    if ((what == CURL_POLL_OUT) || (what == CURL_POLL_INOUT)) {
+        events |= S3_SOCKET_EVENT_WRITE;
+    }
+
+    (*(context->socketCallback))((int) s, events, context->eventCallbackData);
+
+    return 0;
+}
+
+
+// CURLMOPT_TIMERFUNCTION for contexts driven by an external event loop:
+// passes curl's timeout on to the caller, unless the context needs calling
+// sooner anyway
+static int external_timer_func(CURLM *multi, long timeoutMs, void *userp)
+{
+    S3RequestContext *context = (S3RequestContext *) userp;
+
+    (void) multi;
+
+    context->timerDeadline =
+        (timeoutMs < 0) ? -1 : (monotonic_ms() + timeoutMs);
+    request_context_update_timer(context);
+
+    return 0;
+}
+
+
+void request_context_update_timer(S3RequestContext *context)
+{
+    int64_t now = monotonic_ms(), deadline = context->timerDeadline;
+    int64_t untilRequest = request_timeout(context);
+
+    if ((untilRequest >= 0) &&
+        ((deadline < 0) || ((now + untilRequest) < deadline))) {
+        deadline = now + untilRequest;
+    }
+
+    if (deadline != context->reportedDeadline) {
+        context->reportedDeadline = deadline;
+        (*(context->timerCallback))
+            ((deadline < 0) ? -1 : (deadline < now) ? 0 : (deadline - now),
+             context->eventCallbackData);
+    }
+}
 
 
 S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
 {
+    return S3_create_request_context_with_engine
+        (requestContextReturn, S3RequestContextEngineSelect);
+}
+
+
+S3Status S3_create_request_context_with_engine
+    (S3RequestContext **requestContextReturn, S3RequestContextEngine engine)
+{
+#ifndef __linux__
+    if (engine == S3RequestContextEngineEpoll) {
+        return S3StatusNotSupported;
+    }
+#endif
+    if ((engine == S3RequestContextEngineExternal) ||
+        (engine == S3RequestContextEngineThreaded)) {
+        return S3StatusNotSupported;
+    }
+
     *requestContextReturn = 
         (S3RequestContext *) malloc(sizeof(S3RequestContext));
     
@@ -46,8 +198,150 @@ S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
     }
 
     (*requestContextReturn)->requests = 0;
+    (*requestContextReturn)->inFlightCount = 0;
+    (*requestContextReturn)->maxInFlight = 0;
+    (*requestContextReturn)->queueHead = 0;
+    (*requestContextReturn)->queueTail = 0;
+    (*requestContextReturn)->queuedCount = 0;
+    (*requestContextReturn)->http2 = 0;
     (*requestContextReturn)->verifyPeer = 0;
     (*requestContextReturn)->verifyPeerSet = 0;
+    (*requestContextReturn)->signPayloads = -1;
+    (*requestContextReturn)->engine = engine;
+    (*requestContextReturn)->epollFd = -1;
+    (*requestContextReturn)->timerDeadline = -1;
+    (*requestContextReturn)->runningCount = 0;
+    (*requestContextReturn)->socketCallback = 0;
+    (*requestContextReturn)->timerCallback = 0;
+    (*requestContextReturn)->eventCallbackData = 0;
+    (*requestContextReturn)->reportedDeadline = -1;
+    (*requestContextReturn)->workers = 0;
+    (*requestContextReturn)->workerCount = 0;
+    (*requestContextReturn)->nextWorker = 0;
+    (*requestContextReturn)->pendingCount = 0;
+    (*requestContextReturn)->maxHostConnections = 0;
+    (*requestContextReturn)->maxStreams = 0;
+    (*requestContextReturn)->configGeneration = 0;
+    (*requestContextReturn)->completionQueue = 0;
+    (*requestContextReturn)->completionsPosted = 0;
+    (*requestContextReturn)->completionsTaken = 0;
+    (*requestContextReturn)->hedgeThresholdMs = 0;
+    (*requestContextReturn)->hedgePercentile = 0;
+    (*requestContextReturn)->hedgeCandidatesHead = 0;
+    (*requestContextReturn)->hedgeCandidatesTail = 0;
+    (*requestContextReturn)->hedgeLosers = 0;
+    (*requestContextReturn)->performing = 0;
+    (*requestContextReturn)->cancelledRequests = 0;
+    memset(&((*requestContextReturn)->retryPolicy), 0,
+           sizeof((*requestContextReturn)->retryPolicy));
+    (*requestContextReturn)->retryTokens = 0;
+    (*requestContextReturn)->retryRandom =
+        ((uint64_t) monotonic_ms() << 16) ^ (uintptr_t) *requestContextReturn;
+    (*requestContextReturn)->delayedHead = 0;
+    (*requestContextReturn)->delayedCount = 0;
+    (*requestContextReturn)->rateLimiting = 0;
+    (*requestContextReturn)->rateLimitMin = 0;
+    (*requestContextReturn)->rateLimits = 0;
+    (*requestContextReturn)->rateLimitCount = 0;
+    memset(&((*requestContextReturn)->timeouts), 0,
+           sizeof((*requestContextReturn)->timeouts));
+    (*requestContextReturn)->maxResumes = 0;
+    (*requestContextReturn)->bandwidth = 0;
+    (*requestContextReturn)->bandwidthLimits = 0;
+    (*requestContextReturn)->pausedRequests = 0;
+    (*requestContextReturn)->endpointBalancing = S3EndpointBalancingNone;
+    (*requestContextReturn)->endpointRefreshMs = 0;
+    (*requestContextReturn)->endpoints = 0;
+    (*requestContextReturn)->endpointCount = 0;
+    (*requestContextReturn)->firstByteHead = 0;
+    (*requestContextReturn)->firstByteTail = 0;
+    (*requestContextReturn)->hedgeSampleCount = 0;
+    (*requestContextReturn)->hedgePercentileMs = 0;
+    memset(&((*requestContextReturn)->hedgeStats), 0,
+           sizeof((*requestContextReturn)->hedgeStats));
+
+#ifdef __linux__
+    if (engine == S3RequestContextEngineEpoll) {
+        S3RequestContext *context = *requestContextReturn;
+        if (((context->epollFd = epoll_create(EPOLL_EVENTS_PER_WAIT)) < 0) ||
+            curl_multi_setopt(context->curlm, CURLMOPT_SOCKETFUNCTION,
+                              &epoll_socket_func) ||
+            curl_multi_setopt(context->curlm, CURLMOPT_SOCKETDATA,
+                              context) ||
+            curl_multi_setopt(context->curlm, CURLMOPT_TIMERFUNCTION,
+                              &epoll_timer_func) ||
+            curl_multi_setopt(context->curlm, CURLMOPT_TIMERDATA,
+                              context)) {
+            if (context->epollFd >= 0) {
+                close(context->epollFd);
+            }
+            curl_multi_cleanup(context->curlm);
+            free(context);
+            return S3StatusInternalError;
+        }
+    }
+#endif
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_create_request_context_with_event_callbacks
+    (S3RequestContext **requestContextReturn,
+     S3RequestContextSocketCallback *socketCallback,
+     S3RequestContextTimerCallback *timerCallback, void *callbackData)
+{
+    S3Status status = S3_create_request_context_with_engine
+        (requestContextReturn, S3RequestContextEngineSelect);
+
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    S3RequestContext *context = *requestContextReturn;
+    context->engine = S3RequestContextEngineExternal;
+    context->socketCallback = socketCallback;
+    context->timerCallback = timerCallback;
+    context->eventCallbackData = callbackData;
+
+    if (curl_multi_setopt(context->curlm, CURLMOPT_SOCKETFUNCTION,
+                          &external_socket_func) ||
+        curl_multi_setopt(context->curlm, CURLMOPT_SOCKETDATA, context) ||
+        curl_multi_setopt(context->curlm, CURLMOPT_TIMERFUNCTION,
+                          &external_timer_func) ||
+        curl_multi_setopt(context->curlm, CURLMOPT_TIMERDATA, context)) {
+        curl_multi_cleanup(context->curlm);
+        free(context);
+        return S3StatusInternalError;
+    }
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_create_request_context_threaded
+    (S3RequestContext **requestContextReturn, int threadCount)
+{
+    S3Status status = S3_create_request_context_with_engine
+        (requestContextReturn, S3RequestContextEngineSelect);
+
+    if (status != S3StatusOK) {
+        return status;
+    }
+
+    S3RequestContext *context = *requestContextReturn;
+    context->engine = S3RequestContextEngineThreaded;
+    pthread_mutex_init(&(context->idleMutex), 0);
+    pthread_cond_init(&(context->idleCond), 0);
+
+    if ((status = request_workers_start
+         (context, (threadCount > 0) ? threadCount : 1)) != S3StatusOK) {
+        pthread_cond_destroy(&(context->idleCond));
+        pthread_mutex_destroy(&(context->idleMutex));
+        curl_multi_cleanup(context->curlm);
+        free(context);
+        return status;
+    }
 
     return S3StatusOK;
 }
@@ -55,6 +349,23 @@ S3Status S3_create_request_context(S3RequestContext **requestContextReturn)
 
 void S3_destroy_request_context(S3RequestContext *requestContext)
 {
+    // Requests interrupted from here on have their callbacks made directly,
+    // since there will be no completion queue to take them from
+    requestContext->completionQueue = 0;
+
+    // The requests of a threaded context all belong to its workers
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_stop(requestContext);
+        pthread_cond_destroy(&(requestContext->idleCond));
+        pthread_mutex_destroy(&(requestContext->idleMutex));
+    }
+
+    // Requests which lost to their hedges are among the requests below, and
+    // are released without callbacks like them; so are cancelled requests,
+    // which are interrupted like them
+    requestContext->hedgeLosers = 0;
+    requestContext->cancelledRequests = 0;
+
     // For each request in the context, remove curl handle, call back its done
     // method with 'interrupted' status
     Request *r = requestContext->requests, *rFirst = r;
@@ -68,15 +379,233 @@ void S3_destroy_request_context(S3RequestContext *requestContext)
         r = rNext;
     } while (r != rFirst);
 
+    // Requests still waiting to be admitted, or retried, are interrupted
+    // likewise
+    QueuedRequest *queued;
+    while ((queued = request_queue_pop(requestContext))) {
+        request_complete(requestContext, queued->params.completeCallback,
+                         queued->params.callbackData, S3StatusInterrupted,
+                         0, 0);
+        free(queued);
+    }
+    while ((queued = requestContext->delayedHead)) {
+        requestContext->delayedHead = queued->next;
+        request_complete(requestContext, queued->params.completeCallback,
+                         queued->params.callbackData, S3StatusInterrupted,
+                         0, 0);
+        free(queued);
+    }
+
+    // Completions which were never taken still have their callbacks made
+    S3Completion *completion;
+    while (S3_get_request_context_completions(requestContext, &completion,
+                                              1)) {
+        S3_release_completion(completion);
+    }
+
+    rate_limits_destroy(requestContext);
+    bandwidth_limits_destroy(requestContext);
+    endpoints_destroy(requestContext);
+
     curl_multi_cleanup(requestContext->curlm);
 
+#ifdef __linux__
+    if (requestContext->epollFd >= 0) {
+        close(requestContext->epollFd);
+    }
+#endif
+
     free(requestContext);
 }
 
 
+// Finishes every request that curl reports as done.  Returns nonzero in
+// *requestsFinishedReturn if any were, since their callbacks may have added
+// new requests to the context.
+static S3Status finish_done_requests(S3RequestContext *requestContext,
+                                     int *requestsFinishedReturn)
+{
+    CURLMsg *msg;
+    int junk;
+
+    // Cancelled requests must be gone before curl can report them done.
+    // Their callbacks, like those of finished requests, may add requests;
+    // and hedges and retries, like those, need starting straight away.
+    *requestsFinishedReturn = request_cancel_deferred(requestContext);
+    if (request_hedge(requestContext)) {
+        *requestsFinishedReturn = 1;
+    }
+    if (request_expire(requestContext)) {
+        *requestsFinishedReturn = 1;
+    }
+    if (request_start_delayed(requestContext)) {
+        *requestsFinishedReturn = 1;
+    }
+    if (request_bandwidth_resume(requestContext)) {
+        *requestsFinishedReturn = 1;
+    }
+
+    while ((msg = curl_multi_info_read(requestContext->curlm, &junk))) {
+        if (msg->msg != CURLMSG_DONE) {
+            return S3StatusInternalError;
+        }
+        Request *request;
+        if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, 
+                              (char **) (char *) &request) != CURLE_OK) {
+            return S3StatusInternalError;
+        }
+        // Remove the request from the list of requests
+        request_unlink(requestContext, request);
+        if ((msg->data.result != CURLE_OK) &&
+            (request->status == S3StatusOK)) {
+            request->status = request_curl_code_to_status
+                (msg->data.result);
+        }
+        if (curl_multi_remove_handle(requestContext->curlm, 
+                                     msg->easy_handle) != CURLM_OK) {
+            return S3StatusInternalError;
+        }
+        // Finish the request, ensuring that all callbacks have been made,
+        // and also releases the request
+        request_finish(request);
+        *requestsFinishedReturn = 1;
+        // Its place can now be taken by a queued request
+        request_admit_queued(requestContext);
+    }
+
+    return S3StatusOK;
+}
+
+
+static S3Status curlm_code_to_status(CURLMcode code)
+{
+    switch (code) {
+    case CURLM_OK:
+    case CURLM_CALL_MULTI_PERFORM:
+        return S3StatusOK;
+    case CURLM_OUT_OF_MEMORY:
+        return S3StatusOutOfMemory;
+    default:
+        return S3StatusInternalError;
+    }
+}
+
+
+// Hands an event on one socket (or, for CURL_SOCKET_TIMEOUT, the expiry of
+// curl's timer) to curl
+static S3Status socket_action(S3RequestContext *requestContext,
+                              curl_socket_t fd, int mask)
+{
+    requestContext->performing = 1;
+    CURLMcode code = curl_multi_socket_action(requestContext->curlm, fd, mask,
+                                              &(requestContext->runningCount));
+    requestContext->performing = 0;
+
+    return curlm_code_to_status(code);
+}
+
+
+#ifdef __linux__
+
+// Waits up to timeoutMs (-1 for no limit) for I/O on the context's sockets
+// or for curl's timer, and hands whatever is ready to curl, finishing any
+// requests which complete as a result
+static S3Status epoll_run(S3RequestContext *requestContext, int timeoutMs,
+                          int *requestsRemainingReturn)
+{
+    struct epoll_event events[EPOLL_EVENTS_PER_WAIT];
+    S3Status status;
+    int finished;
+
+    do {
+        // Never sleep past curl's timer, or the next hedge or retry
+        if (requestContext->timerDeadline >= 0) {
+            int64_t untilTimer = requestContext->timerDeadline - monotonic_ms();
+            if (untilTimer < 0) {
+                untilTimer = 0;
+            }
+            if ((timeoutMs < 0) || (untilTimer < timeoutMs)) {
+                timeoutMs = untilTimer;
+            }
+        }
+        int64_t untilRequest = request_timeout(requestContext);
+        if ((untilRequest >= 0) &&
+            ((timeoutMs < 0) || (untilRequest < timeoutMs))) {
+            timeoutMs = untilRequest;
+        }
+
+        int count = epoll_wait(requestContext->epollFd, events,
+                               EPOLL_EVENTS_PER_WAIT, timeoutMs);
+        if ((count < 0) && (errno != EINTR)) {
+            return S3StatusInternalError;
+        }
+
+        int i;
+        for (i = 0; i < count; i++) {
+            int mask = (((events[i].events & EPOLLIN) ? CURL_CSELECT_IN : 0) |
+                        ((events[i].events & EPOLLOUT) ? CURL_CSELECT_OUT : 0) |
+                        ((events[i].events & (EPOLLERR | EPOLLHUP)) ?
+                         CURL_CSELECT_ERR : 0));
+            if ((status = socket_action(requestContext, events[i].data.fd,
+                                        mask)) != S3StatusOK) {
+                return status;
+            }
+        }
+
+        if ((requestContext->timerDeadline >= 0) &&
+            (requestContext->timerDeadline <= monotonic_ms())) {
+            requestContext->timerDeadline = -1;
+            if ((status = socket_action(requestContext, CURL_SOCKET_TIMEOUT,
+                                        0)) != S3StatusOK) {
+                return status;
+            }
+        }
+
+        if ((status = finish_done_requests(requestContext, &finished))
+            != S3StatusOK) {
+            return status;
+        }
+
+        // Callbacks of finished requests may have queued up new requests,
+        // which curl wants started straight away (by asking for an immediate
+        // timeout); do so without waiting again
+        timeoutMs = 0;
+    } while (finished && (requestContext->timerDeadline >= 0) &&
+             (requestContext->timerDeadline <= monotonic_ms()));
+
+    *requestsRemainingReturn = requestContext->runningCount +
+        requestContext->queuedCount + requestContext->delayedCount;
+
+    return S3StatusOK;
+}
+
+#endif /* __linux__ */
+
+
 S3Status S3_runall_request_context(S3RequestContext *requestContext)
 {
     int requestsRemaining;
+
+    if (requestContext->engine == S3RequestContextEngineExternal) {
+        return S3StatusNotSupported;
+    }
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_wait(requestContext);
+        return S3StatusOK;
+    }
+
+#ifdef __linux__
+    if (requestContext->engine == S3RequestContextEngineEpoll) {
+        // Start any requests which have been added but not yet begun
+        S3Status status = epoll_run(requestContext, 0, &requestsRemaining);
+        while ((status == S3StatusOK) && requestsRemaining) {
+            status = epoll_run(requestContext, -1, &requestsRemaining);
+        }
+        return status;
+    }
+#endif
+
     do {
         fd_set readfds, writefds, exceptfds;
         FD_ZERO(&readfds);
@@ -91,8 +620,12 @@ S3Status S3_runall_request_context(S3RequestContext *requestContext)
         // curl will return -1 if it hasn't even created any fds yet because
         // none of the connections have started yet.  In this case, don't
         // do the select at all, because it will wait forever; instead, just
-        // skip it and go straight to running the underlying CURL handles
-        if (maxfd != -1) {
+        // skip it and go straight to running the underlying CURL handles.
+        // The exceptions are when only delayed requests remain, or only
+        // transfers paused for want of bandwidth, which must be waited for.
+        if ((maxfd != -1) ||
+            (!requestContext->requests && requestContext->delayedHead) ||
+            requestContext->pausedRequests) {
             int64_t timeout = S3_get_request_context_timeout(requestContext);
             struct timeval tv = { timeout / 1000, (timeout % 1000) * 1000 };
             select(maxfd + 1, &readfds, &writefds, &exceptfds,
@@ -112,63 +645,51 @@ S3Status S3_runall_request_context(S3RequestContext *requestContext)
 S3Status S3_runonce_request_context(S3RequestContext *requestContext, 
                                     int *requestsRemainingReturn)
 {
-    CURLMcode status;
+    if (requestContext->engine == S3RequestContextEngineExternal) {
+        return S3StatusNotSupported;
+    }
+
+    // The workers do the running; there is only progress to report
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        *requestsRemainingReturn =
+            __sync_fetch_and_add(&(requestContext->pendingCount), 0);
+        return S3StatusOK;
+    }
+
+#ifdef __linux__
+    if (requestContext->engine == S3RequestContextEngineEpoll) {
+        return epoll_run(requestContext, 0, requestsRemainingReturn);
+    }
+#endif
+
+    CURLMcode code;
+    S3Status status;
+    int finished;
 
     do {
-        status = curl_multi_perform(requestContext->curlm,
-                                    requestsRemainingReturn);
-
-        switch (status) {
-        case CURLM_OK:
-        case CURLM_CALL_MULTI_PERFORM:
-            break;
-        case CURLM_OUT_OF_MEMORY:
-            return S3StatusOutOfMemory;
-        default:
-            return S3StatusInternalError;
+        requestContext->performing = 1;
+        code = curl_multi_perform(requestContext->curlm,
+                                  requestsRemainingReturn);
+        requestContext->performing = 0;
+
+        if ((status = curlm_code_to_status(code)) != S3StatusOK) {
+            return status;
         }
 
-        CURLMsg *msg;
-        int junk;
-        while ((msg = curl_multi_info_read(requestContext->curlm, &junk))) {
-            if (msg->msg != CURLMSG_DONE) {
-                return S3StatusInternalError;
-            }
-            Request *request;
-            if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, 
-                                  (char **) (char *) &request) != CURLE_OK) {
-                return S3StatusInternalError;
-            }
-            // Remove the request from the list of requests
-            if (request->prev == request->next) {
-                // It was the only one on the list
-                requestContext->requests = 0;
-            }
-            else {
-                // It doesn't matter what the order of them are, so just in
-                // case request was at the head of the list, put the one after
-                // request to the head of the list
-                requestContext->requests = request->next;
-                request->prev->next = request->next;
-                request->next->prev = request->prev;
-            }
-            if ((msg->data.result != CURLE_OK) &&
-                (request->status == S3StatusOK)) {
-                request->status = request_curl_code_to_status
-                    (msg->data.result);
-            }
-            if (curl_multi_remove_handle(requestContext->curlm, 
-                                         msg->easy_handle) != CURLM_OK) {
-                return S3StatusInternalError;
-            }
-            // Finish the request, ensuring that all callbacks have been made,
-            // and also releases the request
-            request_finish(request);
-            // Now, since a callback was made, there may be new requests 
-            // queued up to be performed immediately, so do so
-            status = CURLM_CALL_MULTI_PERFORM;
+        if ((status = finish_done_requests(requestContext, &finished))
+            != S3StatusOK) {
+            return status;
+        }
+
+        // Now, since a callback was made, there may be new requests 
+        // queued up to be performed immediately, so do so
+        if (finished) {
+            code = CURLM_CALL_MULTI_PERFORM;
         }
-    } while (status == CURLM_CALL_MULTI_PERFORM);
+    } while (code == CURLM_CALL_MULTI_PERFORM);
+
+    *requestsRemainingReturn +=
+        requestContext->queuedCount + requestContext->delayedCount;
 
     return S3StatusOK;
 }
@@ -177,6 +698,21 @@ S3Status S3_get_request_context_fdsets(S3RequestContext *requestContext,
                                        fd_set *readFdSet, fd_set *writeFdSet,
                                        fd_set *exceptFdSet, int *maxFd)
 {
+    if ((requestContext->engine == S3RequestContextEngineExternal) ||
+        (requestContext->engine == S3RequestContextEngineThreaded)) {
+        return S3StatusNotSupported;
+    }
+
+#ifdef __linux__
+    // The epoll instance itself becomes readable when any socket it watches
+    // has I/O pending
+    if (requestContext->engine == S3RequestContextEngineEpoll) {
+        FD_SET(requestContext->epollFd, readFdSet);
+        *maxFd = requestContext->epollFd;
+        return S3StatusOK;
+    }
+#endif
+
     return ((curl_multi_fdset(requestContext->curlm, readFdSet, writeFdSet,
                               exceptFdSet, maxFd) == CURLM_OK) ?
             S3StatusOK : S3StatusInternalError);
@@ -186,9 +722,33 @@ int64_t S3_get_request_context_timeout(S3RequestContext *requestContext)
 {
     long timeout;
 
+    if ((requestContext->engine == S3RequestContextEngineExternal) ||
+        (requestContext->engine == S3RequestContextEngineThreaded)) {
+        return -1;
+    }
+
+#ifdef __linux__
+    if (requestContext->engine == S3RequestContextEngineEpoll) {
+        if (requestContext->timerDeadline < 0) {
+            timeout = -1;
+        }
+        else {
+            int64_t untilTimer =
+                requestContext->timerDeadline - monotonic_ms();
+            timeout = (untilTimer < 0) ? 0 : untilTimer;
+        }
+    }
+    else
+#endif
     if (curl_multi_timeout(requestContext->curlm, &timeout) != CURLM_OK) {
         timeout = 0;
     }
+
+    // Wake up in time to issue the next hedge or retry
+    int64_t untilRequest = request_timeout(requestContext);
+    if ((untilRequest >= 0) && ((timeout < 0) || (untilRequest < timeout))) {
+        timeout = untilRequest;
+    }
     
     return timeout;
 }
@@ -198,4 +758,475 @@ void S3_set_request_context_verify_peer(S3RequestContext *requestContext,
 {
     requestContext->verifyPeerSet = 1;
     requestContext->verifyPeer = (verifyPeer != 0);
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+    }
+}
+
+
+void S3_set_request_context_sign_payloads(S3RequestContext *requestContext,
+                                          int signPayloads)
+{
+    requestContext->signPayloads = (signPayloads != 0);
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+    }
+}
+
+
+void S3_set_request_context_completion_queue(S3RequestContext *requestContext,
+                                             int enable)
+{
+    requestContext->completionQueue = enable ? requestContext : 0;
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+    }
+}
+
+
+void S3_set_request_context_max_in_flight(S3RequestContext *requestContext,
+                                          int maxInFlight)
+{
+    requestContext->maxInFlight = (maxInFlight > 0) ? maxInFlight : 0;
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+        return;
+    }
+
+    // A higher limit may make room for queued requests straight away
+    request_admit_queued(requestContext);
+}
+
+
+S3Status S3_set_request_context_max_connections_per_host
+    (S3RequestContext *requestContext, int maxConnections)
+{
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        requestContext->maxHostConnections = maxConnections;
+        request_workers_configure(requestContext);
+        return S3StatusOK;
+    }
+
+    if (curl_multi_setopt(requestContext->curlm,
+                          CURLMOPT_MAX_HOST_CONNECTIONS,
+                          (long) ((maxConnections > 0) ? maxConnections : 0))
+        != CURLM_OK) {
+        return S3StatusNotSupported;
+    }
+
+    return S3StatusOK;
+}
+
+
+
+S3Status S3_set_request_context_http2(S3RequestContext *requestContext,
+                                      int enable, int maxStreams)
+{
+#if LIBCURL_VERSION_NUM >= 0x073100 /* 7.49.0 */
+    if (!(curl_version_info(CURLVERSION_NOW)->features &
+          CURL_VERSION_HTTP2)) {
+        return S3StatusNotSupported;
+    }
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        requestContext->http2 = (enable != 0);
+        requestContext->maxStreams = maxStreams;
+        request_workers_configure(requestContext);
+        return S3StatusOK;
+    }
+
+    if (curl_multi_setopt(requestContext->curlm, CURLMOPT_PIPELINING,
+                          enable ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING)
+        != CURLM_OK) {
+        return S3StatusInternalError;
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x074300 /* 7.67.0 */
+    // curl's default is 100, or whatever the server allows if less
+    if (curl_multi_setopt(requestContext->curlm,
+                          CURLMOPT_MAX_CONCURRENT_STREAMS,
+                          (long) ((maxStreams > 0) ? maxStreams : 100))
+        != CURLM_OK) {
+        return S3StatusInternalError;
+    }
+#else
+    (void) maxStreams;
+#endif
+
+    requestContext->http2 = (enable != 0);
+
+    return S3StatusOK;
+#else
+    (void) requestContext;
+    (void) enable;
+    (void) maxStreams;
+
+    return S3StatusNotSupported;
+#endif
+}
+
+
+S3Status S3_set_request_context_hedging(S3RequestContext *requestContext,
+                                        int thresholdMs, int percentile)
+{
+    requestContext->hedgeThresholdMs = (thresholdMs > 0) ? thresholdMs : 0;
+    requestContext->hedgePercentile =
+        (percentile > 99) ? 99 : (percentile > 0) ? percentile : 0;
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+    }
+
+    return S3StatusOK;
+}
+
+
+void S3_get_request_context_hedge_stats(S3RequestContext *requestContext,
+                                        S3HedgeStats *statsReturn)
+{
+    int i;
+
+    *statsReturn = requestContext->hedgeStats;
+
+    // The workers' counts are read while they may be changing, so the sums
+    // are only approximate while requests are in flight
+    for (i = 0; i < requestContext->workerCount; i++) {
+        const S3HedgeStats *stats =
+            &(requestContext->workers[i].context->hedgeStats);
+        statsReturn->hedgeableCount += stats->hedgeableCount;
+        statsReturn->hedgeCount += stats->hedgeCount;
+        statsReturn->hedgeWinCount += stats->hedgeWinCount;
+    }
+}
+
+
+S3Status S3_set_request_context_retry_policy(S3RequestContext *requestContext,
+                                             const S3RetryPolicy *policy)
+{
+    S3RetryPolicy *retryPolicy = &(requestContext->retryPolicy);
+
+    if (!policy || (policy->maxRetries <= 0)) {
+        memset(retryPolicy, 0, sizeof(*retryPolicy));
+    }
+    else {
+        *retryPolicy = *policy;
+        if (retryPolicy->baseDelayMs <= 0) {
+            retryPolicy->baseDelayMs = 100;
+        }
+        if (retryPolicy->maxDelayMs <= 0) {
+            retryPolicy->maxDelayMs = 20000;
+        }
+        if (retryPolicy->maxDelayMs < retryPolicy->baseDelayMs) {
+            retryPolicy->maxDelayMs = retryPolicy->baseDelayMs;
+        }
+        if (retryPolicy->budgetTokens < 0) {
+            retryPolicy->budgetTokens = 0;
+        }
+        if (retryPolicy->retryCost <= 0) {
+            retryPolicy->retryCost = 5;
+        }
+    }
+    requestContext->retryTokens = retryPolicy->budgetTokens;
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+    }
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_set_request_context_timeouts(S3RequestContext *requestContext,
+                                         const S3RequestTimeouts *timeouts)
+{
+    S3RequestTimeouts *contextTimeouts = &(requestContext->timeouts);
+
+    if (timeouts) {
+        *contextTimeouts = *timeouts;
+        if (contextTimeouts->connectTimeoutMs < 0) {
+            contextTimeouts->connectTimeoutMs = 0;
+        }
+        if (contextTimeouts->firstByteTimeoutMs < 0) {
+            contextTimeouts->firstByteTimeoutMs = 0;
+        }
+        if (contextTimeouts->stallTimeoutMs < 0) {
+            contextTimeouts->stallTimeoutMs = 0;
+        }
+        if (contextTimeouts->deadlineMs < 0) {
+            contextTimeouts->deadlineMs = 0;
+        }
+    }
+    else {
+        memset(contextTimeouts, 0, sizeof(*contextTimeouts));
+    }
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+    }
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_set_request_context_max_resumes(S3RequestContext *requestContext,
+                                            int maxResumes)
+{
+    requestContext->maxResumes = (maxResumes > 0) ? maxResumes : 0;
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+    }
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_set_request_context_bandwidth_limit
+    (S3RequestContext *requestContext, const char *bucketName,
+     int64_t downloadBytesPerSecond, int64_t uploadBytesPerSecond)
+{
+    // The workers of a threaded context would all have to share the buckets
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        return S3StatusNotSupported;
+    }
+
+    // The context as a whole is always measured once anything is
+    BandwidthLimit *all = bandwidth_limit_get(requestContext, 0, 1);
+    BandwidthLimit *limit = bucketName ?
+        bandwidth_limit_get(requestContext, bucketName, 1) : all;
+    if (!all || !limit) {
+        return S3StatusOutOfMemory;
+    }
+
+    bandwidth_set_rate(&(limit->download), downloadBytesPerSecond);
+    bandwidth_set_rate(&(limit->upload), uploadBytesPerSecond);
+
+    return S3StatusOK;
+}
+
+
+void S3_get_request_context_bandwidth(S3RequestContext *requestContext,
+                                      const char *bucketName,
+                                      S3Bandwidth *bandwidthReturn)
+{
+    BandwidthLimit *limit =
+        bandwidth_limit_get(requestContext, bucketName, 0);
+
+    memset(bandwidthReturn, 0, sizeof(*bandwidthReturn));
+
+    if (limit) {
+        bandwidthReturn->downloadLimit = limit->download.rate;
+        bandwidthReturn->uploadLimit = limit->upload.rate;
+        bandwidthReturn->downloadBytesPerSecond =
+            bandwidth_measured_rate(&(limit->download));
+        bandwidthReturn->uploadBytesPerSecond =
+            bandwidth_measured_rate(&(limit->upload));
+    }
+}
+
+
+S3Status S3_set_request_context_rate_limiting
+    (S3RequestContext *requestContext, int enable, double minRequestsPerSecond)
+{
+    // The workers of a threaded context would have to share the rates, which
+    // every request start and completion updates
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        return S3StatusNotSupported;
+    }
+
+    // A rate of zero would mean no limit at all
+    if (minRequestsPerSecond < 0.1) {
+        minRequestsPerSecond = 0.1;
+    }
+
+    requestContext->rateLimiting = enable;
+    requestContext->rateLimitMin = minRequestsPerSecond;
+
+    // Requests in flight keep their groups until they complete
+    if (!enable) {
+        RateLimit **link = &(requestContext->rateLimits);
+        while (*link) {
+            RateLimit *limit = *link;
+            if (limit->inFlight) {
+                limit->rate = 0;
+                link = &(limit->next);
+            }
+            else {
+                *link = limit->next;
+                requestContext->rateLimitCount--;
+                free(limit);
+            }
+        }
+    }
+
+    return S3StatusOK;
+}
+
+
+int S3_get_request_context_rate_limits(S3RequestContext *requestContext,
+                                       S3RateLimit *limitsReturn,
+                                       int maxLimits)
+{
+    RateLimit *limit;
+    int count = 0;
+
+    for (limit = requestContext->rateLimits; limit; limit = limit->next) {
+        if (!limit->rate) {
+            continue;
+        }
+        if (count < maxLimits) {
+            limitsReturn[count].bucketName = limit->bucketName;
+            limitsReturn[count].prefix = limit->prefix;
+            limitsReturn[count].requestsPerSecond = limit->rate;
+        }
+        count++;
+    }
+
+    return count;
+}
+
+
+S3Status S3_set_request_context_endpoint_balancing
+    (S3RequestContext *requestContext, S3EndpointBalancing balancing,
+     int refreshSeconds)
+{
+    if ((balancing != S3EndpointBalancingNone) &&
+        (balancing != S3EndpointBalancingRoundRobin) &&
+        (balancing != S3EndpointBalancingLeastLoaded)) {
+        return S3StatusNotSupported;
+    }
+
+    requestContext->endpointBalancing = balancing;
+    requestContext->endpointRefreshMs =
+        ((refreshSeconds > 0) ? refreshSeconds : 60) * 1000;
+
+    // Each worker of a threaded context balances its own requests
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        request_workers_configure(requestContext);
+    }
+
+    return S3StatusOK;
+}
+
+
+int S3_get_request_context_endpoints(S3RequestContext *requestContext,
+                                     S3EndpointAddress *addressesReturn,
+                                     int maxAddresses)
+{
+    Endpoint *endpoint;
+    EndpointAddress *address;
+    int count = 0;
+    int64_t now = monotonic_ms();
+
+    for (endpoint = requestContext->endpoints; endpoint;
+         endpoint = endpoint->next) {
+        for (address = endpoint->addresses; address;
+             address = address->next) {
+            if (address->stale) {
+                continue;
+            }
+            if (count < maxAddresses) {
+                S3EndpointAddress *a = &(addressesReturn[count]);
+                a->hostName = endpoint->name;
+                a->address = address->address;
+                a->inFlight = address->inFlight;
+                a->requestCount = address->requestCount;
+                a->ejected = (address->ejectedUntilMs > now);
+            }
+            count++;
+        }
+    }
+
+    return count;
+}
+
+
+S3Status S3_cancel_request(S3RequestContext *requestContext,
+                           S3RequestHandle handle)
+{
+    if (!handle) {
+        return S3StatusOK;
+    }
+
+    if (requestContext->engine == S3RequestContextEngineThreaded) {
+        return request_workers_cancel(requestContext, handle);
+    }
+
+    request_cancel(requestContext, handle);
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_process_request_context_socket(S3RequestContext *requestContext,
+                                           int fd, int events,
+                                           int *requestsRemainingReturn)
+{
+    S3Status status;
+    int finished;
+
+    if (requestContext->engine != S3RequestContextEngineExternal) {
+        return S3StatusNotSupported;
+    }
+
+    int mask = (((events & S3_SOCKET_EVENT_READ) ? CURL_CSELECT_IN : 0) |
+                ((events & S3_SOCKET_EVENT_WRITE) ? CURL_CSELECT_OUT : 0) |
+                ((events & S3_SOCKET_EVENT_ERROR) ? CURL_CSELECT_ERR : 0));
+
+    if (((status = socket_action(requestContext, (curl_socket_t) fd, mask))
+         != S3StatusOK) ||
+        ((status = finish_done_requests(requestContext, &finished))
+         != S3StatusOK)) {
+        return status;
+    }
+
+    // What was done may have brought the next hedge, retry or timeout forward
+    request_context_update_timer(requestContext);
+
+    // Not curl's count of running transfers, which still counts those which
+    // finish_done_requests has since removed, such as losers to hedges
+    *requestsRemainingReturn = requestContext->inFlightCount +
+        requestContext->queuedCount + requestContext->delayedCount;
+
+    return S3StatusOK;
+}
+
+
+S3Status S3_process_request_context_timeout(S3RequestContext *requestContext,
+                                            int *requestsRemainingReturn)
+{
+    S3Status status;
+    int finished;
+
+    if (requestContext->engine != S3RequestContextEngineExternal) {
+        return S3StatusNotSupported;
+    }
+
+    // The caller's timer has fired, and so is no longer set; and curl's
+    // timeout, if it is due, is acted on now
+    requestContext->reportedDeadline = -1;
+    if ((requestContext->timerDeadline >= 0) &&
+        (requestContext->timerDeadline <= monotonic_ms())) {
+        requestContext->timerDeadline = -1;
+    }
+
+    // The timeout may have been for curl, or for the hedges, retries, first
+    // byte timeouts and bandwidth resumes which finish_done_requests sees to
+    if (((status = socket_action(requestContext, CURL_SOCKET_TIMEOUT, 0))
+         != S3StatusOK) ||
+        ((status = finish_done_requests(requestContext, &finished))
+         != S3StatusOK)) {
+        return status;
+    }
+
+    request_context_update_timer(requestContext);
+
+    *requestsRemainingReturn = requestContext->inFlightCount +
+        requestContext->queuedCount + requestContext->delayedCount;
+
+    return S3StatusOK;
 }
@@ -0,0 +1,370 @@
+/** **************************************************************************
+ * request_pool.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "request_pool.h"
+
+// Number of idle Requests each thread keeps to itself
+#define THREAD_CACHE_SIZE 8
+
+// Default shared pool capacity is this many Requests per online CPU, but
+// never less than MIN_DEFAULT_CAPACITY
+#define CAPACITY_PER_CPU 16
+#define MIN_DEFAULT_CAPACITY 32
+
+// Index value terminating a slot stack
+#define SLOT_NIL 0xFFFFFFFFu
+
+
+// The shared pool is an array of slots, each of which is on exactly one of
+// two lock-free stacks: the stack of slots holding an idle Request, or the
+// stack of empty slots.  Stacks are linked by slot index rather than by
+// pointer so that the head can carry a modification count alongside the
+// index in a single 64 bit word, which defeats the ABA problem without
+// needing a double-width compare-and-swap.
+typedef struct Slot
+{
+    Request *request;
+
+    uint32_t next;
+} Slot;
+
+
+typedef struct ThreadCache
+{
+    // All thread caches are on a list so that they can be found by
+    // request_pool_deinitialize and S3_get_request_pool_stats
+    struct ThreadCache *prev, *next;
+
+    Request *requests[THREAD_CACHE_SIZE];
+
+    int count;
+
+    // Only ever written by the owning thread
+    S3RequestPoolStats stats;
+} ThreadCache;
+
+
+static int configuredCapacityG;
+
+static RequestPoolDestroyFunc *destroyFuncG;
+
+static Slot *slotsG;
+
+// Heads of the slot stacks: modification count in the upper 32 bits, slot
+// index in the lower 32 bits
+static volatile uint64_t fullStackG, emptyStackG;
+
+static pthread_key_t threadCacheKeyG;
+
+// Protects threadCachesG and retiredStatsG; these are only touched when a
+// thread first uses the pool, when it exits, and when stats are gathered
+static pthread_mutex_t threadCachesMutexG;
+
+static ThreadCache *threadCachesG;
+
+// Stats of threads that have exited
+static S3RequestPoolStats retiredStatsG;
+
+
+static void stack_push(volatile uint64_t *stack, uint32_t index)
+{
+    uint64_t old, new;
+
+    do {
+        old = *stack;
+        slotsG[index].next = (uint32_t) old;
+        new = ((((old >> 32) + 1) << 32) | index);
+    } while (!__sync_bool_compare_and_swap(stack, old, new));
+}
+
+
+static uint32_t stack_pop(volatile uint64_t *stack)
+{
+    uint64_t old, new;
+    uint32_t index;
+
+    do {
+        old = *stack;
+        index = (uint32_t) old;
+        if (index == SLOT_NIL) {
+            return SLOT_NIL;
+        }
+        new = ((((old >> 32) + 1) << 32) | slotsG[index].next);
+    } while (!__sync_bool_compare_and_swap(stack, old, new));
+
+    return index;
+}
+
+
+static Request *shared_get()
+{
+    uint32_t index = stack_pop(&fullStackG);
+
+    if (index == SLOT_NIL) {
+        return 0;
+    }
+
+    Request *request = slotsG[index].request;
+    stack_push(&emptyStackG, index);
+    return request;
+}
+
+
+static int shared_put(Request *request)
+{
+    uint32_t index = stack_pop(&emptyStackG);
+
+    if (index == SLOT_NIL) {
+        return 0;
+    }
+
+    slotsG[index].request = request;
+    stack_push(&fullStackG, index);
+    return 1;
+}
+
+
+static void add_stats(S3RequestPoolStats *to, const S3RequestPoolStats *from)
+{
+    to->threadCacheHits += from->threadCacheHits;
+    to->sharedPoolHits += from->sharedPoolHits;
+    to->misses += from->misses;
+    to->discards += from->discards;
+}
+
+
+// pthread key destructor; hands the exiting thread's idle Requests over to
+// the shared pool
+static void thread_cache_destroy(void *data)
+{
+    ThreadCache *cache = (ThreadCache *) data;
+
+    while (cache->count) {
+        Request *request = cache->requests[--cache->count];
+        if (!shared_put(request)) {
+            cache->stats.discards++;
+            (*destroyFuncG)(request);
+        }
+    }
+
+    pthread_mutex_lock(&threadCachesMutexG);
+    if (cache->next == cache) {
+        threadCachesG = 0;
+    }
+    else {
+        cache->prev->next = cache->next;
+        cache->next->prev = cache->prev;
+        if (threadCachesG == cache) {
+            threadCachesG = cache->next;
+        }
+    }
+    add_stats(&retiredStatsG, &(cache->stats));
+    pthread_mutex_unlock(&threadCachesMutexG);
+
+    free(cache);
+}
+
+
+// Returns the calling thread's cache, creating it if necessary; returns 0
+// only if it could not be allocated, in which case only the shared pool is
+// used
+static ThreadCache *thread_cache_get()
+{
+    ThreadCache *cache =
+        (ThreadCache *) pthread_getspecific(threadCacheKeyG);
+
+    if (cache) {
+        return cache;
+    }
+
+    if (!(cache = (ThreadCache *) calloc(1, sizeof(ThreadCache)))) {
+        return 0;
+    }
+
+    if (pthread_setspecific(threadCacheKeyG, cache)) {
+        free(cache);
+        return 0;
+    }
+
+    pthread_mutex_lock(&threadCachesMutexG);
+    if (threadCachesG) {
+        cache->prev = threadCachesG->prev;
+        cache->next = threadCachesG;
+        threadCachesG->prev->next = cache;
+        threadCachesG->prev = cache;
+    }
+    else {
+        threadCachesG = cache->prev = cache->next = cache;
+    }
+    pthread_mutex_unlock(&threadCachesMutexG);
+
+    return cache;
+}
+
+
+S3Status request_pool_initialize(RequestPoolDestroyFunc *destroyFunc)
+{
+    int capacity = configuredCapacityG;
+
+    if (!capacity) {
+        long cpus = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+        if ((cpus = sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+            cpus = 1;
+        }
+#endif
+        capacity = CAPACITY_PER_CPU * cpus;
+        if (capacity < MIN_DEFAULT_CAPACITY) {
+            capacity = MIN_DEFAULT_CAPACITY;
+        }
+    }
+
+    if (!(slotsG = (Slot *) malloc(capacity * sizeof(Slot)))) {
+        return S3StatusOutOfMemory;
+    }
+
+    if (pthread_key_create(&threadCacheKeyG, &thread_cache_destroy)) {
+        free(slotsG);
+        return S3StatusInternalError;
+    }
+
+    pthread_mutex_init(&threadCachesMutexG, 0);
+
+    destroyFuncG = destroyFunc;
+    threadCachesG = 0;
+    memset(&retiredStatsG, 0, sizeof(retiredStatsG));
+
+    fullStackG = SLOT_NIL;
+    emptyStackG = SLOT_NIL;
+    int i;
+    for (i = 0; i < capacity; i++) {
+        stack_push(&emptyStackG, i);
+    }
+
+    return S3StatusOK;
+}
+
+
+void request_pool_deinitialize()
+{
+    // Deleting the key first ensures that no thread cache destructor can run
+    // concurrently with, or after, the cleanup below
+    pthread_key_delete(threadCacheKeyG);
+
+    while (threadCachesG) {
+        ThreadCache *cache = threadCachesG;
+        if (cache->next == cache) {
+            threadCachesG = 0;
+        }
+        else {
+            cache->prev->next = cache->next;
+            cache->next->prev = cache->prev;
+            threadCachesG = cache->next;
+        }
+        while (cache->count) {
+            (*destroyFuncG)(cache->requests[--cache->count]);
+        }
+        free(cache);
+    }
+
+    Request *request;
+    while ((request = shared_get())) {
+        (*destroyFuncG)(request);
+    }
+
+    pthread_mutex_destroy(&threadCachesMutexG);
+
+    free(slotsG);
+    slotsG = 0;
+}
+
+
+Request *request_pool_get()
+{
+    ThreadCache *cache = thread_cache_get();
+
+    if (cache && cache->count) {
+        cache->stats.threadCacheHits++;
+        return cache->requests[--cache->count];
+    }
+
+    Request *request = shared_get();
+
+    if (cache) {
+        if (request) {
+            cache->stats.sharedPoolHits++;
+        }
+        else {
+            cache->stats.misses++;
+        }
+    }
+
+    return request;
+}
+
+
+void request_pool_put(Request *request)
+{
+    ThreadCache *cache = thread_cache_get();
+
+    if (cache && (cache->count < THREAD_CACHE_SIZE)) {
+        cache->requests[cache->count++] = request;
+        return;
+    }
+
+    if (!shared_put(request)) {
+        if (cache) {
+            cache->stats.discards++;
+        }
+        (*destroyFuncG)(request);
+    }
+}
+
+
+void S3_set_request_pool_capacity(int capacity)
+{
+    configuredCapacityG = (capacity > 0) ? capacity : 0;
+}
+
+
+void S3_get_request_pool_stats(S3RequestPoolStats *statsReturn)
+{
+    pthread_mutex_lock(&threadCachesMutexG);
+
+    *statsReturn = retiredStatsG;
+
+    ThreadCache *cache = threadCachesG;
+    if (cache) do {
+        add_stats(statsReturn, &(cache->stats));
+        cache = cache->next;
+    } while (cache != threadCachesG);
+
+    pthread_mutex_unlock(&threadCachesMutexG);
+}
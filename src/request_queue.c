@@ -0,0 +1,443 @@
+/** **************************************************************************
+ * request_queue.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "request.h"
+#include "request_context.h"
+#include "request_queue.h"
+
+
+// Returns the next amount bytes at *cursor, advancing *cursor past them, and
+// adds amount to *size.  With a null *cursor, only counts.
+static void *reserve(char **cursor, size_t *size, size_t amount)
+{
+    *size += amount;
+
+    if (!*cursor) {
+        return 0;
+    }
+
+    void *ret = *cursor;
+    *cursor += amount;
+    return ret;
+}
+
+
+static const char *copy_string(char **cursor, size_t *size, const char *str)
+{
+    if (!str) {
+        return 0;
+    }
+
+    size_t len = strlen(str) + 1;
+    char *ret = (char *) reserve(cursor, size, len);
+    if (ret) {
+        memcpy(ret, str, len);
+    }
+    return ret;
+}
+
+
+// Copies from into to, and everything that from points to into the memory at
+// *cursor, adding the amount of memory used to *size.  With a null *cursor,
+// only counts the memory needed.  Structures are placed before strings so
+// that they are suitably aligned.
+static void copy_params(RequestParams *to, const RequestParams *from,
+                        char **cursor, size_t *size)
+{
+    S3GetConditions *getConditions = 0;
+    S3PutProperties *putProperties = 0;
+    S3NameValue *metaData = 0;
+    int i;
+
+    *to = *from;
+
+    if (from->getConditions) {
+        getConditions = (S3GetConditions *)
+            reserve(cursor, size, sizeof(S3GetConditions));
+    }
+    if (from->putProperties) {
+        putProperties = (S3PutProperties *)
+            reserve(cursor, size, sizeof(S3PutProperties));
+        if (from->putProperties->metaDataCount > 0) {
+            metaData = (S3NameValue *)
+                reserve(cursor, size, (from->putProperties->metaDataCount *
+                                       sizeof(S3NameValue)));
+        }
+    }
+
+#define copy_field(field)                                               \
+    to->field = copy_string(cursor, size, from->field)
+
+    copy_field(bucketContext.hostName);
+    copy_field(bucketContext.bucketName);
+    copy_field(bucketContext.accessKeyId);
+    copy_field(bucketContext.secretAccessKey);
+    copy_field(bucketContext.securityToken);
+    copy_field(bucketContext.authRegion);
+    copy_field(key);
+    copy_field(queryParams);
+    copy_field(subResource);
+    copy_field(copySourceBucketName);
+    copy_field(copySourceKey);
+
+    if (from->getConditions) {
+        const S3GetConditions *gc = from->getConditions;
+        const char *ifMatchETag = copy_string(cursor, size, gc->ifMatchETag);
+        const char *ifNotMatchETag =
+            copy_string(cursor, size, gc->ifNotMatchETag);
+        if (getConditions) {
+            *getConditions = *gc;
+            getConditions->ifMatchETag = ifMatchETag;
+            getConditions->ifNotMatchETag = ifNotMatchETag;
+        }
+        to->getConditions = getConditions;
+    }
+
+    if (from->putProperties) {
+        const S3PutProperties *pp = from->putProperties;
+        const char *contentType = copy_string(cursor, size, pp->contentType);
+        const char *md5 = copy_string(cursor, size, pp->md5);
+        const char *cacheControl =
+            copy_string(cursor, size, pp->cacheControl);
+        const char *contentDispositionFilename =
+            copy_string(cursor, size, pp->contentDispositionFilename);
+        const char *contentEncoding =
+            copy_string(cursor, size, pp->contentEncoding);
+        for (i = 0; i < pp->metaDataCount; i++) {
+            const char *name = copy_string(cursor, size, pp->metaData[i].name);
+            const char *value =
+                copy_string(cursor, size, pp->metaData[i].value);
+            if (metaData) {
+                metaData[i].name = name;
+                metaData[i].value = value;
+            }
+        }
+        if (putProperties) {
+            *putProperties = *pp;
+            putProperties->contentType = contentType;
+            putProperties->md5 = md5;
+            putProperties->cacheControl = cacheControl;
+            putProperties->contentDispositionFilename =
+                contentDispositionFilename;
+            putProperties->contentEncoding = contentEncoding;
+            putProperties->metaData = metaData;
+        }
+        to->putProperties = putProperties;
+    }
+}
+
+
+QueuedRequest *queued_request_create(const RequestParams *params)
+{
+    RequestParams counted;
+    char *cursor = 0;
+    size_t size = 0;
+
+    copy_params(&counted, params, &cursor, &size);
+
+    QueuedRequest *queued =
+        (QueuedRequest *) malloc(sizeof(QueuedRequest) + size);
+    if (!queued) {
+        return 0;
+    }
+
+    cursor = (char *) &(queued[1]);
+    size = 0;
+    copy_params(&(queued->params), params, &cursor, &size);
+    queued->next = 0;
+    queued->handle = 0;
+    queued->dueMs = 0;
+    queued->retries = 0;
+    queued->retryDelayMs = 0;
+    queued->resumes = 0;
+    queued->deadlineMs = 0;
+
+    return queued;
+}
+
+
+S3Status request_queue_push(S3RequestContext *context,
+                            const RequestParams *params,
+                            S3RequestHandle handle, int64_t deadlineMs)
+{
+    QueuedRequest *queued = queued_request_create(params);
+
+    if (!queued) {
+        return S3StatusOutOfMemory;
+    }
+
+    queued->handle = handle;
+    queued->deadlineMs = deadlineMs;
+    request_queue_append(context, queued);
+
+    return S3StatusOK;
+}
+
+
+void request_queue_append(S3RequestContext *context, QueuedRequest *queued)
+{
+    queued->next = 0;
+
+    if (context->queueTail) {
+        context->queueTail->next = queued;
+    }
+    else {
+        context->queueHead = queued;
+    }
+    context->queueTail = queued;
+    context->queuedCount++;
+}
+
+
+QueuedRequest *request_queue_pop(S3RequestContext *context)
+{
+    QueuedRequest *queued = context->queueHead;
+
+    if (queued) {
+        if (!(context->queueHead = queued->next)) {
+            context->queueTail = 0;
+        }
+        context->queuedCount--;
+    }
+
+    return queued;
+}
+
+
+QueuedRequest *request_queue_remove(S3RequestContext *context,
+                                    S3RequestHandle handle)
+{
+    QueuedRequest *queued = context->queueHead, *prev = 0;
+
+    while (queued && (queued->handle != handle)) {
+        prev = queued;
+        queued = queued->next;
+    }
+
+    if (queued) {
+        if (prev) {
+            prev->next = queued->next;
+        }
+        else {
+            context->queueHead = queued->next;
+        }
+        if (context->queueTail == queued) {
+            context->queueTail = prev;
+        }
+        context->queuedCount--;
+    }
+
+    return queued;
+}
+
+
+// Copies error and properties (either of which may be 0) into the memory at
+// *cursor, as for copy_params, setting *errorReturn and *propertiesReturn to
+// the copies
+static void copy_results(const S3ErrorDetails *error,
+                         const S3ResponseProperties *properties,
+                         const S3ErrorDetails **errorReturn,
+                         const S3ResponseProperties **propertiesReturn,
+                         char **cursor, size_t *size)
+{
+    S3ResponseProperties *toProperties = 0;
+    S3ErrorDetails *toError = 0;
+    S3NameValue *metaData = 0, *extraDetails = 0;
+    int i;
+
+    if (properties) {
+        toProperties = (S3ResponseProperties *)
+            reserve(cursor, size, sizeof(S3ResponseProperties));
+        if (properties->metaDataCount > 0) {
+            metaData = (S3NameValue *)
+                reserve(cursor, size, (properties->metaDataCount *
+                                       sizeof(S3NameValue)));
+        }
+    }
+    if (error) {
+        toError = (S3ErrorDetails *)
+            reserve(cursor, size, sizeof(S3ErrorDetails));
+        if (error->extraDetailsCount > 0) {
+            extraDetails = (S3NameValue *)
+                reserve(cursor, size, (error->extraDetailsCount *
+                                       sizeof(S3NameValue)));
+        }
+    }
+
+    if (properties) {
+        const char *requestId = copy_string(cursor, size,
+                                            properties->requestId);
+        const char *requestId2 = copy_string(cursor, size,
+                                             properties->requestId2);
+        const char *contentType = copy_string(cursor, size,
+                                              properties->contentType);
+        const char *server = copy_string(cursor, size, properties->server);
+        const char *eTag = copy_string(cursor, size, properties->eTag);
+        for (i = 0; i < properties->metaDataCount; i++) {
+            const char *name =
+                copy_string(cursor, size, properties->metaData[i].name);
+            const char *value =
+                copy_string(cursor, size, properties->metaData[i].value);
+            if (metaData) {
+                metaData[i].name = name;
+                metaData[i].value = value;
+            }
+        }
+        if (toProperties) {
+            *toProperties = *properties;
+            toProperties->requestId = requestId;
+            toProperties->requestId2 = requestId2;
+            toProperties->contentType = contentType;
+            toProperties->server = server;
+            toProperties->eTag = eTag;
+            toProperties->metaData = metaData;
+        }
+    }
+
+    if (error) {
+        const char *message = copy_string(cursor, size, error->message);
+        const char *resource = copy_string(cursor, size, error->resource);
+        const char *furtherDetails =
+            copy_string(cursor, size, error->furtherDetails);
+        for (i = 0; i < error->extraDetailsCount; i++) {
+            const char *name =
+                copy_string(cursor, size, error->extraDetails[i].name);
+            const char *value =
+                copy_string(cursor, size, error->extraDetails[i].value);
+            if (extraDetails) {
+                extraDetails[i].name = name;
+                extraDetails[i].value = value;
+            }
+        }
+        if (toError) {
+            *toError = *error;
+            toError->message = message;
+            toError->resource = resource;
+            toError->furtherDetails = furtherDetails;
+            toError->extraDetails = extraDetails;
+        }
+    }
+
+    *errorReturn = toError;
+    *propertiesReturn = toProperties;
+}
+
+
+void request_complete(S3RequestContext *context,
+                      S3ResponseCompleteCallback *completeCallback,
+                      void *callbackData, S3Status status,
+                      const S3ErrorDetails *error,
+                      const S3ResponseProperties *properties)
+{
+    S3RequestContext *queue = context ? context->completionQueue : 0;
+
+    if (queue) {
+        const S3ErrorDetails *junkError;
+        const S3ResponseProperties *junkProperties;
+        char *cursor = 0;
+        size_t size = 0;
+
+        copy_results(error, properties, &junkError, &junkProperties, &cursor,
+                     &size);
+
+        RequestCompletion *completion =
+            (RequestCompletion *) malloc(sizeof(RequestCompletion) + size);
+
+        // Without the memory to post a completion, the callback will have to
+        // do
+        if (completion) {
+            cursor = (char *) &(completion[1]);
+            size = 0;
+            copy_results(error, properties, &(completion->completion.error),
+                         &(completion->completion.properties), &cursor,
+                         &size);
+            completion->completion.callbackData = callbackData;
+            completion->completion.status = status;
+            completion->completeCallback = completeCallback;
+
+            RequestCompletion *head;
+            do {
+                head = queue->completionsPosted;
+                completion->next = head;
+            } while (!__sync_bool_compare_and_swap
+                     (&(queue->completionsPosted), head, completion));
+            return;
+        }
+    }
+
+    if (completeCallback) {
+        (*completeCallback)(status, error, callbackData);
+    }
+}
+
+
+int S3_get_request_context_completions(S3RequestContext *requestContext,
+                                       S3Completion **completionsReturn,
+                                       int maxCompletions)
+{
+    int count = 0;
+
+    while (count < maxCompletions) {
+        if (!requestContext->completionsTaken) {
+            RequestCompletion *posted;
+            do {
+                posted = requestContext->completionsPosted;
+            } while (!__sync_bool_compare_and_swap
+                     (&(requestContext->completionsPosted), posted, 0));
+            if (!posted) {
+                break;
+            }
+            // They were posted most recent first
+            while (posted) {
+                RequestCompletion *next = posted->next;
+                posted->next = requestContext->completionsTaken;
+                requestContext->completionsTaken = posted;
+                posted = next;
+            }
+        }
+        RequestCompletion *completion = requestContext->completionsTaken;
+        requestContext->completionsTaken = completion->next;
+        completionsReturn[count++] = &(completion->completion);
+    }
+
+    return count;
+}
+
+
+void S3_release_completion(S3Completion *completion)
+{
+    RequestCompletion *requestCompletion = (RequestCompletion *) completion;
+
+    if (requestCompletion->completeCallback) {
+        (*(requestCompletion->completeCallback))
+            (completion->status, completion->error, completion->callbackData);
+    }
+
+    free(requestCompletion);
+}
@@ -0,0 +1,393 @@
+/** **************************************************************************
+ * request_worker.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+
+#include <curl/curl.h>
+#include <stdlib.h>
+#include "request.h"
+#include "request_context.h"
+#include "request_worker.h"
+
+// The longest a worker sleeps without checking for submissions and settings,
+// in case a wakeup is ever missed
+#define WORKER_MAX_WAIT_MS 1000
+
+
+#if LIBCURL_VERSION_NUM >= 0x074400 /* 7.68.0 */
+
+// Takes every request submitted to the worker so far, and returns them in
+// the order in which they were submitted
+static QueuedRequest *take_submissions(RequestWorker *worker)
+{
+    QueuedRequest *taken, *ordered = 0;
+
+    do {
+        taken = worker->submissions;
+    } while (!__sync_bool_compare_and_swap(&(worker->submissions), taken, 0));
+
+    // The stack is most recent first, so reverse it
+    while (taken) {
+        QueuedRequest *next = taken->next;
+        taken->next = ordered;
+        ordered = taken;
+        taken = next;
+    }
+
+    return ordered;
+}
+
+
+// Takes every cancellation posted to the worker so far
+static RequestCancel *take_cancels(RequestWorker *worker)
+{
+    RequestCancel *taken;
+
+    do {
+        taken = worker->cancels;
+    } while (!__sync_bool_compare_and_swap(&(worker->cancels), taken, 0));
+
+    return taken;
+}
+
+
+// Brings the settings of the worker's context up to date with its owner's
+static void apply_settings(RequestWorker *worker)
+{
+    S3RequestContext *owner = worker->owner, *context = worker->context;
+
+    if (worker->configGeneration == owner->configGeneration) {
+        return;
+    }
+
+    worker->configGeneration = owner->configGeneration;
+    __sync_synchronize();
+
+    if (owner->verifyPeerSet) {
+        S3_set_request_context_verify_peer(context, owner->verifyPeer);
+    }
+    context->signPayloads = owner->signPayloads;
+    context->completionQueue = owner->completionQueue;
+    S3_set_request_context_max_in_flight(context, owner->maxInFlight);
+    S3_set_request_context_max_connections_per_host
+        (context, owner->maxHostConnections);
+    if (owner->http2 != context->http2) {
+        S3_set_request_context_http2(context, owner->http2,
+                                     owner->maxStreams);
+    }
+    S3_set_request_context_hedging(context, owner->hedgeThresholdMs,
+                                   owner->hedgePercentile);
+    S3_set_request_context_retry_policy(context, &(owner->retryPolicy));
+    S3_set_request_context_timeouts(context, &(owner->timeouts));
+    S3_set_request_context_max_resumes(context, owner->maxResumes);
+    S3_set_request_context_endpoint_balancing
+        (context, owner->endpointBalancing, owner->endpointRefreshMs / 1000);
+}
+
+
+// Counts requests completed by the worker out of the owner's pending count,
+// waking any waiters if that leaves none pending
+static void complete_requests(RequestWorker *worker, int count)
+{
+    S3RequestContext *owner = worker->owner;
+
+    if (!__sync_sub_and_fetch(&(owner->pendingCount), count)) {
+        pthread_mutex_lock(&(owner->idleMutex));
+        pthread_cond_broadcast(&(owner->idleCond));
+        pthread_mutex_unlock(&(owner->idleMutex));
+    }
+}
+
+
+static void *worker_thread(void *arg)
+{
+    RequestWorker *worker = (RequestWorker *) arg;
+
+    while (!worker->stop) {
+        // Settings changed before a request was submitted must apply to it,
+        // so check for them only once the submissions have been taken
+        RequestCancel *cancels = take_cancels(worker);
+        QueuedRequest *submitted = take_submissions(worker);
+        apply_settings(worker);
+        while (submitted) {
+            QueuedRequest *next = submitted->next;
+            worker->takenCount++;
+            request_start(&(submitted->params), worker->context,
+                          submitted->handle, submitted->deadlineMs);
+            free(submitted);
+            submitted = next;
+        }
+        // Most are for requests that other workers have
+        while (cancels) {
+            RequestCancel *next = cancels->next;
+            request_cancel(worker->context, cancels->handle);
+            free(cancels);
+            cancels = next;
+        }
+
+        // Requests completed by this, or which failed to start at all, are
+        // no longer counted among those remaining in the worker's context
+        int requestsRemaining;
+        if (S3_runonce_request_context(worker->context, &requestsRemaining)
+            == S3StatusOK) {
+            if (worker->takenCount > requestsRemaining) {
+                complete_requests(worker,
+                                  worker->takenCount - requestsRemaining);
+                worker->takenCount = requestsRemaining;
+            }
+        }
+
+        // Sleep until there is I/O for curl to do, curl's timer expires, a
+        // hedge or retry is due, or something is submitted or cancelled
+        if (!worker->stop &&
+            !__sync_fetch_and_add(&(worker->submissions), 0) &&
+            !__sync_fetch_and_add(&(worker->cancels), 0)) {
+            int64_t untilRequest = request_timeout(worker->context);
+            curl_multi_poll(worker->context->curlm, 0, 0,
+                            ((untilRequest >= 0) &&
+                             (untilRequest < WORKER_MAX_WAIT_MS)) ?
+                            (int) untilRequest : WORKER_MAX_WAIT_MS, 0);
+        }
+    }
+
+    return 0;
+}
+
+
+S3Status request_workers_start(S3RequestContext *context, int workerCount)
+{
+    S3Status status;
+    int i;
+
+    if (!(context->workers = (RequestWorker *)
+          calloc(workerCount, sizeof(RequestWorker)))) {
+        return S3StatusOutOfMemory;
+    }
+
+    for (i = 0; i < workerCount; i++) {
+        RequestWorker *worker = &(context->workers[i]);
+        worker->owner = context;
+        worker->configGeneration = context->configGeneration;
+        if ((status = S3_create_request_context(&(worker->context)))
+            != S3StatusOK) {
+            break;
+        }
+        if (pthread_create(&(worker->thread), 0, &worker_thread, worker)) {
+            S3_destroy_request_context(worker->context);
+            status = S3StatusInternalError;
+            break;
+        }
+        context->workerCount++;
+    }
+
+    if (context->workerCount < workerCount) {
+        request_workers_stop(context);
+        return status;
+    }
+
+    return S3StatusOK;
+}
+
+
+void request_workers_stop(S3RequestContext *context)
+{
+    int i;
+
+    for (i = 0; i < context->workerCount; i++) {
+        context->workers[i].stop = 1;
+        curl_multi_wakeup(context->workers[i].context->curlm);
+    }
+
+    for (i = 0; i < context->workerCount; i++) {
+        RequestWorker *worker = &(context->workers[i]);
+        pthread_join(worker->thread, 0);
+        // This interrupts the requests which the worker had started
+        S3_destroy_request_context(worker->context);
+        // And these are the ones that it never got to
+        QueuedRequest *submitted = take_submissions(worker);
+        while (submitted) {
+            QueuedRequest *next = submitted->next;
+            request_complete(context, submitted->params.completeCallback,
+                             submitted->params.callbackData,
+                             S3StatusInterrupted, 0, 0);
+            free(submitted);
+            submitted = next;
+        }
+        RequestCancel *cancels = take_cancels(worker);
+        while (cancels) {
+            RequestCancel *next = cancels->next;
+            free(cancels);
+            cancels = next;
+        }
+    }
+
+    free(context->workers);
+    context->workers = 0;
+    context->workerCount = 0;
+    context->pendingCount = 0;
+}
+
+
+void request_workers_submit(S3RequestContext *context,
+                            const RequestParams *params,
+                            S3RequestHandle handle, int64_t deadlineMs)
+{
+    QueuedRequest *submitted = queued_request_create(params);
+    if (!submitted) {
+        request_complete(context, params->completeCallback,
+                         params->callbackData, S3StatusOutOfMemory, 0, 0);
+        return;
+    }
+    submitted->handle = handle;
+    submitted->deadlineMs = deadlineMs;
+
+    RequestWorker *worker = &(context->workers
+                              [__sync_fetch_and_add(&(context->nextWorker), 1) %
+                               context->workerCount]);
+
+    // Counted before it can possibly complete
+    __sync_fetch_and_add(&(context->pendingCount), 1);
+
+    QueuedRequest *head;
+    do {
+        head = worker->submissions;
+        submitted->next = head;
+    } while (!__sync_bool_compare_and_swap(&(worker->submissions), head,
+                                           submitted));
+
+    curl_multi_wakeup(worker->context->curlm);
+}
+
+
+S3Status request_workers_cancel(S3RequestContext *context,
+                                S3RequestHandle handle)
+{
+    RequestCancel *cancels = 0;
+    int i;
+
+    // Allocated up front, so that either every worker is asked or none is
+    for (i = 0; i < context->workerCount; i++) {
+        RequestCancel *cancel = (RequestCancel *) malloc(sizeof(RequestCancel));
+        if (!cancel) {
+            while (cancels) {
+                RequestCancel *next = cancels->next;
+                free(cancels);
+                cancels = next;
+            }
+            return S3StatusOutOfMemory;
+        }
+        cancel->handle = handle;
+        cancel->next = cancels;
+        cancels = cancel;
+    }
+
+    for (i = 0; i < context->workerCount; i++) {
+        RequestWorker *worker = &(context->workers[i]);
+        RequestCancel *cancel = cancels, *head;
+        cancels = cancel->next;
+        do {
+            head = worker->cancels;
+            cancel->next = head;
+        } while (!__sync_bool_compare_and_swap(&(worker->cancels), head,
+                                               cancel));
+        curl_multi_wakeup(worker->context->curlm);
+    }
+
+    return S3StatusOK;
+}
+
+
+void request_workers_wait(S3RequestContext *context)
+{
+    pthread_mutex_lock(&(context->idleMutex));
+    while (__sync_fetch_and_add(&(context->pendingCount), 0)) {
+        pthread_cond_wait(&(context->idleCond), &(context->idleMutex));
+    }
+    pthread_mutex_unlock(&(context->idleMutex));
+}
+
+
+void request_workers_configure(S3RequestContext *context)
+{
+    int i;
+
+    __sync_fetch_and_add(&(context->configGeneration), 1);
+
+    for (i = 0; i < context->workerCount; i++) {
+        curl_multi_wakeup(context->workers[i].context->curlm);
+    }
+}
+
+#else
+
+S3Status request_workers_start(S3RequestContext *context, int workerCount)
+{
+    (void) context;
+    (void) workerCount;
+
+    return S3StatusNotSupported;
+}
+
+
+void request_workers_stop(S3RequestContext *context)
+{
+    (void) context;
+}
+
+
+void request_workers_submit(S3RequestContext *context,
+                            const RequestParams *params,
+                            S3RequestHandle handle, int64_t deadlineMs)
+{
+    (void) handle;
+    (void) deadlineMs;
+
+    request_complete(context, params->completeCallback, params->callbackData,
+                     S3StatusNotSupported, 0, 0);
+}
+
+
+S3Status request_workers_cancel(S3RequestContext *context,
+                                S3RequestHandle handle)
+{
+    (void) context;
+    (void) handle;
+
+    return S3StatusNotSupported;
+}
+
+
+void request_workers_wait(S3RequestContext *context)
+{
+    (void) context;
+}
+
+
+void request_workers_configure(S3RequestContext *context)
+{
+    (void) context;
+}
+
+#endif
@@ -186,7 +186,8 @@ void S3_list_service(S3Protocol protocol, const char *accessKeyId,
         &dataCallback,                                // fromS3Callback
         &completeCallback,                            // completeCallback
         data,                                         // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -347,7 +347,8 @@ void S3_get_server_access_logging(const S3BucketContext *bucketContext,
         &getBlsDataCallback,                          // fromS3Callback
         &getBlsCompleteCallback,                      // completeCallback
         gsData,                                       // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
@@ -555,7 +556,8 @@ void S3_set_server_access_logging(const S3BucketContext *bucketContext,
         0,                                            // fromS3Callback
         &setSalCompleteCallback,                      // completeCallback
         data,                                         // callbackData
-        timeoutMs                                     // timeoutMs
+        timeoutMs,                                    // timeoutMs
+        0                                             // toS3CallbackRewindable
     };
 
     // Perform the request
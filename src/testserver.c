@@ -0,0 +1,803 @@
+/** **************************************************************************
+ * testserver.c
+ *
+ * Copyright 2008 Bryan Ischo <bryan@ischo.com>
+ *
+ * This file is part of libs3.
+ *
+ * libs3 is free software: you can redistribute it and/or modify it under the
+ * terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation, version 3 of the License.
+ *
+ * In addition, as a special exception, the copyright holders give
+ * permission to link the code of this library and its programs with the
+ * OpenSSL library, and distribute linked combinations including the two.
+ *
+ * libs3 is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * version 3 along with libs3, in a file named COPYING.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ *
+ ************************************************************************** **/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include "testserver.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+#define MAX_REQUEST_HEADER_SIZE 16384
+
+typedef struct Connection
+{
+    int fd;
+
+    // Bytes read from the client which have not been processed yet
+    char in[MAX_REQUEST_HEADER_SIZE];
+    int inLen;
+
+    // Request body bytes still to be read before the response can be sent
+    long long bodyRemaining;
+
+    // Method and path of the request whose body is being read
+    char method[16];
+    char path[256];
+
+    // The byte range asked for (rangeStart is -1 if none; rangeEnd is -1 if
+    // open-ended), and the If-Match header, if any
+    long long rangeStart, rangeEnd;
+    char ifMatch[64];
+
+    // For a body in aws-chunked encoding: nonzero while one is being read,
+    // and once it is found to be bad; the part of the body being read
+    // (CHUNK_XXX); the chunk header read so far; the chunk data still to
+    // come; and the decoded length announced, and read so far
+    int chunked, chunkedBad, chunkPart;
+    char chunkHeader[128];
+    int chunkHeaderLen;
+    long long chunkRemaining, decodedLength, decodedCount;
+
+    // What the chunk signatures are checked with: the signing key (if the
+    // server has the secret), request date and credential scope; the
+    // signature of the chunk before; the signature the chunk being read
+    // claims; and the digest of its data
+    int chunkSigning;
+    unsigned char signingKey[32];
+    char date[17], scope[128], previousSignature[65], chunkSignature[65];
+    EVP_MD_CTX *digest;
+
+    // Nonzero once the response has been cut short, after which the
+    // connection is closed as soon as it has been written
+    int closeAfterOutput;
+
+    // Response bytes not yet written to the client
+    char *out;
+    size_t outLen, outPos, outCap;
+} Connection;
+
+
+// The parts of an aws-chunked body
+#define CHUNK_HEADER 0
+#define CHUNK_DATA 1
+#define CHUNK_DATA_END 2
+#define CHUNK_DONE 3
+
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+
+static void out_append(Connection *c, const char *data, size_t len)
+{
+    if ((c->outLen + len) > c->outCap) {
+        while ((c->outLen + len) > c->outCap) {
+            c->outCap = c->outCap ? (c->outCap * 2) : 4096;
+        }
+        c->out = (char *) realloc(c->out, c->outCap);
+    }
+    memcpy(&(c->out[c->outLen]), data, len);
+    c->outLen += len;
+}
+
+
+static void respond(TestServer *server, Connection *c)
+{
+    char header[512];
+    int len;
+
+    if (strstr(c->path, "/slow") && (server->slowCount > 0)) {
+        __sync_fetch_and_sub(&(server->slowCount), 1);
+        return;
+    }
+
+    if (strstr(c->path, "/flaky") && (server->failCount > 0)) {
+        static const char body[] =
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<Error><Code>InternalError</Code>"
+            "<Message>We encountered an internal error.</Message>"
+            "<RequestId>testrequestid</RequestId></Error>";
+        __sync_fetch_and_sub(&(server->failCount), 1);
+        int bodyLen = strcmp(c->method, "HEAD") ? (sizeof(body) - 1) : 0;
+        len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 500 Internal Server Error\r\n"
+                       "x-amz-request-id: testrequestid\r\n"
+                       "Content-Type: application/xml\r\n"
+                       "Content-Length: %d\r\n"
+                       "\r\n", (int) (sizeof(body) - 1));
+        out_append(c, header, len);
+        out_append(c, body, bodyLen);
+    }
+    else if (strstr(c->path, "/busy") && (server->busyCount > 0)) {
+        static const char body[] =
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<Error><Code>SlowDown</Code>"
+            "<Message>Please reduce your request rate.</Message>"
+            "<RequestId>testrequestid</RequestId></Error>";
+        __sync_fetch_and_sub(&(server->busyCount), 1);
+        int bodyLen = strcmp(c->method, "HEAD") ? (sizeof(body) - 1) : 0;
+        len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 503 Slow Down\r\n"
+                       "x-amz-request-id: testrequestid\r\n"
+                       "Content-Type: application/xml\r\n"
+                       "Content-Length: %d\r\n"
+                       "\r\n", (int) (sizeof(body) - 1));
+        out_append(c, header, len);
+        out_append(c, body, bodyLen);
+    }
+    else if (strstr(c->path, "/missing")) {
+        static const char body[] =
+            "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+            "<Error><Code>NoSuchKey</Code>"
+            "<Message>The specified key does not exist.</Message>"
+            "<Resource>/missing</Resource>"
+            "<RequestId>testrequestid</RequestId></Error>";
+        int bodyLen = strcmp(c->method, "HEAD") ? (sizeof(body) - 1) : 0;
+        len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 404 Not Found\r\n"
+                       "x-amz-request-id: testrequestid\r\n"
+                       "Content-Type: application/xml\r\n"
+                       "Content-Length: %d\r\n"
+                       "\r\n", (int) (sizeof(body) - 1));
+        out_append(c, header, len);
+        out_append(c, body, bodyLen);
+    }
+    else if (c->ifMatch[0] && strcmp(c->ifMatch, TEST_SERVER_ETAG)) {
+        len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 412 Precondition Failed\r\n"
+                       "x-amz-request-id: testrequestid\r\n"
+                       "Content-Length: 0\r\n"
+                       "\r\n");
+        out_append(c, header, len);
+    }
+    else if (!strcmp(c->method, "GET") || !strcmp(c->method, "HEAD")) {
+        long long start = 0, end = server->bodySize - 1;
+        if ((c->rangeStart >= 0) && (c->rangeStart < server->bodySize)) {
+            start = c->rangeStart;
+            if ((c->rangeEnd >= start) && (c->rangeEnd < end)) {
+                end = c->rangeEnd;
+            }
+            len = snprintf(header, sizeof(header),
+                           "HTTP/1.1 206 Partial Content\r\n"
+                           "Content-Range: bytes %lld-%lld/%d\r\n",
+                           start, end, server->bodySize);
+        }
+        else {
+            len = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n");
+        }
+        len += snprintf(&(header[len]), sizeof(header) - len,
+                        "x-amz-request-id: testrequestid\r\n"
+                        "Content-Length: %lld\r\n"
+                        "ETag: " TEST_SERVER_ETAG "\r\n"
+                        "Last-Modified: Tue, 01 Jan 2008 00:00:00 GMT\r\n"
+                        "\r\n", (end - start) + 1);
+        out_append(c, header, len);
+        if (!strcmp(c->method, "GET")) {
+            // A response which is cut short stops halfway, and then either
+            // stalls or is closed
+            int stall = strstr(c->path, "/stall") && (server->stallCount > 0);
+            int cut = strstr(c->path, "/cut") && (server->cutCount > 0);
+            if (stall) {
+                __sync_fetch_and_sub(&(server->stallCount), 1);
+            }
+            if (cut) {
+                __sync_fetch_and_sub(&(server->cutCount), 1);
+                c->closeAfterOutput = 1;
+            }
+            if (stall || cut) {
+                end = start + ((end - start) / 2);
+            }
+            char body[4096];
+            while (start <= end) {
+                int amt = 0;
+                while ((amt < (int) sizeof(body)) && (start <= end)) {
+                    body[amt++] = TEST_SERVER_BODY_BYTE(start++);
+                }
+                out_append(c, body, amt);
+            }
+        }
+    }
+    else if (!strcmp(c->method, "DELETE")) {
+        len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 204 No Content\r\n\r\n");
+        out_append(c, header, len);
+    }
+    else {
+        len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 200 OK\r\n"
+                       "Content-Length: 0\r\n"
+                       "ETag: " TEST_SERVER_ETAG "\r\n"
+                       "\r\n");
+        out_append(c, header, len);
+    }
+
+    __sync_fetch_and_add(&(server->requestCount), 1);
+}
+
+
+// Answers a request whose body in aws-chunked encoding was not intact
+static void respond_bad_signature(TestServer *server, Connection *c)
+{
+    static const char body[] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+        "<Error><Code>SignatureDoesNotMatch</Code>"
+        "<Message>The request signature we calculated does not match the "
+        "signature you provided.</Message>"
+        "<RequestId>testrequestid</RequestId></Error>";
+    char header[256];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 403 Forbidden\r\n"
+                       "x-amz-request-id: testrequestid\r\n"
+                       "Content-Type: application/xml\r\n"
+                       "Content-Length: %d\r\n"
+                       "\r\n", (int) (sizeof(body) - 1));
+    out_append(c, header, len);
+    out_append(c, body, sizeof(body) - 1);
+
+    __sync_fetch_and_add(&(server->requestCount), 1);
+}
+
+
+// Returns the value of the named header within the request headers, or 0
+static const char *find_header(const char *headers, const char *name)
+{
+    size_t nameLen = strlen(name);
+    const char *line = strstr(headers, "\r\n");
+
+    while (line && line[2]) {
+        line += 2;
+        if (!strncasecmp(line, name, nameLen) && (line[nameLen] == ':')) {
+            const char *value = &(line[nameLen + 1]);
+            while (*value == ' ') {
+                value++;
+            }
+            return value;
+        }
+        line = strstr(line, "\r\n");
+    }
+
+    return 0;
+}
+
+
+// Records the names of the headers which the request's Authorization header
+// signs, and counts the request if any of them is not among its headers
+static void check_signed_headers(TestServer *server, const char *headers)
+{
+    const char *auth = find_header(headers, "Authorization");
+    const char *names = auth ? strstr(auth, "SignedHeaders=") : 0;
+    int len = 0;
+
+    if (names) {
+        names += sizeof("SignedHeaders=") - 1;
+        len = strcspn(names, ",\r");
+        if (len >= (int) sizeof(server->lastSignedHeaders)) {
+            len = sizeof(server->lastSignedHeaders) - 1;
+        }
+        memcpy(server->lastSignedHeaders, names, len);
+    }
+    server->lastSignedHeaders[len] = 0;
+
+    char name[256];
+    const char *start = server->lastSignedHeaders;
+    while (*start) {
+        int nameLen = strcspn(start, ";");
+        if (nameLen < (int) sizeof(name)) {
+            memcpy(name, start, nameLen);
+            name[nameLen] = 0;
+            if (!find_header(headers, name)) {
+                __sync_fetch_and_add(&(server->unsentSignedCount), 1);
+                break;
+            }
+        }
+        start += nameLen + (start[nameLen] == ';');
+    }
+}
+
+
+static void hex_encode(const unsigned char *bytes, int len, char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+    int i;
+
+    for (i = 0; i < len; i++) {
+        hex[2 * i] = digits[bytes[i] >> 4];
+        hex[(2 * i) + 1] = digits[bytes[i] & 0xF];
+    }
+    hex[2 * len] = 0;
+}
+
+
+// Begins reading a body in aws-chunked encoding, taking what its chunk
+// signatures are checked with from the request headers
+static void chunked_start(TestServer *server, Connection *c)
+{
+    c->chunked = 1;
+    c->chunkedBad = 0;
+    c->chunkPart = CHUNK_HEADER;
+    c->chunkHeaderLen = 0;
+    c->decodedCount = 0;
+    c->chunkSigning = 0;
+
+    const char *value = find_header(c->in, "x-amz-decoded-content-length");
+    c->decodedLength = value ? atoll(value) : -1;
+
+    if (!server->secretAccessKey) {
+        return;
+    }
+
+    // The scope follows the access key id in the credential, and the seed
+    // signature is the request's own
+    const char *auth = find_header(c->in, "Authorization");
+    const char *date = find_header(c->in, "x-amz-date");
+    const char *scope = auth ? strstr(auth, "Credential=") : 0;
+    const char *signature = auth ? strstr(auth, "Signature=") : 0;
+    if (!date || !scope || !signature || !(scope = strchr(scope, '/'))) {
+        c->chunkedBad = 1;
+        return;
+    }
+    scope++;
+    signature += 10;
+    int scopeLen = strcspn(scope, ",\r");
+    if ((scopeLen >= (int) sizeof(c->scope)) ||
+        (strcspn(date, "\r") != 16) || (strcspn(signature, "\r") != 64)) {
+        c->chunkedBad = 1;
+        return;
+    }
+    memcpy(c->scope, scope, scopeLen);
+    c->scope[scopeLen] = 0;
+    memcpy(c->date, date, 16);
+    c->date[16] = 0;
+    memcpy(c->previousSignature, signature, 64);
+    c->previousSignature[64] = 0;
+
+    // The signing key is the HMAC chain of the parts of the scope (date,
+    // region, service and "aws4_request"), keyed first by the secret
+    unsigned char key[128];
+    unsigned int keyLen = snprintf((char *) key, sizeof(key), "AWS4%s",
+                                   server->secretAccessKey);
+    const char *part = c->scope;
+    while (*part) {
+        int partLen = strcspn(part, "/");
+        HMAC(EVP_sha256(), key, keyLen, (const unsigned char *) part,
+             partLen, c->signingKey, &keyLen);
+        memcpy(key, c->signingKey, keyLen);
+        part += partLen + (part[partLen] == '/');
+    }
+
+    if (!c->digest && !(c->digest = EVP_MD_CTX_new())) {
+        c->chunkedBad = 1;
+        return;
+    }
+    c->chunkSigning = 1;
+}
+
+
+// Checks the signature of the chunk just read, whose data has been digested
+static void chunk_check(Connection *c)
+{
+    static const char emptyHash[] =
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+    unsigned char hash[32];
+    char hashHex[65], stringToSign[512], signatureHex[65];
+
+    EVP_DigestFinal_ex(c->digest, hash, NULL);
+    hex_encode(hash, 32, hashHex);
+    int len = snprintf(stringToSign, sizeof(stringToSign),
+                       "AWS4-HMAC-SHA256-PAYLOAD\n%s\n%s\n%s\n%s\n%s",
+                       c->date, c->scope, c->previousSignature, emptyHash,
+                       hashHex);
+    HMAC(EVP_sha256(), c->signingKey, 32, (const unsigned char *) stringToSign,
+         len, hash, NULL);
+    hex_encode(hash, 32, signatureHex);
+
+    if (strcmp(signatureHex, c->chunkSignature)) {
+        c->chunkedBad = 1;
+    }
+    strcpy(c->previousSignature, signatureHex);
+}
+
+
+// Parses the chunk header just read; returns nonzero if it is malformed
+static int chunk_header(Connection *c)
+{
+    char *end;
+
+    c->chunkHeader[c->chunkHeaderLen] = 0;
+    c->chunkRemaining = strtoll(c->chunkHeader, &end, 16);
+    if ((end == c->chunkHeader) || (c->chunkRemaining < 0) ||
+        strncmp(end, ";chunk-signature=", 17) ||
+        (strlen(&(end[17])) != 66)) {
+        return 1;
+    }
+    memcpy(c->chunkSignature, &(end[17]), 64);
+    c->chunkSignature[64] = 0;
+
+    if (c->chunkSigning) {
+        EVP_DigestInit_ex(c->digest, EVP_sha256(), NULL);
+    }
+    return 0;
+}
+
+
+// Decodes the next part of a body in aws-chunked encoding, noting whether
+// it is intact
+static void chunked_read(Connection *c, const char *data, int len)
+{
+    while (len && !c->chunkedBad) {
+        switch (c->chunkPart) {
+        case CHUNK_HEADER: {
+            // The header runs to its "\r\n"
+            int amt = 0;
+            while ((amt < len) && (data[amt] != '\n')) {
+                amt++;
+            }
+            int end = (amt < len);
+            amt += end;
+            if ((c->chunkHeaderLen + amt) >= (int) sizeof(c->chunkHeader)) {
+                c->chunkedBad = 1;
+                break;
+            }
+            memcpy(&(c->chunkHeader[c->chunkHeaderLen]), data, amt);
+            c->chunkHeaderLen += amt;
+            data += amt, len -= amt;
+            if (end) {
+                c->chunkedBad = chunk_header(c);
+                c->chunkHeaderLen = 0;
+                c->chunkPart = CHUNK_DATA;
+            }
+            break;
+        }
+        case CHUNK_DATA: {
+            int amt = (len < c->chunkRemaining) ? len : (int) c->chunkRemaining;
+            if (c->chunkSigning) {
+                EVP_DigestUpdate(c->digest, data, amt);
+            }
+            c->chunkRemaining -= amt;
+            c->decodedCount += amt;
+            data += amt, len -= amt;
+            if (!c->chunkRemaining) {
+                c->chunkPart = CHUNK_DATA_END;
+            }
+            break;
+        }
+        case CHUNK_DATA_END:
+            // The data's "\r\n", which may arrive a byte at a time
+            if (*data != ((c->chunkHeaderLen++) ? '\n' : '\r')) {
+                c->chunkedBad = 1;
+                break;
+            }
+            data++, len--;
+            if (c->chunkHeaderLen == 2) {
+                c->chunkHeaderLen = 0;
+                if (c->chunkSigning) {
+                    chunk_check(c);
+                }
+                // Only the empty chunk ends the body
+                c->chunkPart = (c->chunkHeader[0] == '0') &&
+                    (c->chunkHeader[1] == ';') ? CHUNK_DONE : CHUNK_HEADER;
+            }
+            break;
+        default:
+            // Nothing may follow the empty chunk
+            c->chunkedBad = 1;
+            break;
+        }
+    }
+}
+
+
+// Ends reading a body in aws-chunked encoding; returns nonzero if it was
+// intact
+static int chunked_finish(TestServer *server, Connection *c)
+{
+    int intact = !c->chunkedBad && (c->chunkPart == CHUNK_DONE) &&
+        ((c->decodedLength < 0) || (c->decodedCount == c->decodedLength));
+
+    c->chunked = 0;
+    __sync_fetch_and_add(intact ? &(server->chunkedCount) :
+                         &(server->badChunkedCount), 1);
+    return intact;
+}
+
+
+// Processes as much buffered input as possible; returns nonzero if the
+// connection should be closed
+static int process_input(TestServer *server, Connection *c)
+{
+    while (1) {
+        if (c->bodyRemaining) {
+            int amt = (c->inLen < c->bodyRemaining) ?
+                c->inLen : (int) c->bodyRemaining;
+            if (c->chunked) {
+                chunked_read(c, c->in, amt);
+            }
+            memmove(c->in, &(c->in[amt]), c->inLen - amt);
+            c->inLen -= amt;
+            c->bodyRemaining -= amt;
+            if (c->bodyRemaining) {
+                return 0;
+            }
+            if (c->chunked && !chunked_finish(server, c)) {
+                respond_bad_signature(server, c);
+                continue;
+            }
+            respond(server, c);
+            continue;
+        }
+
+        c->in[c->inLen] = 0;
+        char *end = strstr(c->in, "\r\n\r\n");
+        if (!end) {
+            return (c->inLen == (MAX_REQUEST_HEADER_SIZE - 1));
+        }
+        end[2] = 0;
+
+        if (sscanf(c->in, "%15s %255s", c->method, c->path) != 2) {
+            return 1;
+        }
+
+        int lineLen = strstr(c->in, "\r\n") - c->in;
+        if (lineLen >= (int) sizeof(server->lastRequestLine)) {
+            lineLen = sizeof(server->lastRequestLine) - 1;
+        }
+        memcpy(server->lastRequestLine, c->in, lineLen);
+        server->lastRequestLine[lineLen] = 0;
+
+        check_signed_headers(server, c->in);
+
+        const char *value = find_header(c->in, "Content-Length");
+        c->bodyRemaining = value ? atoll(value) : 0;
+
+        c->rangeStart = c->rangeEnd = -1;
+        value = find_header(c->in, "Range");
+        if (value && !strncmp(value, "bytes=", 6)) {
+            char *dash;
+            c->rangeStart = strtoll(&(value[6]), &dash, 10);
+            if ((*dash == '-') && (dash[1] >= '0') && (dash[1] <= '9')) {
+                c->rangeEnd = atoll(&(dash[1]));
+            }
+        }
+
+        c->ifMatch[0] = 0;
+        value = find_header(c->in, "If-Match");
+        if (value) {
+            int valueLen = strcspn(value, "\r");
+            if (valueLen >= (int) sizeof(c->ifMatch)) {
+                valueLen = sizeof(c->ifMatch) - 1;
+            }
+            memcpy(c->ifMatch, value, valueLen);
+            c->ifMatch[valueLen] = 0;
+        }
+
+        value = find_header(c->in, "Content-Encoding");
+        if (value && c->bodyRemaining &&
+            !strncasecmp(value, "aws-chunked", 11)) {
+            chunked_start(server, c);
+        }
+
+        value = find_header(c->in, "Expect");
+        if (value && c->bodyRemaining &&
+            !strncasecmp(value, "100-continue", 12)) {
+            static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            out_append(c, cont, sizeof(cont) - 1);
+        }
+
+        int headerLen = (end + 4) - c->in;
+        memmove(c->in, &(c->in[headerLen]), c->inLen - headerLen);
+        c->inLen -= headerLen;
+
+        if (!c->bodyRemaining) {
+            respond(server, c);
+        }
+    }
+}
+
+
+// Writes as much pending output as possible; returns nonzero if the
+// connection should be closed
+static int flush_output(TestServer *server, Connection *c)
+{
+    struct epoll_event ev;
+    ev.data.ptr = c;
+
+    while (c->outPos < c->outLen) {
+        ssize_t amt = write(c->fd, &(c->out[c->outPos]),
+                            c->outLen - c->outPos);
+        if (amt < 0) {
+            if (errno != EAGAIN) {
+                return 1;
+            }
+            // Wait for the client to drain its socket
+            ev.events = EPOLLIN | EPOLLOUT;
+            epoll_ctl(server->epollFd, EPOLL_CTL_MOD, c->fd, &ev);
+            return 0;
+        }
+        c->outPos += amt;
+    }
+
+    c->outPos = c->outLen = 0;
+
+    if (c->closeAfterOutput) {
+        return 1;
+    }
+
+    ev.events = EPOLLIN;
+    epoll_ctl(server->epollFd, EPOLL_CTL_MOD, c->fd, &ev);
+
+    return 0;
+}
+
+
+static void connection_close(TestServer *server, Connection *c)
+{
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, c->fd, 0);
+    close(c->fd);
+    if (c->digest) {
+        EVP_MD_CTX_free(c->digest);
+    }
+    free(c->out);
+    free(c);
+}
+
+
+static void *server_thread(void *data)
+{
+    TestServer *server = (TestServer *) data;
+    struct epoll_event events[256];
+
+    while (1) {
+        int count = epoll_wait(server->epollFd, events,
+                               sizeof(events) / sizeof(events[0]), -1);
+        int i;
+        for (i = 0; i < count; i++) {
+            if (events[i].data.ptr == &(server->stopPipe)) {
+                return 0;
+            }
+            if (events[i].data.ptr == &(server->listenFd)) {
+                int fd;
+                while ((fd = accept(server->listenFd, 0, 0)) >= 0) {
+                    set_nonblocking(fd);
+                    Connection *c =
+                        (Connection *) calloc(1, sizeof(Connection));
+                    c->fd = fd;
+                    struct epoll_event ev;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &ev);
+                    __sync_fetch_and_add(&(server->acceptCount), 1);
+                }
+                continue;
+            }
+
+            Connection *c = (Connection *) events[i].data.ptr;
+            int closeIt = 0;
+            if (events[i].events & EPOLLIN) {
+                ssize_t amt = read(c->fd, &(c->in[c->inLen]),
+                                   MAX_REQUEST_HEADER_SIZE - 1 - c->inLen);
+                if (amt > 0) {
+                    c->inLen += amt;
+                    closeIt = process_input(server, c);
+                }
+                else if ((amt == 0) || (errno != EAGAIN)) {
+                    closeIt = 1;
+                }
+            }
+            if (!closeIt && (c->outPos < c->outLen)) {
+                closeIt = flush_output(server, c);
+            }
+            if (!closeIt && (events[i].events & (EPOLLHUP | EPOLLERR))) {
+                closeIt = 1;
+            }
+            if (closeIt) {
+                connection_close(server, c);
+            }
+        }
+    }
+}
+
+
+int test_server_start(TestServer *server)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int one = 1;
+
+    server->acceptCount = 0;
+    server->requestCount = 0;
+    server->slowCount = 0;
+    server->failCount = 0;
+    server->busyCount = 0;
+    server->stallCount = 0;
+    server->cutCount = 0;
+    server->chunkedCount = 0;
+    server->badChunkedCount = 0;
+
+    if ((server->listenFd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        return -1;
+    }
+    setsockopt(server->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    if (bind(server->listenFd, (struct sockaddr *) &addr, sizeof(addr)) ||
+        listen(server->listenFd, 4096) ||
+        getsockname(server->listenFd, (struct sockaddr *) &addr, &addrLen)) {
+        close(server->listenFd);
+        return -1;
+    }
+    server->port = ntohs(addr.sin_port);
+    set_nonblocking(server->listenFd);
+
+    if (pipe(server->stopPipe)) {
+        close(server->listenFd);
+        return -1;
+    }
+
+    server->epollFd = epoll_create(256);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = &(server->listenFd);
+    epoll_ctl(server->epollFd, EPOLL_CTL_ADD, server->listenFd, &ev);
+    ev.data.ptr = &(server->stopPipe);
+    epoll_ctl(server->epollFd, EPOLL_CTL_ADD, server->stopPipe[0], &ev);
+
+    return pthread_create(&(server->thread), 0, &server_thread, server);
+}
+
+
+void test_server_stop(TestServer *server)
+{
+    if (write(server->stopPipe[1], "x", 1) != 1) {
+        return;
+    }
+    pthread_join(server->thread, 0);
+
+    close(server->stopPipe[0]);
+    close(server->stopPipe[1]);
+    close(server->listenFd);
+    close(server->epollFd);
+}
@@ -26,6 +26,7 @@
 
 #include <ctype.h>
 #include <string.h>
+#include <time.h>
 #include "util.h"
 
 
@@ -53,6 +54,85 @@ static int checkString(const char *str, const char *format)
     return 1;
 }
 
+// The vector encoding loops need GCC's vector extensions and function
+// targets, and CPU detection
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    !defined(__APPLE__)
+#define URLENCODE_VECTORS
+#endif
+
+// The shortest input which 32 byte vectors are chosen for.  Below it they
+// cover at most one vector's worth of a typical key, and lose to 16 byte
+// vectors starting straight away.
+#define URLENCODE_WIDE_MIN_LEN 64
+
+// The vector width set by urlEncodeSetWidth (0 to choose it)
+static int setWidthG = 0;
+
+
+// Returns nonzero if the character is left as it is by URL-encoding; unlike
+// isalnum, this does not depend on the locale
+static int is_unreserved(unsigned char c, int encodeSlash)
+{
+    unsigned char lower = c | 0x20;
+
+    return (((c >= '0') && (c <= '9')) || ((lower >= 'a') && (lower <= 'z')) ||
+            (c == '-') || (c == '_') || (c == '.') || (c == '~') ||
+            ((c == '/') && !encodeSlash));
+}
+
+
+// URL-encodes a character which is not unreserved, returning the end of
+// what was written
+static char *url_encode_byte(char *dest, unsigned char c)
+{
+    static const char *hex = "0123456789ABCDEF";
+
+    dest[0] = '%';
+    dest[1] = hex[c >> 4];
+    dest[2] = hex[c & 15];
+
+    return &(dest[3]);
+}
+
+
+#ifdef URLENCODE_VECTORS
+
+#define URLENCODE_WIDTH 16
+#define URLENCODE_TARGET "sse2"
+#define URLENCODE_NAME(name) name##_sse2
+#include "urlencode_kernels.h"
+#undef URLENCODE_WIDTH
+#undef URLENCODE_TARGET
+#undef URLENCODE_NAME
+
+#define URLENCODE_WIDTH 32
+#define URLENCODE_TARGET "avx2"
+#define URLENCODE_NAME(name) name##_avx2
+#include "urlencode_kernels.h"
+#undef URLENCODE_WIDTH
+#undef URLENCODE_TARGET
+#undef URLENCODE_NAME
+
+
+// Returns the width of the widest vectors the CPU has, in bytes (1 if it has
+// none which are used)
+static int cpu_width()
+{
+    static int widthG = 0;
+
+    if (!widthG) {
+        __builtin_cpu_init();
+        widthG = __builtin_cpu_supports("avx2") ? 32 :
+            __builtin_cpu_supports("sse2") ? 16 : 1;
+    }
+
+    return widthG;
+}
+
+#endif /* URLENCODE_VECTORS */
+
+
 /*
  * Encode rules:
  * 1. Every byte except: 'A'-'Z', 'a'-'z', '0'-'9', '-', '.', '_', and '~'
@@ -62,27 +142,39 @@ static int checkString(const char *str, const char *format)
  */
 int urlEncode(char *dest, const char *src, int maxSrcSize, int encodeSlash)
 {
-    static const char *hex = "0123456789ABCDEF";
+    const unsigned char *in = (const unsigned char *) src;
+    size_t srcLen = src ? strlen(src) : 0;
 
-    int len = 0;
+    if (srcLen > (size_t) ((maxSrcSize < 0) ? 0 : maxSrcSize)) {
+        *dest = 0;
+        return 0;
+    }
 
-    if (src) while (*src) {
-        if (++len > maxSrcSize) {
-            *dest = 0;
-            return 0;
-        }
-        unsigned char c = *src;
-        if (isalnum(c) ||
-            (c == '-') || (c == '_') || (c == '.') ||
-            (c == '~') || (c == '/' && !encodeSlash)) {
-            *dest++ = c;
+    int len = srcLen, i = 0;
+
+#ifdef URLENCODE_VECTORS
+    // The widest vectors take as much as they can, and the narrower ones
+    // what is left of that; unless set, 32 byte vectors are only used for
+    // longer input
+    int width = cpu_width();
+    if (setWidthG && (setWidthG < width)) {
+        width = (setWidthG >= 16) ? 16 : 1;
+    }
+    if ((width == 32) && (setWidthG || (len >= URLENCODE_WIDE_MIN_LEN))) {
+        i = url_encode_vectors_avx2(&dest, in, len, encodeSlash);
+    }
+    if (width >= 16) {
+        i += url_encode_vectors_sse2(&dest, &(in[i]), len - i, encodeSlash);
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (is_unreserved(in[i], encodeSlash)) {
+            *dest++ = in[i];
         }
         else {
-            *dest++ = '%';
-            *dest++ = hex[c >> 4];
-            *dest++ = hex[c & 15];
+            dest = url_encode_byte(dest, in[i]);
         }
-        src++;
     }
 
     *dest = 0;
@@ -91,6 +183,18 @@ int urlEncode(char *dest, const char *src, int maxSrcSize, int encodeSlash)
 }
 
 
+int urlEncodeSetWidth(int width)
+{
+    setWidthG = width;
+
+#ifdef URLENCODE_VECTORS
+    return cpu_width();
+#else
+    return 1;
+#endif
+}
+
+
 int64_t parseIso8601Time(const char *str)
 {
     // Check to make sure that it has a valid format
@@ -173,3 +277,47 @@ int is_blank(char c)
 {
     return ((c == ' ') || (c == '\t'));
 }
+
+
+int64_t monotonic_ms()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (((int64_t) ts.tv_sec) * 1000) + (ts.tv_nsec / 1000000);
+}
+
+
+void hex_encode(const unsigned char *bytes, int len, char *hex)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    while (len--) {
+        *hex++ = digits[*bytes >> 4];
+        *hex++ = digits[*bytes++ & 15];
+    }
+    *hex = 0;
+}
+
+
+void base64_encode(const unsigned char *bytes, int len, char *base64)
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    for (; len > 0; bytes += 3, len -= 3) {
+        uint32_t bits = (uint32_t) bytes[0] << 16;
+        if (len > 1) {
+            bits |= (uint32_t) bytes[1] << 8;
+        }
+        if (len > 2) {
+            bits |= bytes[2];
+        }
+        *base64++ = digits[bits >> 18];
+        *base64++ = digits[(bits >> 12) & 63];
+        *base64++ = (len > 1) ? digits[(bits >> 6) & 63] : '=';
+        *base64++ = (len > 2) ? digits[bits & 63] : '=';
+    }
+    *base64 = 0;
+}